@@ -30,13 +30,57 @@
  */
 #define  __STDC_FORMAT_MACROS
 #include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <link.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/auxv.h>
 #include <sys/mman.h>
-#include <android/log.h>
+#include <sys/ucontext.h>
+#include <sys/syscall.h>
 
-#if defined(__aarch64__)
+/*
+ * A64_LOG_SINK: 在编译期选择日志的输出方式
+ *
+ *   A64_LOG_SINK_NONE(0):    丢弃所有日志
+ *   A64_LOG_SINK_ANDROID(1): __android_log_print, Android 上的默认值
+ *   A64_LOG_SINK_STDERR(2):  写到 stderr, 其他 Linux(glibc/musl) 上的默认值
+ *   A64_LOG_SINK_CUSTOM(3):  交给使用者实现的 A64LogWrite(prio, fmt, ...), 例如转发到自己的日志系统
+ *
+ * 通过 -DA64_LOG_SINK=<n> 指定, CMake 中对应 A64_LOG_SINK 缓存变量。
+ */
+#define   A64_LOG_SINK_NONE    0
+#define   A64_LOG_SINK_ANDROID 1
+#define   A64_LOG_SINK_STDERR  2
+#define   A64_LOG_SINK_CUSTOM  3
+#ifndef A64_LOG_SINK
+# if defined(__ANDROID__)
+#  define A64_LOG_SINK         A64_LOG_SINK_ANDROID
+# else
+#  define A64_LOG_SINK         A64_LOG_SINK_STDERR
+# endif
+#endif // A64_LOG_SINK
+
+#if A64_LOG_SINK == A64_LOG_SINK_ANDROID
+# include <android/log.h>
+#endif
+
+/*
+ * A64_HOST_RELOCATOR: 在非 AArch64 主机上只编译指令修复(重定位)部分
+ *
+ * 供主机上运行的基准测试和工具以源码包含的方式使用 __fix_instructions, 或者构建只导出
+ * A64Relocate 的主机库(CMake 在非 AArch64 目标上自动定义)。
+ * 此时计时改用 CLOCK_MONOTONIC, Hook 安装相关的代码不参与编译。
+ */
+#if defined(__aarch64__) || defined(A64_HOST_RELOCATOR)
 
 #include "And64InlineHook.hpp"
 
@@ -71,14 +115,141 @@
  */
 #define   A64_NOP              0xd503201fu
 
+/*
+ * A64_BTI_C: BTI c, 间接调用(BLR, 以及经 X16/X17 的 BR)的着陆指令
+ *
+ * 同样属于 HINT 指令族, 不支持 BTI 的 CPU 或没有以 PROT_BTI 映射的页上等同于 NOP。
+ */
+#define   A64_BTI_C            0xd503245fu
+
+/*
+ * A64_COVERAGE_ARENA_SITES: 每块覆盖率探针区域(coverage_arena)容纳的探针数量
+ *
+ * 每个探针占用 8 字节的转发代码和 24 字节的描述, 一块区域约 512KB, 按需映射在目标函数附近。
+ */
+#define   A64_COVERAGE_ARENA_SITES 16384
+
+/*
+ * A64_MAX_TRAPS: 以 BRK 陷阱方式安装的 Hook 的最大数量, 见 A64TrapHookFunction
+ */
+#define   A64_MAX_TRAPS        1024
+
+/*
+ * A64_TRAP_BRK: 陷阱 Hook 写入目标函数入口的指令, BRK #0xa64
+ *
+ * 立即数只是为了在调试器和崩溃日志中容易辨认, SIGTRAP 处理函数按 PC 而不是立即数查找 Hook。
+ */
+#define   A64_TRAP_BRK         (0xd4200000u | (0xa64u << 5))
+
+/*
+ * A64_MAX_SNIPPET_WORDS: A64HookInjectSnippet 接受的代码片段的最大指令数量
+ *
+ * 片段和被覆盖的指令一起修复, 每条指令最多展开为 9 个字, 64 条时跳板最多约 2.6KB。
+ */
+#define   A64_MAX_SNIPPET_WORDS 64
+
+/*
+ * A64_SNIPPET_SAVED: A64HookInjectSnippet 会保存和恢复的通用寄存器, 其余的 clobbers 位被忽略
+ *
+ * X0~X8 是参数和间接返回地址寄存器, X18 是平台寄存器, X19~X30 由被调用者保存或保存着返回地址;
+ * X9~X17 在函数入口处不含调用者需要的值, 片段可以直接使用。
+ */
+#define   A64_SNIPPET_SAVED    0x7ffc01ffu
+
+/*
+ * A64_MAX_SYSCALL_SITES: A64SyscallHook 一次最多拦截的 SVC #0 位置数量
+ *
+ * libc 中通常只有几百个, 每个位置占用 56 字节的 syscall_site。
+ */
+#define   A64_MAX_SYSCALL_SITES 8192
+
+/*
+ * A64_SYSCALL_GUARD_SLOTS: 正在执行系统调用处理函数的线程表的大小, 见 __syscall_guard_enter
+ *
+ * 每个线程按线程指针散列到 8 个连续槽位之一, 同时在处理函数中的线程过多、槽位都被占用时,
+ * 新的系统调用直接执行, 不经过处理函数。
+ */
+#define   A64_SYSCALL_GUARD_SLOTS 256
+
+/*
+ * A64_MAX_REWRITE_WORDS: A64HookBlocks 能重写的函数的最大指令数量
+ *
+ * 修复时每条指令需要约 170 字节的临时记录; 重写后的代码还必须在 32KB 以内(见 __rewrite_max_bytes)。
+ */
+#define   A64_MAX_REWRITE_WORDS 4096
+
+/*
+ * A64_SHADOW_DEPTH: 每个线程的影子栈(Shadow Stack)深度
+ *
+ * 探针在函数入口处把真实的返回地址(LR)压入影子栈, 并把 LR 改写为桩代码的出口,
+ * 这样才能在函数返回时记录返回值。嵌套深度超过该值的调用不会被记录出口事件。
+ */
+#define   A64_SHADOW_DEPTH     256
+
+/*
+ * A64_TRACE_RING_RECORDS: 每个线程的追踪环形缓冲区能容纳的记录数量, 必须是 2 的幂
+ *
+ * 每条记录 64 字节, 默认每个线程占用 256KB, 仅在线程第一次产生追踪记录时才分配。
+ */
+#define   A64_TRACE_RING_RECORDS 4096
+
+/*
+ * A64_TRACE_DRAIN_MS: drainer 线程两次批量写出之间的休眠间隔(毫秒)
+ */
+#define   A64_TRACE_DRAIN_MS   10
+
+/*
+ * A64_PROFILE_NODES: 每个线程调用上下文树的最大节点数量
+ *
+ * 每个节点代表一条不同的调用栈(由 A64_PROBE_PROFILE 探针组成), 占用 32 字节;
+ * 哈希表槽位数为节点数的 2 倍, 以保持较低的装载因子。节点用完后新出现的调用栈
+ * 不再被统计, 已有的调用栈不受影响。
+ */
+#define   A64_PROFILE_NODES    4096
+
+/*
+ * A64_THREAD_SLOTS: 线程指针到线程块的索引表(thread_slot)的大小, 必须是 2 的幂
+ *
+ * 每个线程按线程指针散列到 8 个连续槽位之一, 槽位都被占用的线程不会被探针记录。
+ */
+#define   A64_THREAD_SLOTS     4096
+
 #define   A64_JNIEXPORT        __attribute__((visibility("default")))
-#define   A64_LOGE(...)        ((void)__android_log_print(ANDROID_LOG_ERROR, "A64_HOOK", __VA_ARGS__))
+#if A64_LOG_SINK == A64_LOG_SINK_ANDROID
+# define  A64_LOG_PRINT(prio, ...) ((void)__android_log_print(prio, "A64_HOOK", __VA_ARGS__))
+#elif A64_LOG_SINK == A64_LOG_SINK_STDERR
+# define  A64_LOG_PRINT(prio, ...) __log_stderr(prio, __VA_ARGS__)
+#elif A64_LOG_SINK == A64_LOG_SINK_CUSTOM
+# define  A64_LOG_PRINT(prio, ...) A64LogWrite(prio, __VA_ARGS__)
+#else
+# define  A64_LOG_PRINT(prio, ...) ((void)0)
+#endif
+#define   A64_LOGE(...)        A64_LOG_PRINT(A64_LOG_ERROR, __VA_ARGS__)
 #ifndef NDEBUG
-# define  A64_LOGI(...)        ((void)__android_log_print(ANDROID_LOG_INFO, "A64_HOOK", __VA_ARGS__))
+# define  A64_LOGI(...)        A64_LOG_PRINT(A64_LOG_INFO, __VA_ARGS__)
 #else
 # define  A64_LOGI(...)        ((void)0)
 #endif // NDEBUG
 
+#if A64_LOG_SINK == A64_LOG_SINK_STDERR
+/*
+ * __log_stderr: stderr 日志输出, 整行拼好后一次 write, 避免多线程输出交错
+ */
+__attribute__((format(printf, 2, 3)))
+static void __log_stderr(const int prio, const char *fmt, ...)
+{
+    char    buf[512];
+    int     n = snprintf(buf, sizeof(buf), "A64_HOOK %c: ", prio == A64_LOG_ERROR ? 'E' : 'I');
+    va_list ap;
+    va_start(ap, fmt);
+    const int m = vsnprintf(buf + n, sizeof(buf) - 1u - n, fmt, ap);
+    va_end(ap);
+    n = m < 0 ? n : n + m < static_cast<int>(sizeof(buf)) - 1 ? n + m : static_cast<int>(sizeof(buf)) - 1;
+    buf[n++] = '\n';
+    (void)::write(STDERR_FILENO, buf, static_cast<size_t>(n));
+}
+#endif // A64_LOG_SINK_STDERR
+
 /*
  * instruction 类型定义: 指向指令指针的指针
  *
@@ -132,11 +303,68 @@ struct context
         fix_info fmap[A64_MAX_REFERENCES];  // 引用此指令的其他指令的修复信息
     };
 
-    int64_t    basep;  // 原始指令序列的起始地址
-    int64_t    endp;   // 原始指令序列的结束地址
-    insns_info dat[A64_MAX_INSTRUCTIONS];  // 每条原始指令的修复信息
+    int64_t     basep;  // 原始指令序列的起始地址
+    int64_t     endp;   // 原始指令序列的结束地址
+    insns_info *dat;    // 每条原始指令的修复信息, 由调用者提供, 至少 count 个(通常为 A64_MAX_INSTRUCTIONS)
+
+    /*
+     * 地址与读写位置分离(A64Relocate)
+     *
+     * 所有 PC 相对计算都使用虚拟地址: 原始指令的虚拟地址 = 读取位置 + in_bias,
+     * 跳板的虚拟地址 = 写入位置 + out_bias。原位修复(__fix_instructions)时两者都是 0。
+     * dat[].ins 和 fix_info.bp 仍然是写入位置, 它们之间的差值与虚拟地址的差值相同。
+     *
+     * 字面量按虚拟地址读取: src 为 NULL 时直接读内存, 否则只能从 [src_va, src_va + src_size)
+     * 中读取, 超出范围时置 failed。
+     */
+    int64_t        in_bias;
+    int64_t        out_bias;
+    const uint8_t *src;
+    uint64_t       src_va;
+    uint64_t       src_size;
+    uint32_t      *tailp;   // 跳回原函数的指令序列在跳板中的位置
+    bool           failed;
+
+    /*
+     * 整函数重写(A64HookBlocks)
+     *
+     * blocks 非 NULL 时, blocks[i] >= 0 表示第 i 条指令是基本块的开头, 在它之前插入对
+     * counters[blocks[i]] 的原子加一; blockp 是插入的计数代码的位置, 跳到该指令的分支落在那里。
+     * layout 非 NULL 时是上一遍按相同位置试排得到的每条指令的位置, 向后的引用不进入 fmap(不受其容量限制),
+     * 暂存在 deferred 中, 在当前指令写完后的 process_fix_map 中按 layout 回填。
+     */
+    const int32_t  *blocks   = NULL;
+    uint64_t       *counters = NULL;
+    uint32_t       *blockp   = NULL;
+    const uint64_t *layout   = NULL;
+    bool            lse      = false;
+    fix_info        deferred = { NULL, 0u, 0u };
+    intptr_t        deferred_idx = -1;
 
 public:
+    inline int64_t in_va(const uint32_t *p) const {
+        return static_cast<int64_t>(reinterpret_cast<uint64_t>(p) + static_cast<uint64_t>(this->in_bias));
+    }
+
+    inline int64_t out_va(const uint32_t *p) const {
+        return static_cast<int64_t>(reinterpret_cast<uint64_t>(p) + static_cast<uint64_t>(this->out_bias));
+    }
+
+    /*
+     * read_literal: 按虚拟地址读取被 LDR (literal) 引用的数据
+     */
+    void read_literal(void *dst, const int64_t va, const size_t n) {
+        if (this->src == NULL) {
+            memcpy(dst, reinterpret_cast<void *>(va), n);
+        } else if (static_cast<uint64_t>(va) - this->src_va <= this->src_size &&
+                   n <= this->src_size - (static_cast<uint64_t>(va) - this->src_va)) {
+            memcpy(dst, this->src + (static_cast<uint64_t>(va) - this->src_va), n);
+        } else {
+            memset(dst, 0, n);
+            this->failed = true;
+        }
+    }
+
     /*
      * is_in_fixing_range: 判断一个绝对地址是否位于正在修复的指令范围内
      *
@@ -163,8 +391,8 @@ public:
      * 这样后续处理的指令如果需要跳转到此指令, 就能知道目标地址。
      */
     inline intptr_t get_and_set_current_index(uint32_t *__restrict inp, uint32_t *__restrict outp) {
-        intptr_t current_idx = this->get_ref_ins_index(reinterpret_cast<int64_t>(inp));
-        this->dat[current_idx].insp = outp;
+        intptr_t current_idx = this->get_ref_ins_index(this->in_va(inp));
+        this->dat[current_idx].insp = this->blockp != NULL ? this->blockp : outp;
         return current_idx;
     }
 
@@ -172,9 +400,10 @@ public:
      * reset_current_ins: 更新指令在跳板中的位置
      *
      * 当因为对齐需要插入 NOP 时, 指令的实际位置会改变, 需要更新记录。
+     * 前面插入了计数代码时分支仍落在计数代码处, NOP 随后顺序执行。
      */
     inline void reset_current_ins(const intptr_t idx, uint32_t *__restrict outp) {
-        this->dat[idx].insp = outp;
+        if (this->blockp == NULL) this->dat[idx].insp = outp;
     }
 
     /*
@@ -188,6 +417,13 @@ public:
      * 等指令 B 被处理后, process_fix_map 会使用这些信息回填正确的偏移。
      */
     void insert_fix_map(const intptr_t idx, uint32_t *bp, uint32_t ls = 0u, uint32_t ad = 0xffffffffu) {
+        if (this->layout != NULL) {
+            // 每条指令最多引用一条后面的指令
+            if (this->deferred_idx >= 0) this->failed = true;
+            this->deferred     = { bp, ls, ad };
+            this->deferred_idx = idx;
+            return;
+        }
         for (auto &f : this->dat[idx].fmap) {
             if (f.bp == NULL) {
                 f.bp = bp;
@@ -196,7 +432,8 @@ public:
                 return;
             }
         }
-        // 如果执行到这里说明 fmap 已满, 这是代码设计的缺陷
+        // fmap 已满: 被覆盖的入口指令不会出现这种情况, 较长的片段(A64HookInjectSnippet)可能出现
+        this->failed = true;
     }
 
     /*
@@ -211,6 +448,11 @@ public:
      * 然后将偏移量左移 ls 位, 与 ad 掩码做与运算, 再或到原指令上。
      */
     void process_fix_map(const intptr_t idx) {
+        if (this->deferred_idx >= 0) {
+            const fix_info &f = this->deferred;
+            *(f.bp) = *(f.bp) | (((int32_t(static_cast<int64_t>(this->layout[this->deferred_idx]) - reinterpret_cast<int64_t>(f.bp)) >> 2) << f.ls) & f.ad);
+            this->deferred_idx = -1;
+        }
         for (auto &f : this->dat[idx].fmap) {
             if (f.bp == NULL) break;
             *(f.bp) = *(f.bp) | (((int32_t(this->dat[idx].ins - reinterpret_cast<int64_t>(f.bp)) >> 2) << f.ls) & f.ad);
@@ -235,6 +477,9 @@ public:
 #define __atomic_increase(p)       __sync_add_and_fetch(p, 1)
 #define __sync_cmpswap(p, v, n)    __sync_bool_compare_and_swap(p, v, n)
 #define __predict_true(exp)        __builtin_expect((exp) != 0, 1)
+#define __predict_false(exp)       __builtin_expect((exp) != 0, 0)
+#define __load_acquire(p)          __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define __store_release(p, v)      __atomic_store_n(p, v, __ATOMIC_RELEASE)
 
 /*
  * __flush_cache: 刷新指令缓存
@@ -273,6 +518,42 @@ public:
 
 //-------------------------------------------------------------------------
 
+/*
+ * __read_cntvct / __read_cntfrq: 读取 ARM 通用定时器(Generic Timer)
+ *
+ * CNTVCT_EL0 是用户态可直接读取的虚拟计数器, 不需要系统调用, 读取开销只有
+ * 几十个周期; CNTFRQ_EL0 是它的计数频率(Hz)。
+ */
+#if defined(__aarch64__)
+static inline uint64_t __read_cntvct()
+{
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+}
+
+static inline uint64_t __read_cntfrq()
+{
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(v));
+    return v;
+}
+#else
+static inline uint64_t __read_cntvct()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static inline uint64_t __read_cntfrq()
+{
+    return 1000000000ull;
+}
+#endif // defined(__aarch64__)
+
+//-------------------------------------------------------------------------
+
 /*
  * __fix_branch_imm: 修复无条件分支指令 B 和 BL
  *
@@ -347,13 +628,13 @@ static bool __fix_branch_imm(instruction inpp, instruction outpp, context *ctxp)
              *
              * 最终 absolute_addr = 当前指令地址 + 有符号扩展后的字节偏移
              */
-            int64_t absolute_addr = reinterpret_cast<int64_t>(*inpp) + (static_cast<int32_t>(ins << mbits) >> (mbits - 2u));
+            int64_t absolute_addr = ctxp->in_va(*inpp) + (static_cast<int32_t>(ins << mbits) >> (mbits - 2u));
 
             /*
              * 计算从跳板中的新位置到目标的偏移
              * 右移 2 位是因为指令中存储的偏移以 4 字节为单位
              */
-            int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - reinterpret_cast<int64_t>(*outpp)) >> 2;
+            int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - ctxp->out_va(*outpp)) >> 2;
 
             // 检查目标是否也在被修复的范围内(即也被复制到了跳板)
             bool special_fix_type = ctxp->is_in_fixing_range(absolute_addr);
@@ -368,7 +649,7 @@ static bool __fix_branch_imm(instruction inpp, instruction outpp, context *ctxp)
              */
             if (!special_fix_type && llabs(new_pc_offset) >= (rmask >> 1)) {
                 // 检查数据位置的对齐情况: outpp+2 需要 8 字节对齐
-                bool b_aligned = (reinterpret_cast<uint64_t>(*outpp + 2) & 7u) == 0u;
+                bool b_aligned = (static_cast<uint64_t>(ctxp->out_va(*outpp + 2)) & 7u) == 0u;
 
                 if (opc == op_b) {
                     // B 指令: 数据在 outpp+2, 如果 outpp+2 不是 8 字节对齐则需要 NOP
@@ -524,8 +805,8 @@ static bool __fix_cond_comp_test_branch(instruction inpp, instruction outpp, con
      * 2. << msb: 将偏移量移到最高位进行符号扩展
      * 3. 转为 int32_t 后 >> (lsb - 2 + msb): 算术右移恢复偏移量并保留 <<2 效果
      */
-    int64_t absolute_addr = reinterpret_cast<int64_t>(*inpp) + (static_cast<int32_t>((ins & ~lmask) << msb) >> (lsb - 2u + msb));
-    int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - reinterpret_cast<int64_t>(*outpp)) >> 2; // shifted
+    int64_t absolute_addr = ctxp->in_va(*inpp) + (static_cast<int32_t>((ins & ~lmask) << msb) >> (lsb - 2u + msb));
+    int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - ctxp->out_va(*outpp)) >> 2; // shifted
     bool special_fix_type = ctxp->is_in_fixing_range(absolute_addr);
 
     /*
@@ -534,7 +815,7 @@ static bool __fix_cond_comp_test_branch(instruction inpp, instruction outpp, con
      */
     if (!special_fix_type && llabs(new_pc_offset) >= (~lmask >> (lsb + 1))) {
         // 数据在 outpp+4, 需要 8 字节对齐
-        if ((reinterpret_cast<uint64_t>(*outpp + 4) & 7u) != 0u) {
+        if ((static_cast<uint64_t>(ctxp->out_va(*outpp + 4)) & 7u) != 0u) {
             (*outpp)[0] = A64_NOP;
             ctxp->reset_current_ins(current_idx, ++(*outpp));
         } //if
@@ -570,7 +851,7 @@ static bool __fix_cond_comp_test_branch(instruction inpp, instruction outpp, con
         }
 
         // 生成新指令: 将新偏移量编码到指令中
-        (*outpp)[0] = (static_cast<uint32_t>(new_pc_offset << lsb) & ~lmask) | (ins & lmask);
+        (*outpp)[0] = ((static_cast<uint32_t>(new_pc_offset) << lsb) & ~lmask) | (ins & lmask);
         ++(*outpp);
     } //if
 
@@ -654,7 +935,6 @@ static bool __fix_loadlit(instruction inpp, instruction outpp, context *ctxp)
     static constexpr uint32_t mask_ldrsw = 0xff000000u;
     static constexpr uint32_t op_ldrsw   = 0x98000000u;
 
-    uint32_t  mask     = mask_ldr;
     /*
      * 确定数据对齐要求
      *
@@ -669,7 +949,6 @@ static bool __fix_loadlit(instruction inpp, instruction outpp, context *ctxp)
 
     if ((ins & mask_ldr) != op_ldr) {
         // 不是通用寄存器加载, 检查是否是浮点寄存器加载
-        mask = mask_ldrv;
         /*
          * 浮点加载的对齐要求:
          *   bit30=0, bit31=0: 32 位 (St) -> 4 字节对齐
@@ -685,7 +964,6 @@ static bool __fix_loadlit(instruction inpp, instruction outpp, context *ctxp)
             if ((ins & mask_ldrsw) != op_ldrsw) {
                 return false;  // 不是我们要处理的指令类型
             }
-            mask     = mask_ldrsw;
             faligned = 7u;  // LDRSW 加载 32 位数据但扩展到 64 位寄存器
         }
     }
@@ -698,10 +976,11 @@ static bool __fix_loadlit(instruction inpp, instruction outpp, context *ctxp)
      * LDR literal 的偏移量是以 4 字节为单位的, 且目标地址必须 4 字节对齐。
      * (ins << msb) >> (msb + lsb - 2): 符号扩展并乘以 4
      * & ~3: 确保结果 4 字节对齐(实际上由于 -2 已经是 4 的倍数)
+     * 必须先扩展到 64 位再取掩码, 否则与 32 位无符号掩码运算会把负偏移零扩展成 +4GB 附近的地址
      */
-    int64_t absolute_addr = reinterpret_cast<int64_t>(*inpp) + ((static_cast<int32_t>(ins << msb) >> (msb + lsb - 2u)) & ~3u);
+    int64_t absolute_addr = ctxp->in_va(*inpp) + (static_cast<int64_t>(static_cast<int32_t>(ins << msb) >> (msb + lsb - 2u)) & ~3ll);
 
-    int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - reinterpret_cast<int64_t>(*outpp)) >> 2;
+    int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - ctxp->out_va(*outpp)) >> 2;
     bool special_fix_type = ctxp->is_in_fixing_range(absolute_addr);
 
     /*
@@ -715,7 +994,7 @@ static bool __fix_loadlit(instruction inpp, instruction outpp, context *ctxp)
      */
     if (special_fix_type || (llabs(new_pc_offset) + (faligned + 1u - 4u) / 4u) >= (~lmask >> (lsb + 1))) {
         // 插入 NOP 直到数据位置满足对齐要求
-        while ((reinterpret_cast<uint64_t>(*outpp + 2) & faligned) != 0u) {
+        while ((static_cast<uint64_t>(ctxp->out_va(*outpp + 2)) & faligned) != 0u) {
             *(*outpp)++ = A64_NOP;
         }
         ctxp->reset_current_ins(current_idx, *outpp);
@@ -731,9 +1010,9 @@ static bool __fix_loadlit(instruction inpp, instruction outpp, context *ctxp)
          * 这是一个已知限制, 对于常量数据没有问题。
          */
         uint32_t ns = static_cast<uint32_t>((faligned + 1) / sizeof(uint32_t));  // 数据占用的指令槽数
-        (*outpp)[0] = (((8u >> 2u) << lsb) & ~mask) | (ins & lmask); // LDR #0x8
+        (*outpp)[0] = (((8u >> 2u) << lsb) & ~lmask) | (ins & lmask); // LDR #0x8
         (*outpp)[1] = 0x14000001u + ns;  // B #(4 + ns*4), 跳过数据, B #0xc
-        memcpy(*outpp + 2, reinterpret_cast<void *>(absolute_addr), faligned + 1);
+        ctxp->read_literal(*outpp + 2, absolute_addr, faligned + 1);
         *outpp += 2 + ns;
     } else {
         /*
@@ -747,12 +1026,12 @@ static bool __fix_loadlit(instruction inpp, instruction outpp, context *ctxp)
         faligned >>= 2;
         while ((new_pc_offset & faligned) != 0) {
             *(*outpp)++   = A64_NOP;
-            new_pc_offset = static_cast<int64_t>(absolute_addr - reinterpret_cast<int64_t>(*outpp)) >> 2;
+            new_pc_offset = static_cast<int64_t>(absolute_addr - ctxp->out_va(*outpp)) >> 2;
         }
         ctxp->reset_current_ins(current_idx, *outpp);
 
-        // 生成新指令: 更新偏移量
-        (*outpp)[0] = (static_cast<uint32_t>(new_pc_offset << lsb) & ~mask) | (ins & lmask);
+        // 生成新指令: 更新偏移量, 只写入 imm19 位域(负偏移的符号位不能覆盖 opc/V)
+        (*outpp)[0] = ((static_cast<uint32_t>(new_pc_offset) << lsb) & ~lmask) | (ins & lmask);
         ++(*outpp);
     }
 
@@ -822,15 +1101,17 @@ static bool __fix_pcreladdr(instruction inpp, instruction outpp, context *ctxp)
              * & ~3 清除低 2 位后与 immlo 合并得到完整偏移
              */
             int64_t lsb_bytes     = static_cast<uint32_t>(ins << 1u) >> 30u;
-            int64_t absolute_addr = reinterpret_cast<int64_t>(*inpp) + (((static_cast<int32_t>(ins << msb) >> (msb + lsb - 2u)) & ~3u) | lsb_bytes);
+            int64_t absolute_addr = ctxp->in_va(*inpp) + ((static_cast<int64_t>(static_cast<int32_t>(ins << msb) >> (msb + lsb - 2u)) & ~3ll) | lsb_bytes);
 
             // ADR 的偏移是字节级别的, 不需要右移
-            int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - reinterpret_cast<int64_t>(*outpp));
-            bool special_fix_type = ctxp->is_in_fixing_range(absolute_addr);
+            int64_t new_pc_offset = static_cast<int64_t>(absolute_addr - ctxp->out_va(*outpp));
+
+            // 整函数重写时函数内的 ADR 多半是跳转表的基址, 偏移按原始布局计算, 仍然指向原函数
+            bool special_fix_type = ctxp->blocks == NULL && ctxp->is_in_fixing_range(absolute_addr);
 
             if (!special_fix_type && llabs(new_pc_offset) >= (max_val >> 1)) {
                 // 超出 ADR 范围, 转为 LDR 绝对地址
-                if ((reinterpret_cast<uint64_t>(*outpp + 2) & 7u) != 0u) {
+                if ((static_cast<uint64_t>(ctxp->out_va(*outpp + 2)) & 7u) != 0u) {
                     (*outpp)[0] = A64_NOP;
                     ctxp->reset_current_ins(current_idx, ++(*outpp));
                 }
@@ -861,15 +1142,15 @@ static bool __fix_pcreladdr(instruction inpp, instruction outpp, context *ctxp)
                 /*
                  * 编码新的 ADR 指令
                  *
-                 * new_pc_offset << (lsb - 2): 将偏移的高位放到 immhi 位置
+                 * (new_pc_offset >> 2) << lsb: 将偏移的高位放到 immhi 位置(bit5-23)
                  *   - new_pc_offset 是字节偏移
-                 *   - 低 2 位需要放到 immlo (bit29-30), 高位放到 immhi (bit5-23)
-                 *   - 这里 (lsb - 2) = 3, 左移 3 位相当于把 bit2-20 移到 bit5-23
+                 *   - 原指令和跳板都是 4 字节对齐的, 新偏移的低 2 位与原 immlo 相同,
+                 *     由 lmask 从原指令保留 immlo (bit29-30)
+                 *   - 低 2 位不能左移到 bit3-4, 否则会污染 Rd
                  *
-                 * & fmask: 只保留 immhi:immlo 位域
-                 * lmask 保留了原指令的 immlo 位(但实际上这里重新计算了整个偏移)
+                 * & fmask & ~rmask: 只写入 immhi 位域
                  */
-                (*outpp)[0] = (static_cast<uint32_t>(new_pc_offset << (lsb - 2u)) & fmask) | (ins & lmask);
+                (*outpp)[0] = ((static_cast<uint32_t>(new_pc_offset >> 2) << lsb) & fmask & ~rmask) | (ins & lmask);
                 ++(*outpp);
             } //if
         }
@@ -889,48 +1170,24 @@ static bool __fix_pcreladdr(instruction inpp, instruction outpp, context *ctxp)
              * imm << 12: 偏移量左移 12 位(乘以 4KB)
              */
             int32_t lsb_bytes     = static_cast<uint32_t>(ins << 1u) >> 30u;
-            int64_t absolute_addr = (reinterpret_cast<int64_t>(*inpp) & ~0xfffll) + ((((static_cast<int32_t>(ins << msb) >> (msb + lsb - 2u)) & ~3u) | lsb_bytes) << 12);
+            int64_t absolute_addr = (ctxp->in_va(*inpp) & ~0xfffll) + (((static_cast<int64_t>(static_cast<int32_t>(ins << msb) >> (msb + lsb - 2u)) & ~3ll) | lsb_bytes) * 4096);
 
-            A64_LOGI("ins = 0x%.8X, pc = %p, abs_addr = %p",
-                     ins, *inpp, reinterpret_cast<int64_t *>(absolute_addr));
-
-            if (ctxp->is_in_fixing_range(absolute_addr)) {
-                /*
-                 * ADRP 目标在修复范围内的特殊情况
-                 *
-                 * ADRP 计算的是页地址(低 12 位被清零), 如果原始代码使用 ADRP + ADD/LDR
-                 * 组合来访问某个地址, 移动到跳板后这种组合可能失效。
-                 *
-                 * 理论上需要重新计算 ADRP 的偏移, 使得计算出的页地址仍然正确。
-                 * 但这很复杂, 因为跳板的页地址可能与原地址的页地址不同。
-                 *
-                 * 当前实现选择直接保留原指令(这通常是错误的), 并记录日志。
-                 * 实际使用中这种情况很少见, 因为很少有函数开头的几条指令中
-                 * 既有 ADRP 又有该 ADRP 引用的数据。
-                 */
-                intptr_t ref_idx = ctxp->get_ref_ins_index(absolute_addr/* & ~3ull*/);
-                if (ref_idx > current_idx) {
-                    A64_LOGE("ref_idx must be less than or equal to current_idx!");
-                }
-                A64_LOGI("What is the correct way to fix this?");
-                *(*outpp)++ = ins; // 直接复制原指令(可能不正确?),0x90000000u;
-            } else {
-                /*
-                 * ADRP 目标不在修复范围内, 转为 LDR 绝对地址
-                 *
-                 * 由于 ADRP 计算的是页地址(可能与跳板不在同一页),
-                 * 最安全的方式是预计算出绝对地址并用 LDR 加载。
-                 */
-                if ((reinterpret_cast<uint64_t>(*outpp + 2) & 7u) != 0u) {
-                    (*outpp)[0] = A64_NOP;
-                    ctxp->reset_current_ins(current_idx, ++(*outpp));
-                }
-
-                (*outpp)[0] = 0x58000000u | (((8u >> 2u) << lsb) & ~mask) | (ins & rmask);  // LDR Xd, #0x8
-                (*outpp)[1] = 0x14000003u; // B #0xc
-                memcpy(*outpp + 2, &absolute_addr, sizeof(absolute_addr));
-                *outpp += 4;
+            /*
+             * 转为 LDR 绝对地址
+             *
+             * ADRP 计算的是页地址(可能与跳板不在同一页), 后续的 ADD/LDR 仍然按原始页访问数据,
+             * 所以即使目标页基址落在被覆盖的指令范围内, 结果也必须是原始页地址,
+             * 最安全的方式是预计算出绝对地址并用 LDR 加载。
+             */
+            if ((static_cast<uint64_t>(ctxp->out_va(*outpp + 2)) & 7u) != 0u) {
+                (*outpp)[0] = A64_NOP;
+                ctxp->reset_current_ins(current_idx, ++(*outpp));
             }
+
+            (*outpp)[0] = 0x58000000u | (((8u >> 2u) << lsb) & ~mask) | (ins & rmask);  // LDR Xd, #0x8
+            (*outpp)[1] = 0x14000003u; // B #0xc
+            memcpy(*outpp + 2, &absolute_addr, sizeof(absolute_addr));
+            *outpp += 4;
         }
         break;
 
@@ -946,41 +1203,54 @@ static bool __fix_pcreladdr(instruction inpp, instruction outpp, context *ctxp)
 //-------------------------------------------------------------------------
 
 /*
- * __fix_instructions: 批量修复被覆盖的原始指令, 生成跳板代码
- *
- * 这是指令修复的主入口函数。它遍历每条原始指令, 判断其类型并调用相应的
- * 修复函数。不涉及 PC 相对寻址的指令可以直接复制。
- *
- * 修复完所有原始指令后, 还需要添加一条跳转回原函数的指令。这样当跳板代码
- * 执行完被覆盖的指令后, 会自动跳转回原函数继续执行剩余部分。
- *
- * 跳板代码结构:
- *   [修复后的原始指令 1]
- *   [修复后的原始指令 2]
- *   ...
- *   [修复后的原始指令 N]
- *   [跳转回原函数的指令]  ; 目标是原函数第 N+1 条指令的位置
+ * __emit_block_counter: 生成对 *counter 原子加一的指令, 不改变任何寄存器和 NZCV
  *
- * @param inp:   原始指令的起始地址
- * @param count: 需要修复的指令数量
- * @param outp:  跳板的起始地址(输出位置)
+ * counter 必须在 ADR 的范围(+/-1MB)内。支持 LSE 时使用 STADD(5 条指令):
+ *   STP   X16, X17, [SP, #-16]!
+ *   ADR   X16, counter
+ *   MOV   X17, #1
+ *   STADD X17, [X16]
+ *   LDP   X16, X17, [SP], #16
+ * 否则使用 LDXR/STXR 循环(9 条指令), 需要第三个寄存器 X15 保存状态。
  */
-static void __fix_instructions(uint32_t *__restrict inp, int32_t count, uint32_t *__restrict outp)
+static uint32_t *__emit_block_counter(uint32_t *outp, const uint64_t *counter, const bool lse)
 {
-    context ctx;
-    ctx.basep = reinterpret_cast<int64_t>(inp);
-    ctx.endp  = reinterpret_cast<int64_t>(inp + count);
-    memset(ctx.dat, 0, sizeof(ctx.dat));
-
-    static_assert(sizeof(ctx.dat) / sizeof(ctx.dat[0]) == A64_MAX_INSTRUCTIONS,
-                  "please use A64_MAX_INSTRUCTIONS!");
-#ifndef NDEBUG
-    if (count > A64_MAX_INSTRUCTIONS) {
-        A64_LOGE("too many fixing instructions!");
+    const auto adr = [](const uint32_t *pc, const void *target) -> uint32_t {
+        const uint32_t imm = static_cast<uint32_t>(__intval(target) - __intval(pc));
+        return 0x10000010u | ((imm & 3u) << 29) | (((imm >> 2) & 0x7ffffu) << 5);  // ADR X16, target
+    };
+    if (lse) {
+        outp[0] = 0xa9bf47f0u;  // STP   X16, X17, [SP, #-16]!
+        outp[1] = adr(outp + 1, counter);
+        outp[2] = 0xd2800031u;  // MOV   X17, #1
+        outp[3] = 0xf831021fu;  // STADD X17, [X16]
+        outp[4] = 0xa8c147f0u;  // LDP   X16, X17, [SP], #16
+        return outp + 5;
     }
-#endif // NDEBUG
+    outp[0] = 0xa9be47f0u;  // STP   X16, X17, [SP, #-32]!
+    outp[1] = 0xf9000befu;  // STR   X15, [SP, #16]
+    outp[2] = adr(outp + 2, counter);
+    outp[3] = 0xc85f7e11u;  // LDXR  X17, [X16]
+    outp[4] = 0x91000631u;  // ADD   X17, X17, #1
+    outp[5] = 0xc80f7e11u;  // STXR  W15, X17, [X16]
+    outp[6] = 0x35ffffafu;  // CBNZ  W15, LDXR
+    outp[7] = 0xf9400befu;  // LDR   X15, [SP, #16]
+    outp[8] = 0xa8c247f0u;  // LDP   X16, X17, [SP], #32
+    return outp + 9;
+}
 
-    uint32_t *const outp_base = outp;
+/*
+ * __relocate_insns: 逐条修复 count 条原始指令, 不生成跳回原函数的指令
+ *
+ * @return: 修复后的写入位置
+ */
+static uint32_t *__relocate_insns(context &ctx, uint32_t *__restrict inp, int32_t count, uint32_t *__restrict outp,
+                                  A64InstallStats *st)
+{
+    ctx.basep  = ctx.in_va(inp);
+    ctx.endp   = ctx.in_va(inp + count);
+    ctx.failed = false;
+    memset(ctx.dat, 0, static_cast<size_t>(count) * sizeof(ctx.dat[0]));
 
     /*
      * 逐条处理原始指令
@@ -992,15 +1262,67 @@ static void __fix_instructions(uint32_t *__restrict inp, int32_t count, uint32_t
      * 这类指令包括: 寄存器操作、立即数操作、内存间接寻址等。
      */
     while (--count >= 0) {
-        if (__fix_branch_imm(&inp, &outp, &ctx)) continue;
-        if (__fix_cond_comp_test_branch(&inp, &outp, &ctx)) continue;
-        if (__fix_loadlit(&inp, &outp, &ctx)) continue;
-        if (__fix_pcreladdr(&inp, &outp, &ctx)) continue;
+        if (ctx.blocks != NULL) {
+            const int32_t block = ctx.blocks[ctx.get_ref_ins_index(ctx.in_va(inp))];
+            ctx.blockp = block >= 0 ? outp : NULL;
+            if (block >= 0) outp = __emit_block_counter(outp, &ctx.counters[block], ctx.lse);
+        }
+
+        uint32_t *const before = outp;
+        intptr_t        kind;
+        if (__fix_branch_imm(&inp, &outp, &ctx)) {
+            kind = A64_RELOC_BRANCH;
+        } else if (__fix_cond_comp_test_branch(&inp, &outp, &ctx)) {
+            kind = A64_RELOC_COND;
+        } else if (__fix_loadlit(&inp, &outp, &ctx)) {
+            kind = A64_RELOC_LITERAL;
+        } else if (__fix_pcreladdr(&inp, &outp, &ctx)) {
+            kind = A64_RELOC_PCREL;
+        } else {
+            // 不涉及 PC 相对寻址的指令, 直接复制
+            ctx.process_fix_map(ctx.get_and_set_current_index(inp, outp));
+            *(outp++) = *(inp++);
+            kind = A64_RELOC_COPY;
+        }
 
-        // 不涉及 PC 相对寻址的指令, 直接复制
-        ctx.process_fix_map(ctx.get_and_set_current_index(inp, outp));
-        *(outp++) = *(inp++);
+        if (st != NULL) {
+            ++st->relocated[kind];
+            if (outp - before > 1) ++st->expanded[kind];
+        }
     }
+    return outp;
+}
+
+/*
+ * __relocate: 批量修复被覆盖的原始指令, 生成跳板代码
+ *
+ * 这是指令修复的核心。它遍历每条原始指令, 判断其类型并调用相应的
+ * 修复函数。不涉及 PC 相对寻址的指令可以直接复制。
+ *
+ * 修复完所有原始指令后, 还需要添加一条跳转回原函数的指令。这样当跳板代码
+ * 执行完被覆盖的指令后, 会自动跳转回原函数继续执行剩余部分。
+ *
+ * 跳板代码结构:
+ *   [修复后的原始指令 1]
+ *   [修复后的原始指令 2]
+ *   ...
+ *   [修复后的原始指令 N]
+ *   [跳转回原函数的指令]  ; 目标是原函数第 N+1 条指令的位置
+ *
+ * 调用者负责设置 ctx 中的 in_bias/out_bias 和字面量来源, 见 context。
+ *
+ * @param inp:   原始指令的读取位置
+ * @param count: 需要修复的指令数量
+ * @param outp:  跳板的写入位置
+ * @param st:    安装遥测, 累加各类指令的数量, 可以为 NULL
+ * @return:      跳板实际使用的字节数
+ */
+static uintptr_t __relocate(context &ctx, uint32_t *__restrict inp, int32_t count, uint32_t *__restrict outp,
+                            A64InstallStats *st)
+{
+    uint32_t *const outp_base = outp;
+    outp = __relocate_insns(ctx, inp, count, outp, st);
+    inp += count;
 
     /*
      * 生成跳转回原函数的指令
@@ -1012,18 +1334,19 @@ static void __fix_instructions(uint32_t *__restrict inp, int32_t count, uint32_t
      * 否则需要使用 LDR+BR 间接跳转。
      */
     static constexpr uint_fast64_t mask = 0x03ffffffu;  // B 指令的 26 位偏移掩码,0b00000011111111111111111111111111
-    auto callback  = reinterpret_cast<int64_t>(inp);    // 回调点地址
-    auto pc_offset = static_cast<int64_t>(callback - reinterpret_cast<int64_t>(outp)) >> 2;
+    auto callback  = ctx.in_va(inp);                    // 回调点地址
+    auto pc_offset = static_cast<int64_t>(callback - ctx.out_va(outp)) >> 2;
 
+    ctx.tailp = outp;
     if (llabs(pc_offset) >= (mask >> 1)) {
         // 超出 B 指令范围, 使用 LDR+BR
-        if ((reinterpret_cast<uint64_t>(outp + 2) & 7u) != 0u) {
+        if ((static_cast<uint64_t>(ctx.out_va(outp + 2)) & 7u) != 0u) {
             outp[0] = A64_NOP;
             ++outp;
         } //if
         outp[0] = 0x58000051u; // LDR X17, #0x8
         outp[1] = 0xd61f0220u; // BR X17
-        *reinterpret_cast<int64_t *>(outp + 2) = callback;
+        memcpy(outp + 2, &callback, sizeof(callback));
         outp += 4;
     } else {
         // 在 B 指令范围内, 直接使用 B 指令
@@ -1031,240 +1354,3754 @@ static void __fix_instructions(uint32_t *__restrict inp, int32_t count, uint32_t
         ++outp;
     }
 
-    // 刷新指令缓存, 确保 CPU 能执行新生成的跳板代码
-    const uintptr_t total = (outp - outp_base) * sizeof(uint32_t);
-    __flush_cache(outp_base, total); // necessary
+    return (outp - outp_base) * sizeof(uint32_t);
 }
 
-//-------------------------------------------------------------------------
+/*
+ * __relocate_map: 导出 __relocate 之后 context::dat 记录的位置
+ *
+ * map[i] 是第 i 条原始指令在跳板中的字节偏移, map[count] 是跳回原函数的指令序列的偏移。
+ */
+static void __relocate_map(const context &ctx, const uint32_t *outp, const int32_t count, uint32_t *map)
+{
+    for (int32_t i = 0; i < count; ++i) {
+        map[i] = static_cast<uint32_t>(ctx.dat[i].insu - reinterpret_cast<uint64_t>(outp));
+    }
+    map[count] = static_cast<uint32_t>(reinterpret_cast<uint64_t>(ctx.tailp) - reinterpret_cast<uint64_t>(outp));
+}
+
+/*
+ * __fix_instructions: 修复原始指令, 原始指令按实际地址执行
+ *
+ * 跳板通常也按写入的地址执行(out_bias 为 0)。调用者用两个映射分别写入和执行跳板时(A64HookFunctionVX),
+ * out_bias 是执行地址减写入地址, 所有 PC 相对的计算都按执行地址进行。
+ *
+ * @param inp:      原始指令的起始地址
+ * @param count:    需要修复的指令数量
+ * @param outp:     跳板的起始地址(写入位置)
+ * @param st:       安装遥测, 累加各类指令的数量和各阶段耗时(计数周期), 可以为 NULL
+ * @param map:      可以为 NULL, 否则写入 count + 1 个偏移, 见 __relocate_map
+ * @param out_bias: 跳板的执行地址 - outp
+ * @return:         跳板实际使用的字节数
+ */
+static inline uintptr_t __fix_instructions(uint32_t *__restrict inp, int32_t count, uint32_t *__restrict outp,
+                                           A64InstallStats *st = NULL, uint32_t *map = NULL, const int64_t out_bias = 0)
+{
+    context::insns_info dat[A64_MAX_INSTRUCTIONS];
+    context ctx;
+    ctx.dat      = dat;
+    ctx.in_bias  = 0;
+    ctx.out_bias = out_bias;
+    ctx.src      = NULL;
+
+    // 不需要遥测时不读取计数器, 主机上 __read_cntvct 是一次 clock_gettime
+    const uint64_t  start = st != NULL ? __read_cntvct() : 0u;
+    const uintptr_t total = __relocate(ctx, inp, count, outp, st);
 
-extern "C" {
     /*
-     * __insns_pool: 预分配的跳板内存池
-     *
-     * 这是一个静态分配的数组, 用于存储所有 Hook 的跳板代码。
-     * 数组按页对齐(__page_size = 4096), 便于 mprotect 修改权限。
-     *
-     * 每个跳板槽位大小: A64_MAX_INSTRUCTIONS * 10 * sizeof(uint32_t)
-     *   = 5 * 10 * 4 = 200 字节
-     *
-     * 这个大小足够容纳:
-     *   - 最多 5 条原始指令的修复版本(每条最多展开为多条)
-     *   - 跳转回原函数的指令
+     * 刷新指令缓存, 确保 CPU 能执行新生成的跳板代码
      *
-     * 总内存: 256 * 200 = 51200 字节 = 50KB
+     * 按执行地址刷新: 数据缓存按物理地址索引, 通过执行映射清理同样写回了写入映射中的修改,
+     * 指令缓存则必须按取指使用的地址无效化。
      */
-    static __attribute__((__aligned__(__page_size))) uint32_t __insns_pool[A64_MAX_BACKUPS][A64_MAX_INSTRUCTIONS * 10];
+    const uint64_t  fixed = st != NULL ? __read_cntvct() : 0u;
+    __flush_cache(reinterpret_cast<uint8_t *>(outp) + out_bias, total); // necessary
 
-    //-------------------------------------------------------------------------
+    if (st != NULL) {
+        st->phase_ns[A64_PHASE_RELOCATE] += fixed - start;
+        st->phase_ns[A64_PHASE_FLUSH]    += __read_cntvct() - fixed;
+        st->original_bytes   += static_cast<uintptr_t>(count) * sizeof(uint32_t);
+        st->trampoline_bytes += total;
+    }
+    if (map != NULL) __relocate_map(ctx, outp, count, map);
+    return total;
+}
+
+/*
+ * __fix_bound: 修复 count 条原始指令时跳板可能使用的最大字节数
+ *
+ * 单条指令最长的修复是内联 LDR Qt 的字面量: 最多 3 条对齐用的 NOP + LDR + B + 16 字节数据,
+ * 共 9 个字; 跳回原函数最多是 NOP + LDR + BR + 8 字节地址, 共 5 个字。
+ */
+static constexpr uintptr_t __fix_bound(const int32_t count)
+{
+    return (9u * static_cast<uintptr_t>(count) + 5u) * sizeof(uint32_t);
+}
+
+/*
+ * __trampoline_bound: 本库自己分配的跳板的大小, __fix_bound 加上开头可选的 BTI c
+ *
+ * A64HookFunctionV 的调用者提供的缓冲区小于这个大小时不放 BTI c。
+ */
+static constexpr uintptr_t __trampoline_bound(const int32_t count)
+{
+    return __fix_bound(count) + sizeof(uint32_t);
+}
 
+/*
+ * __patch_words: 入口补丁需要覆盖的指令数
+ *
+ * 替换函数在 +/-128MB 内时只需一条 B 指令; 否则使用 LDR X17 + BR X17 + 64 位地址,
+ * 地址必须 8 字节对齐, original+2 不对齐时在前面补一条 NOP, 共 5 条, 否则 4 条。
+ */
+static inline int32_t __patch_words(const void *symbol, const void *replace)
+{
+    static constexpr uint_fast64_t mask = 0x03ffffffu;  // B 指令偏移掩码
+    const int64_t pc_offset = static_cast<int64_t>(reinterpret_cast<uintptr_t>(replace) - reinterpret_cast<uintptr_t>(symbol)) >> 2;
+    if (llabs(pc_offset) < static_cast<int64_t>(mask >> 1)) return 1;
+    return (reinterpret_cast<uint64_t>(static_cast<const uint32_t *>(symbol) + 2) & 7u) != 0u ? 5 : 4;
+}
+
+/*
+ * __emit_patch: 按 __patch_words 选择的形状写入入口补丁, 不处理内存权限和缓存
+ *
+ * 远跳转的多条指令不能原子写入, __hook_function 只用它写远跳转补丁;
+ * 近跳转在那里用比较交换写入单条 B 指令。
+ */
+static inline void __emit_patch(uint32_t *original, const void *replace, const int32_t count)
+{
+    if (count == 1) {
+        const int64_t pc_offset = static_cast<int64_t>(reinterpret_cast<uintptr_t>(replace) - reinterpret_cast<uintptr_t>(original)) >> 2;
+        original[0] = 0x14000000u | (static_cast<uint32_t>(pc_offset) & 0x03ffffffu);  // B #offset
+        return;
+    }
+    if (count == 5) {
+        // 需要 NOP 对齐
+        original[0] = A64_NOP;
+        ++original;
+    }
+    original[0] = 0x58000051u; // LDR X17, #0x8
+    original[1] = 0xd61f0220u; // BR X17
+    const int64_t addr = reinterpret_cast<intptr_t>(replace);
+    memcpy(original + 2, &addr, sizeof(addr));
+}
+
+static_assert(__fix_bound(A64_MAX_INSTRUCTIONS) <= A64_RELOC_MAX_BYTES, "please fix A64_RELOC_MAX_BYTES!");
+
+//-------------------------------------------------------------------------
+
+extern "C" {
     /*
-     * A64HookInit: 初始化类, 用于在程序启动时设置跳板池的内存权限
-     *
-     * 使用静态对象的构造函数实现自动初始化。当包含此代码的共享库被加载时,
-     * 静态对象 __init 会被构造, 其构造函数会被自动调用。
+     * A64Relocate: 离线修复, 原始指令和跳板都只是缓冲区, 地址由调用者指定
      *
-     * 构造函数中调用 __make_rwx 将跳板池设置为可读/可写/可执行,
-     * 这是后续写入和执行跳板代码的前提条件。
+     * 窗口复制到对齐的局部数组中修复, 输出先写到局部数组再复制给调用者,
+     * 因此 src/out 可以是任意对齐的字节缓冲区。
      */
-    class A64HookInit
+    A64_JNIEXPORT intptr_t A64Relocate(const A64RelocRequest *req, void *out, size_t out_size, uint32_t *map)
     {
-    public:
-        A64HookInit()
-        {
-            __make_rwx(__insns_pool, sizeof(__insns_pool));
-            A64_LOGI("insns pool initialized.");
+        if (req == NULL || req->src == NULL || out == NULL ||
+            req->count < 1 || req->count > A64_MAX_INSTRUCTIONS || ((req->pc | req->dst_va) & 3u) != 0u ||
+            req->pc - req->src_va > req->src_size ||
+            req->src_size - (req->pc - req->src_va) < static_cast<uint64_t>(req->count) * sizeof(uint32_t)) {
+            A64_LOGE("invalid relocation request!");
+            return -1;
         }
-    };
-    static A64HookInit __init;
+
+        uint32_t window[A64_MAX_INSTRUCTIONS];
+        uint32_t code[__fix_bound(A64_MAX_INSTRUCTIONS) / sizeof(uint32_t)];
+        memcpy(window, static_cast<const uint8_t *>(req->src) + (req->pc - req->src_va),
+               static_cast<size_t>(req->count) * sizeof(uint32_t));
+
+        context::insns_info dat[A64_MAX_INSTRUCTIONS];
+        context ctx;
+        ctx.dat      = dat;
+        ctx.in_bias  = static_cast<int64_t>(req->pc - reinterpret_cast<uint64_t>(window));
+        ctx.out_bias = static_cast<int64_t>(req->dst_va - reinterpret_cast<uint64_t>(code));
+        ctx.src      = static_cast<const uint8_t *>(req->src);
+        ctx.src_va   = req->src_va;
+        ctx.src_size = req->src_size;
+
+        const uintptr_t total = __relocate(ctx, window, req->count, code, NULL);
+        if (ctx.failed) {
+            A64_LOGE("literal referenced at 0x%" PRIx64 " is outside the source bytes!", req->pc);
+            return -1;
+        }
+        if (total > out_size) {
+            A64_LOGE("out size is too small to hold %zu bytes!", static_cast<size_t>(total));
+            return -1;
+        }
+        memcpy(out, code, total);
+
+        if (map != NULL) __relocate_map(ctx, code, req->count, map);
+        return static_cast<intptr_t>(total);
+    }
+}
+
+#if defined(__aarch64__)
+
+//-------------------------------------------------------------------------
+// CPU 特性
+//-------------------------------------------------------------------------
+
+/*
+ * 生成代码和改写入口时按运行时的 CPU 特性选择指令, 每种特性都有 ARMv8.0 的回退方式:
+ *   A64_CPU_LSE:  CASAL 改写入口字, STADD 递增基本块计数器; 否则为 LDXR/STXR 循环
+ *   A64_CPU_BTI:  跳板开头放一条 BTI c, 跳板所在的页以 PROT_BTI 映射时仍然可以通过函数指针调用
+ *   A64_CPU_PAC:  只检测和报告, 生成的代码都从函数入口(PACIASP 之前)进入, 不需要处理签名的 LR
+ * 特性在第一次使用时通过 getauxval 读取, 之后只读; A64SetCpuFeatures 可以屏蔽其中一部分, 用于测试回退路径。
+ */
+#define __hwcap_atomics  (1ul << 8)   // HWCAP_ATOMICS
+#define __hwcap_paca     (1ul << 30)  // HWCAP_PACA
+#define __hwcap2_bti     (1ul << 17)  // HWCAP2_BTI
+#define __cpu_detected   0x80000000u  // __cpu_hwcaps 已初始化
+
+static uint32_t          __cpu_hwcaps  = 0u;
+static volatile uint32_t __cpu_allowed = ~0u;
+
+/*
+ * __cpu_features: 当前生效的 A64_CPU_* 特性
+ *
+ * 多个线程同时初始化时得到的值相同, 不需要加锁。
+ */
+static inline uint32_t __cpu_features()
+{
+    uint32_t hwcaps = __atomic_load_n(&__cpu_hwcaps, __ATOMIC_RELAXED);
+    if (__predict_false(hwcaps == 0u)) {
+        const unsigned long hwcap  = getauxval(AT_HWCAP);
+        const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+        hwcaps = __cpu_detected;
+        if ((hwcap & __hwcap_atomics) != 0u) hwcaps |= A64_CPU_LSE;
+        if ((hwcap2 & __hwcap2_bti) != 0u)   hwcaps |= A64_CPU_BTI;
+        if ((hwcap & __hwcap_paca) != 0u)    hwcaps |= A64_CPU_PAC;
+        __atomic_store_n(&__cpu_hwcaps, hwcaps, __ATOMIC_RELAXED);
+    }
+    return hwcaps & __cpu_allowed & ~__cpu_detected;
+}
+
+static inline bool __cpu_has(const uint32_t feature)
+{
+    return (__cpu_features() & feature) != 0u;
+}
+
+/*
+ * __code_cmpswap: 比较交换一个代码字, 与 __sync_cmpswap 相同, 支持 LSE 时使用 CASAL
+ */
+static inline bool __code_cmpswap(uint32_t *p, const uint32_t expected, const uint32_t desired)
+{
+    if (__cpu_has(A64_CPU_LSE)) {
+        uint32_t old = expected;
+        __asm__ __volatile__(".arch_extension lse\n"
+                             "casal %w0, %w2, [%1]"
+                             : "+r"(old) : "r"(p), "r"(desired) : "memory");
+        return old == expected;
+    }
+    return __sync_cmpswap(p, expected, desired);
+}
+
+/*
+ * __store_far_patch: 在其他线程可能正在执行目标函数时写入 count 个字的远跳转补丁, 不处理内存权限
+ *
+ * 与 A64HookSetEnabled 切换远跳转 Hook 一样, 只用比较交换改写第一个字:
+ *   1. 第一个字改为 bridge(跳到跳板的 B; 没有可用的跳板时为跳到自身的 B), 此后进入函数的线程
+ *      不再执行后续的字, 没有跳板时在第一个字处短暂自旋;
+ *   2. 写入后续的字;
+ *   3. 第一个字从 bridge 改为补丁的第一个字(LDR 或对齐用的 NOP)。
+ * 每一步之后都刷新指令缓存。只有第 1 步的瞬间已经执行了原来的第一个字、还停在随后几条指令中的
+ * 线程不受保护, 与近跳转改写一个字的假设相同。后续的字逐个用普通存储写入, 不调用 memcpy:
+ * 被 Hook 的可能正是 memcpy, 第 1 步之后调用它的线程(包括当前线程)会停在 bridge 上。
+ */
+static void __store_far_patch(uint32_t *original, const uint32_t *patch, const int32_t count,
+                              const uint32_t bridge, A64InstallStats *st)
+{
+    uint64_t t0 = __read_cntvct();
+    __code_cmpswap(original, original[0], bridge);
+    uint64_t patch_ns = __read_cntvct() - t0;
+
+    t0 = __read_cntvct();
+    __flush_cache(original, sizeof(uint32_t));
+    uint64_t flush_ns = __read_cntvct() - t0;
+
+    t0 = __read_cntvct();
+    for (int32_t i = 1; i < count; ++i) {
+        __atomic_store_n(&original[i], patch[i], __ATOMIC_RELAXED);
+    }
+    patch_ns += __read_cntvct() - t0;
+
+    t0 = __read_cntvct();
+    __flush_cache(original + 1, static_cast<size_t>(count - 1) * sizeof(uint32_t));
+    flush_ns += __read_cntvct() - t0;
+
+    t0 = __read_cntvct();
+    __code_cmpswap(original, bridge, patch[0]);
+    patch_ns += __read_cntvct() - t0;
+
+    t0 = __read_cntvct();
+    __flush_cache(original, sizeof(uint32_t));
+    flush_ns += __read_cntvct() - t0;
+
+    st->phase_ns[A64_PHASE_PATCH] += patch_ns;
+    st->phase_ns[A64_PHASE_FLUSH] += flush_ns;
+}
+
+A64_JNIEXPORT uint32_t A64GetCpuFeatures(void)
+{
+    return __cpu_features();
+}
+
+A64_JNIEXPORT uint32_t A64SetCpuFeatures(uint32_t mask)
+{
+    __cpu_allowed = mask | __cpu_detected;
+    return __cpu_features();
+}
+
+//-------------------------------------------------------------------------
+// Hook 注册表与共享内存统计
+//-------------------------------------------------------------------------
+
+#ifndef MFD_CLOEXEC
+# define MFD_CLOEXEC 0x0001u
+#endif // MFD_CLOEXEC
+
+/*
+ * __stats: Hook 注册表, 布局见头文件中的 A64HookStats
+ *
+ * 第一次安装 Hook 时以 MAP_NORESERVE 映射整个注册表, 只有真正写入的页才会占用
+ * 物理内存。导出为共享内存后, 这块地址会被原地替换为共享映射, 指针保持不变,
+ * 因此各处缓存的 A64HookStatsEntry 指针始终有效。
+ *
+ * __stats_lock 保护复制和重新映射之间的窗口: 分配、归还条目和 seqlock 写端持有读锁,
+ * A64StatsExport 持有写锁, 因此导出期间不会有元数据写入丢失。热路径上的调用计数不加锁。
+ */
+static A64HookStats    *__stats      = NULL;
+static size_t           __stats_size = 0u;
+static volatile int     __stats_fd   = -1;
+static pthread_once_t   __stats_once = PTHREAD_ONCE_INIT;
+static pthread_rwlock_t __stats_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void __stats_init()
+{
+    const size_t size = __page_align(sizeof(A64HookStats) + A64_MAX_HOOKS * sizeof(A64HookStatsEntry));
+    void *p = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        A64_LOGE("failed to allocate hook registry, errno = %d", errno);
+        return;
+    }
+
+    A64HookStats *stats = static_cast<A64HookStats *>(p);
+    memcpy(stats->magic, A64_STATS_MAGIC, sizeof(stats->magic));
+    stats->version      = A64_STATS_VERSION;
+    stats->header_size  = sizeof(A64HookStats);
+    stats->entry_size   = sizeof(A64HookStatsEntry);
+    stats->capacity     = A64_MAX_HOOKS;
+    stats->counter_freq = __read_cntfrq();
+
+    __stats_size = size;
+    __store_release(&__stats, stats);
+}
+
+static inline A64HookStatsEntry *__stats_entry(const uint32_t index)
+{
+    return const_cast<A64HookStatsEntry *>(A64StatsEntryAt(__stats, index));
+}
+
+/*
+ * __registry_free: 安装失败后归还的条目, 这些条目从未发布(seq 为 0), 分配时优先复用
+ *
+ * count 保持单调递增, 读取方照常跳过 seq 为 0 的条目。
+ */
+static uint32_t        __registry_free[A64_MAX_HOOKS];
+static uint32_t        __registry_free_count = 0u;
+static pthread_mutex_t __registry_free_lock  = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * __registry_alloc: 分配一个注册表条目
+ *
+ * 条目在 seq 变为非 0 之前对读取方不可见, flags 和 name 在分配时预先填写。
+ * 注册表已满时返回 NULL。
+ *
+ * @param flags: 预先填写的 A64_HOOK_* | A64_PROBE_*
+ * @param name:  预先填写的名称, 可以为 NULL
+ */
+static A64HookStatsEntry *__registry_alloc(const uint32_t flags = 0u, const char *name = NULL)
+{
+    pthread_once(&__stats_once, __stats_init);
+    if (__stats == NULL) return NULL;
+
+    pthread_rwlock_rdlock(&__stats_lock);
+    A64HookStatsEntry *e = NULL;
+    if (__load_acquire(&__registry_free_count) != 0u) {
+        pthread_mutex_lock(&__registry_free_lock);
+        if (__registry_free_count != 0u) e = __stats_entry(__registry_free[--__registry_free_count]);
+        pthread_mutex_unlock(&__registry_free_lock);
+    }
+
+    if (e == NULL) {
+        uint32_t index;
+        do {
+            index = __load_acquire(&__stats->count);
+            if (index >= __stats->capacity) {
+                pthread_rwlock_unlock(&__stats_lock);
+                static volatile int32_t __reported = 0;
+                if (__sync_cmpswap(&__reported, 0, 1)) A64_LOGE("hook registry is full!");
+                return NULL;
+            }
+        } while (!__sync_cmpswap(&__stats->count, index, index + 1u));
+
+        e = __stats_entry(index);
+        e->id = index;
+    }
+
+    e->flags = flags;
+    if (name != NULL) {
+        strncpy(e->name, name, sizeof(e->name) - 1u);
+    }
+    pthread_rwlock_unlock(&__stats_lock);
+    return e;
+}
+
+/*
+ * __registry_release: 归还安装失败、尚未发布的条目, entry 可以为 NULL
+ *
+ * 已发布的条目(安装成功)不受影响, 因此调用者无法从返回值判断成败时(例如没有跳板)
+ * 也可以直接调用。清除分配者预先填写的 flags 和 name, 条目保持 seq 为 0, 读取方始终看不到它。
+ */
+static void __registry_release(A64HookStatsEntry *e)
+{
+    if (e == NULL || __load_acquire(&e->seq) != 0u) return;
+
+    const uint32_t id = e->id;
+    pthread_rwlock_rdlock(&__stats_lock);
+    memset(reinterpret_cast<uint8_t *>(e) + offsetof(A64HookStatsEntry, symbol), 0,
+           sizeof(*e) - offsetof(A64HookStatsEntry, symbol));
+
+    pthread_mutex_lock(&__registry_free_lock);
+    __registry_free[__registry_free_count] = id;
+    __store_release(&__registry_free_count, __registry_free_count + 1u);
+    pthread_mutex_unlock(&__registry_free_lock);
+    pthread_rwlock_unlock(&__stats_lock);
+}
+
+/*
+ * __seq_write_begin / __seq_write_end: seqlock 写端
+ *
+ * 每个条目只有一个写入者(安装或切换它的线程), 因此不需要写端互斥;
+ * 两者之间持有 __stats_lock 的读锁, 不会与 A64StatsExport 重叠。
+ */
+static inline void __seq_write_begin(uint32_t *seq)
+{
+    pthread_rwlock_rdlock(&__stats_lock);
+    __atomic_store_n(seq, *seq + 1u, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void __seq_write_end(uint32_t *seq)
+{
+    __store_release(seq, *seq + 1u);
+    __atomic_fetch_add(&__stats->generation, 1u, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&__stats_lock);
+}
+
+/*
+ * __install_totals: 所有 Hook 安装遥测的全局汇总, 以原子加累计
+ */
+static A64InstallStats __install_totals;
+
+/*
+ * __install_commit: 把一次安装的遥测换算为纳秒并累加到全局汇总
+ *
+ * 安装过程中 phase_ns 暂存的是 CNTVCT_EL0 计数周期, 这里统一换算。
+ */
+static void __install_commit(A64InstallStats *st, const bool succeeded)
+{
+    const uint64_t freq = __read_cntfrq();
+    for (intptr_t i = 0; i < A64_PHASE_COUNT; ++i) {
+        const uint64_t v = st->phase_ns[i];
+        st->phase_ns[i]  = freq != 0u ? v / freq * 1000000000ull + v % freq * 1000000000ull / freq : v;
+    }
+    st->hooks    = succeeded ? 1u : 0u;
+    st->failures = succeeded ? 0u : 1u;
+
+    const uint64_t *src = reinterpret_cast<const uint64_t *>(st);
+    uint64_t       *dst = reinterpret_cast<uint64_t *>(&__install_totals);
+    for (size_t i = 0u; i < sizeof(A64InstallStats) / sizeof(uint64_t); ++i) {
+        if (src[i] != 0u) __atomic_fetch_add(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * __make_rwx_timed: 带遥测的 __make_rwx
+ */
+static inline int __make_rwx_timed(void *p, const size_t n, A64InstallStats *st)
+{
+    const uint64_t t0 = __read_cntvct();
+    const int      r  = __make_rwx(p, n);
+    st->phase_ns[A64_PHASE_PROTECT] += __read_cntvct() - t0;
+    ++st->syscalls;
+    return r;
+}
+
+/*
+ * __registry_publish: Hook 安装成功后写入条目的元数据并使其对读取方可见
+ *
+ * 同时提交本次安装的遥测(st 在此之后以纳秒为单位)。
+ */
+static void __registry_publish(A64HookStatsEntry *e, void *symbol, void *replace, void *trampoline,
+                               const uint32_t shape, const uint32_t patch_size, A64InstallStats *st)
+{
+    __install_commit(st, true);
+    if (e == NULL) return;
+
+    __seq_write_begin(&e->seq);
+    e->symbol          = __uintval(symbol);
+    e->replace         = __uintval(replace);
+    e->trampoline      = __uintval(trampoline);
+    e->patch_shape     = shape;
+    e->patch_size      = patch_size;
+    e->trampoline_size = static_cast<uint32_t>(st->trampoline_bytes);
+    e->flags          |= A64_HOOK_ENABLED;
+    e->install         = *st;
+    __seq_write_end(&e->seq);
+}
+
+/*
+ * hook_patch: 启用/停用 Hook 时改写的入口字, 下标为 hook id
+ *
+ * 切换只改写入口处的一个对齐的 32 位字, 单次存储对正在取指的其他线程是原子的:
+ *   - 近跳转: 在 B replace 和原始的第一条指令之间切换
+ *   - 远跳转: 在补丁的第一个字(NOP 或 LDR)和 B trampoline 之间切换, 后面的
+ *     LDR/BR/地址保持不变, 已经越过第一个字的线程仍会完整地执行旧的跳转序列
+ * disabled 为 0 表示不支持切换(远跳转没有跳板, 或跳板超出 B 指令的范围)。
+ */
+struct hook_patch
+{
+    uint32_t *word;
+    uint32_t  enabled;
+    uint32_t  disabled;
+    uint32_t  backup[A64_MAX_INSTRUCTIONS];      // 被入口补丁覆盖的原始指令, 供 A64HookDescribe 使用
+    uint8_t   map[A64_MAX_INSTRUCTIONS + 1];     // 原始指令在跳板中的字偏移, 见 __relocate_map
+};
+
+static hook_patch __patches[A64_MAX_HOOKS];
+
+/*
+ * __patch_record: 记录切换用的入口字, 必须在 __registry_publish 之前调用
+ */
+static void __patch_record(const A64HookStatsEntry *e, uint32_t *word, const uint32_t enabled, const uint32_t disabled)
+{
+    if (e == NULL) return;
+    hook_patch *p = &__patches[e->id];
+    p->word     = word;
+    p->enabled  = enabled;
+    p->disabled = disabled;
+}
+
+/*
+ * __patch_backup: 在改写入口之前保存原始指令和修复后的位置, map 为 NULL 表示没有跳板
+ */
+static void __patch_backup(const A64HookStatsEntry *e, const uint32_t *original, const int32_t count, const uint32_t *map)
+{
+    static_assert(__trampoline_bound(A64_MAX_INSTRUCTIONS) / sizeof(uint32_t) <= 0xffu, "please widen hook_patch::map!");
+
+    if (e == NULL) return;
+    hook_patch *p = &__patches[e->id];
+    memcpy(p->backup, original, static_cast<size_t>(count) * sizeof(uint32_t));
+    for (int32_t i = 0; i <= count; ++i) {
+        p->map[i] = map != NULL ? static_cast<uint8_t>(map[i] / sizeof(uint32_t)) : 0u;
+    }
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * buf_writer: 写入调用者提供的字符串缓冲区, 与 snprintf 一样截断并统计完整输出的长度
+ */
+struct buf_writer
+{
+    char  *buf;
+    size_t len;
+    size_t pos;
+
+    void put(const char *fmt, ...) __attribute__((__format__(__printf__, 2, 3))) {
+        va_list ap;
+        va_start(ap, fmt);
+        const int n = vsnprintf(this->pos < this->len ? this->buf + this->pos : NULL,
+                                this->pos < this->len ? this->len - this->pos : 0u, fmt, ap);
+        va_end(ap);
+        if (n > 0) this->pos += static_cast<size_t>(n);
+    }
+};
+
+/*
+ * __literal_bytes: LDR (literal) 加载的字节数, 不是 LDR (literal) 时返回 -1, PRFM 返回 0
+ */
+static inline int32_t __literal_bytes(const uint32_t ins)
+{
+    if ((ins & 0x3b000000u) != 0x18000000u) return -1;
+    static const int8_t sizes[2][4] = { { 4, 8, 4, 0 }, { 4, 8, 16, -1 } };  // [V][opc]
+    return sizes[(ins >> 26) & 1u][ins >> 30];
+}
+
+/*
+ * __reg_name: 通用寄存器的名称, 编号 31 在这些指令中是零寄存器
+ */
+static inline const char *__reg_name(char (&buf)[8], const char sf, const uint32_t n)
+{
+    if (n == 31u) {
+        snprintf(buf, sizeof(buf), "%czr", sf);
+    } else {
+        snprintf(buf, sizeof(buf), "%c%u", sf, n);
+    }
+    return buf;
+}
+
+/*
+ * __disasm: 反汇编修复器会生成或改写的几类指令, 其他指令输出为 .inst
+ *
+ * 覆盖 B/BL、B.cond、CBZ/CBNZ、TBZ/TBNZ、LDR/LDRSW/PRFM (literal)、ADR/ADRP、
+ * BR/BLR/RET、NOP、跳板开头的 BTI c 和陷阱 Hook 使用的 BRK, 跳转和加载的目标按 pc 计算为绝对地址。
+ */
+static void __disasm(buf_writer *w, const uint32_t ins, const uint64_t pc)
+{
+    static const char conds[16][3] = { "eq", "ne", "hs", "lo", "mi", "pl", "vs", "vc",
+                                       "hi", "ls", "ge", "lt", "gt", "le", "al", "nv" };
+    const uint32_t rt = ins & 0x1fu;
+    const char     sf = (ins & 0x80000000u) != 0u ? 'x' : 'w';
+    const uint64_t imm19 = pc + static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(ins << 8) >> 11) & ~3ll);
+    char           reg[8];
+
+    if (ins == A64_NOP) {
+        w->put("nop");
+    } else if (ins == A64_BTI_C) {
+        w->put("bti c");
+    } else if ((ins & 0xffe0001fu) == 0xd4200000u) {
+        w->put("brk #0x%x", (ins >> 5) & 0xffffu);
+    } else if ((ins & 0x7c000000u) == 0x14000000u) {
+        w->put("%s 0x%" PRIx64, (ins & 0x80000000u) != 0u ? "bl" : "b",
+               pc + static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(ins << 6) >> 4)));
+    } else if ((ins & 0xff000010u) == 0x54000000u) {
+        w->put("b.%s 0x%" PRIx64, conds[ins & 0xfu], imm19);
+    } else if ((ins & 0x7e000000u) == 0x34000000u) {
+        w->put("%s %s, 0x%" PRIx64, (ins & 0x01000000u) != 0u ? "cbnz" : "cbz", __reg_name(reg, sf, rt), imm19);
+    } else if ((ins & 0x7e000000u) == 0x36000000u) {
+        w->put("%s %s, #%u, 0x%" PRIx64, (ins & 0x01000000u) != 0u ? "tbnz" : "tbz", __reg_name(reg, sf, rt),
+               ((ins >> 26) & 0x20u) | ((ins >> 19) & 0x1fu),
+               pc + static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(ins << 13) >> 16) & ~3ll));
+    } else if (__literal_bytes(ins) >= 0) {
+        const uint32_t opc = ins >> 30;
+        if ((ins & 0x04000000u) != 0u) {
+            w->put("ldr %c%u, 0x%" PRIx64, "sdq"[opc], rt, imm19);
+        } else if (opc == 3u) {
+            w->put("prfm #%u, 0x%" PRIx64, rt, imm19);
+        } else {
+            w->put("%s %s, 0x%" PRIx64, opc == 2u ? "ldrsw" : "ldr", __reg_name(reg, opc != 0u ? 'x' : 'w', rt), imm19);
+        }
+    } else if ((ins & 0x1f000000u) == 0x10000000u) {
+        const int64_t imm = static_cast<int64_t>(static_cast<int32_t>((((ins >> 5) & 0x7ffffu) << 13) | (((ins >> 29) & 3u) << 11)) >> 11);
+        if ((ins & 0x80000000u) != 0u) {
+            w->put("adrp %s, 0x%" PRIx64, __reg_name(reg, 'x', rt), (pc & ~static_cast<uint64_t>(0xfffu)) + static_cast<uint64_t>(imm * 4096));
+        } else {
+            w->put("adr %s, 0x%" PRIx64, __reg_name(reg, 'x', rt), pc + static_cast<uint64_t>(imm));
+        }
+    } else if ((ins & 0xff9ffc1fu) == 0xd61f0000u && (ins & 0x00600000u) != 0x00600000u) {
+        static const char *const names[3] = { "br", "blr", "ret" };
+        const uint32_t rn = (ins >> 5) & 0x1fu;
+        if ((ins & 0x00600000u) == 0x00400000u && rn == 30u) {
+            w->put("ret");
+        } else {
+            w->put("%s %s", names[(ins >> 21) & 3u], __reg_name(reg, 'x', rn));
+        }
+    } else {
+        w->put(".inst 0x%08x", ins);
+    }
+}
+
+/*
+ * __describe_code: 逐字输出一段代码, 被其中的 LDR (literal) 引用的字按数据输出
+ *
+ * 跳板和远跳转补丁中的 64 位地址、内联的字面量都是这样嵌在代码中的,
+ * 引用它们的 LDR 后面附上加载的值。
+ */
+static void __describe_code(buf_writer *w, const uint32_t *words, const int32_t n, const uint64_t va,
+                            const uint8_t *map, const int32_t count)
+{
+    int8_t data[__trampoline_bound(A64_MAX_INSTRUCTIONS) / sizeof(uint32_t)] = {};  // 数据起点记录字节数, 后续字为 -1
+    for (int32_t i = 0; i < n; ++i) {
+        const int32_t bytes = __literal_bytes(words[i]);
+        if (data[i] != 0 || bytes <= 0) continue;
+        const int32_t t = i + (static_cast<int32_t>(words[i] << 8) >> 13);
+        if (t > i && t + bytes / 4 <= n) {
+            data[t] = static_cast<int8_t>(bytes);
+            for (int32_t k = 1; k < bytes / 4; ++k) data[t + k] = -1;
+        }
+    }
+
+    for (int32_t i = 0; i < n; ++i) {
+        if (data[i] < 0) continue;
+        w->put("  %016" PRIx64 " ", va + static_cast<uint64_t>(i) * 4u);
+        int32_t index = -1;
+        for (int32_t k = 0; map != NULL && k <= count; ++k) {
+            if (map[k] == i) index = k;
+        }
+        if (index < 0) {
+            w->put("    ");
+        } else if (index == count) {
+            w->put("[>] ");
+        } else {
+            w->put("[%d] ", static_cast<int>(index));
+        }
+
+        if (data[i] > 0) {
+            uint64_t v[2] = { 0u, 0u };
+            memcpy(v, words + i, static_cast<size_t>(data[i]));
+            if (data[i] == 4) {
+                w->put("%08x  .word 0x%08x\n", words[i], static_cast<uint32_t>(v[0]));
+            } else if (data[i] == 8) {
+                w->put("%08x  .quad 0x%016" PRIx64 "\n", words[i], v[0]);
+            } else {
+                w->put("%08x  .quad 0x%016" PRIx64 ", 0x%016" PRIx64 "\n", words[i], v[0], v[1]);
+            }
+            continue;
+        }
+
+        w->put("%08x  ", words[i]);
+        __disasm(w, words[i], va + static_cast<uint64_t>(i) * 4u);
+        const int32_t bytes = __literal_bytes(words[i]);
+        const int32_t t     = i + (static_cast<int32_t>(words[i] << 8) >> 13);
+        if (bytes > 0 && t > i && t < n && data[t] == bytes) {
+            uint64_t v[2] = { 0u, 0u };
+            memcpy(v, words + t, static_cast<size_t>(bytes));
+            if (bytes == 16) {
+                w->put("  // =0x%016" PRIx64 "%016" PRIx64, v[1], v[0]);
+            } else {
+                w->put("  // =0x%" PRIx64, v[0]);
+            }
+        }
+        w->put("\n");
+    }
+}
+
+/*
+ * __stats_record_call: 累加一次调用的计数器和耗时直方图
+ */
+static inline void __stats_record_call(A64HookStatsEntry *e, const uint64_t ticks)
+{
+    const uint32_t bucket = ticks != 0u ? 63u - static_cast<uint32_t>(__builtin_clzll(ticks)) : 0u;
+    __atomic_fetch_add(&e->calls, 1u, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&e->total_ticks, ticks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&e->hist[bucket < A64_STATS_HIST_BUCKETS ? bucket : A64_STATS_HIST_BUCKETS - 1u], 1u, __ATOMIC_RELAXED);
+}
+
+//-------------------------------------------------------------------------
+
+A64_JNIEXPORT const A64HookStats *A64StatsGet(void)
+{
+    return __load_acquire(&__stats);
+}
+
+A64_JNIEXPORT void A64GetInstallStats(A64InstallStats *out)
+{
+    const uint64_t *src = reinterpret_cast<const uint64_t *>(&__install_totals);
+    uint64_t       *dst = reinterpret_cast<uint64_t *>(out);
+    for (size_t i = 0u; i < sizeof(A64InstallStats) / sizeof(uint64_t); ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+A64_JNIEXPORT int A64GetHookInstallStats(int hook_id, A64InstallStats *out)
+{
+    const A64HookStats *stats = __load_acquire(&__stats);
+    if (stats == NULL || hook_id < 0 || static_cast<uint32_t>(hook_id) >= __load_acquire(&stats->count)) {
+        return -1;
+    }
+
+    A64HookStatsEntry e;
+    if (!A64StatsReadEntry(stats, static_cast<uint32_t>(hook_id), &e)) return -1;
+    *out = e.install;
+    return 0;
+}
+
+A64_JNIEXPORT int A64StatsExport(const char *path)
+{
+    pthread_once(&__stats_once, __stats_init);
+    if (__stats == NULL) return -1;
+    if (__load_acquire(&__stats_fd) >= 0) return __stats_fd;
+
+    // 写锁覆盖复制和重新映射的整个过程, 并发的导出调用在这里等待第一次导出完成
+    pthread_rwlock_wrlock(&__stats_lock);
+    if (__stats_fd >= 0) {
+        pthread_rwlock_unlock(&__stats_lock);
+        return __stats_fd;
+    }
+
+    const int fd = path != NULL ? open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)
+                                : static_cast<int>(::syscall(__NR_memfd_create, "a64hook-stats", MFD_CLOEXEC));
+    if (fd < 0) {
+        A64_LOGE("failed to create stats file, errno = %d", errno);
+        pthread_rwlock_unlock(&__stats_lock);
+        return -1;
+    }
+
+    // 共享文件是稀疏的: 只写入已分配的条目, 其余部分读出来都是 0
+    const size_t used = sizeof(A64HookStats) + __load_acquire(&__stats->count) * sizeof(A64HookStatsEntry);
+    if (ftruncate(fd, static_cast<off_t>(__stats_size)) != 0 ||
+        pwrite(fd, __stats, used, 0) != static_cast<ssize_t>(used) ||
+        ::mmap(__stats, __stats_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        A64_LOGE("failed to export stats, errno = %d", errno);
+        close(fd);
+        pthread_rwlock_unlock(&__stats_lock);
+        return -1;
+    }
+    __store_release(&__stats_fd, fd);
+    pthread_rwlock_unlock(&__stats_lock);
+    return fd;
+}
+
+//-------------------------------------------------------------------------
+
+extern "C" {
+    /*
+     * __insns_pool: 预分配的跳板内存池
+     *
+     * 这是一个静态分配的数组, 用于存储所有 Hook 的跳板代码。
+     * 数组按页对齐(__page_size = 4096), 便于 mprotect 修改权限。
+     *
+     * 每个跳板槽位大小: (A64_MAX_INSTRUCTIONS * 10 + 2) * sizeof(uint32_t)
+     *   = (5 * 10 + 2) * 4 = 208 字节
+     *
+     * 这个大小足够容纳:
+     *   - 开头可选的 BTI c(见 __trampoline_bound)
+     *   - 最多 5 条原始指令的修复版本(每条最多展开为多条)
+     *   - 跳转回原函数的指令
+     *
+     * 总内存: 256 * 208 = 53248 字节 = 52KB
+     */
+    static __attribute__((__aligned__(__page_size))) uint32_t __insns_pool[A64_MAX_BACKUPS][A64_MAX_INSTRUCTIONS * 10 + 2];
+
+    /*
+     * __insns_index: __insns_pool 中最后一个已分配槽位的下标, 初始为 -1
+     */
+    static volatile int32_t __insns_index = -1;
 
     //-------------------------------------------------------------------------
 
-    /*
-     * FastAllocateTrampoline: 从跳板池中快速分配一个槽位
-     *
-     * 使用原子操作实现线程安全的槽位分配, 无需加锁。
-     * __atomic_increase 是一个原子递增操作, 多线程同时调用也能保证
-     * 每个线程获得不同的索引值。
-     *
-     * @return: 成功返回跳板槽位的地址, 失败(池已满)返回 NULL
-     */
-    static uint32_t *FastAllocateTrampoline()
-    {
-        static_assert((A64_MAX_INSTRUCTIONS * 10 * sizeof(uint32_t)) % 8 == 0, "8-byte align");
-        static volatile int32_t __index = -1;  // 初始为 -1, 第一次调用后变为 0
+    /*
+     * A64HookInit: 初始化类, 用于在程序启动时设置跳板池的内存权限
+     *
+     * 使用静态对象的构造函数实现自动初始化。当包含此代码的共享库被加载时,
+     * 静态对象 __init 会被构造, 其构造函数会被自动调用。
+     *
+     * 构造函数中调用 __make_rwx 将跳板池设置为可读/可写/可执行,
+     * 这是后续写入和执行跳板代码的前提条件。
+     */
+    class A64HookInit
+    {
+    public:
+        A64HookInit()
+        {
+            __make_rwx(__insns_pool, sizeof(__insns_pool));
+            A64_LOGI("insns pool initialized.");
+        }
+    };
+    static A64HookInit __init;
+
+    //-------------------------------------------------------------------------
+
+    /*
+     * FastAllocateTrampoline: 从跳板池中快速分配一个槽位
+     *
+     * 使用原子操作实现线程安全的槽位分配, 无需加锁。
+     * __atomic_increase 是一个原子递增操作, 多线程同时调用也能保证
+     * 每个线程获得不同的索引值。
+     *
+     * @return: 成功返回跳板槽位的地址, 失败(池已满)返回 NULL
+     */
+    static uint32_t *FastAllocateTrampoline()
+    {
+        static_assert(sizeof(__insns_pool[0]) % 8 == 0, "8-byte align");
+        static_assert(sizeof(__insns_pool[0]) >= __trampoline_bound(A64_MAX_INSTRUCTIONS), "trampoline slot too small");
+
+        int32_t i = __atomic_increase(&__insns_index);
+        if (__predict_true(i >= 0 && i < __countof(__insns_pool))) {
+            return __insns_pool[i];
+        }
+
+        A64_LOGE("failed to allocate trampoline!");
+        return NULL;
+    }
+
+    //-------------------------------------------------------------------------
+
+    /*
+     * __fix_trampoline: 生成跳板, 支持 BTI 且 rwx_size 足够(__trampoline_bound)时开头放一条 BTI c
+     *
+     * 跳板通过 result 返回给调用者, 以函数指针(BLR)调用。map 中的偏移相对跳板开头, 包含 BTI c。
+     * trampoline 是写入地址, 执行地址为 trampoline + out_bias, 见 __fix_instructions。
+     */
+    static void __fix_trampoline(uint32_t *original, const int32_t count, uint32_t *trampoline,
+                                 const uintptr_t rwx_size, A64InstallStats *st, uint32_t *map, const int64_t out_bias)
+    {
+        uint32_t pad = 0u;
+        if (__cpu_has(A64_CPU_BTI) && rwx_size >= __trampoline_bound(count)) {
+            trampoline[0] = A64_BTI_C;
+            __flush_cache(reinterpret_cast<uint8_t *>(trampoline) + out_bias, sizeof(uint32_t));
+            st->trampoline_bytes += sizeof(uint32_t);
+            pad = 1u;
+        }
+        __fix_instructions(original, count, trampoline + pad, st, map, out_bias);
+        for (int32_t i = 0; i <= count; ++i) map[i] += pad * sizeof(uint32_t);
+    }
+
+    /*
+     * A64HookFunctionV: 带自定义跳板缓冲区的 Hook 实现
+     *
+     * 这是 Hook 的核心实现函数。它完成以下工作:
+     *   1. 备份并修复原函数开头的指令到跳板
+     *   2. 将原函数入口替换为跳转到替换函数的代码
+     *
+     * Hook 后的执行流程:
+     *   调用原函数 -> 跳转到替换函数 -> (可选)调用跳板执行原逻辑 -> 返回
+     *
+     * @param symbol:   要 Hook 的目标函数地址
+     * @param replace:  替换函数地址
+     * @param rwx:      跳板缓冲区(需要有 RWX 权限)
+     * @param rwx_size: 跳板缓冲区大小
+     * @param entry:    注册表条目, 安装成功后写入元数据, 可以为 NULL
+     * @param st:       安装遥测, 调用者可以预先累加分配阶段的耗时(计数周期)
+     * @param out_bias: 跳板的执行地址 - rwx, 只有 A64HookFunctionVX 不为 0, 此时 rwx 只需可写
+     * @return:         成功返回跳板(执行)地址, 失败返回 NULL
+     */
+    static void *__hook_function(void *const symbol, void *const replace,
+                                 void *const rwx, const uintptr_t rwx_size,
+                                 A64HookStatsEntry *entry, A64InstallStats *st, const int64_t out_bias = 0)
+    {
+        static constexpr uint_fast64_t mask = 0x03ffffffu;  // B 指令偏移掩码 0b00000011111111111111111111111111
+
+        uint32_t *trampoline = static_cast<uint32_t *>(rwx);
+        uint32_t *original = static_cast<uint32_t *>(symbol);
+        uint32_t  map[A64_MAX_INSTRUCTIONS + 1];
+        uint64_t  t0;
+
+        static_assert(A64_MAX_INSTRUCTIONS >= 5, "please fix A64_MAX_INSTRUCTIONS!");
+
+        /*
+         * 计算从原函数到替换函数的 PC 相对偏移
+         *
+         * 如果偏移在 +/-128MB 范围内, 只需覆盖一条指令(B 指令)。
+         * 否则需要使用 LDR+BR 间接跳转, 需要覆盖 4-5 条指令。
+         */
+        auto pc_offset = static_cast<int64_t>(__intval(replace) - __intval(symbol)) >> 2;
+        const int32_t count = __patch_words(symbol, replace);
+
+        if (count > 1) {
+            /*
+             * 远距离跳转: 需要使用 LDR+BR 组合
+             *
+             * 指令序列:
+             *   [NOP]             ; 可选, 用于对齐
+             *   LDR X17, #8       ; 从 PC+8 加载目标地址
+             *   BR  X17           ; 跳转到目标
+             *   <64-bit address>  ; 替换函数地址
+             *
+             * 是否需要 NOP 取决于 original+2 的对齐情况:
+             *   - 如果 (original+2) 已经 8 字节对齐 -> 不需要 NOP, 共 4 条指令
+             *   - 否则 -> 需要 NOP 对齐, 共 5 条指令
+             */
+            if (trampoline) {
+                // 检查跳板缓冲区大小
+                if (rwx_size < __fix_bound(count)) {
+                    A64_LOGE("rwx size is too small to hold %zu bytes backup instructions!", __fix_bound(count));
+                    __install_commit(st, false);
+                    return NULL;
+                }
+                // 备份并修复原始指令
+                __fix_trampoline(original, count, trampoline, rwx_size, st, map, out_bias);
+                trampoline = reinterpret_cast<uint32_t *>(__intval(trampoline) + out_bias);
+            }
+
+            // 修改原函数入口
+            if (__make_rwx_timed(original, 5 * sizeof(uint32_t), st) == 0) {
+                __patch_backup(entry, original, count, trampoline != NULL ? map : NULL);
+                // 停用时第一个字改为跳到跳板, 跳板执行被覆盖的指令后回到原函数; 安装期间也用它过渡
+                const int64_t  back     = trampoline != NULL ? (__intval(trampoline) - __intval(original)) >> 2 : INT64_MAX;
+                const uint32_t disabled = llabs(back) < static_cast<int64_t>(mask >> 1) ? 0x14000000u | (back & mask) : 0u;
+                uint32_t patch[5];
+                __emit_patch(patch, replace, count);
+                __store_far_patch(original, patch, count, disabled != 0u ? disabled : 0x14000000u, st);
+                __patch_record(entry, original, patch[0], disabled);
+                __registry_publish(entry, symbol, replace, trampoline, A64_PATCH_FAR, count * sizeof(uint32_t), st);
+            } else {
+                A64_LOGE("mprotect failed with errno = %d, p = %p, size = %zu",
+                         errno, original, 5 * sizeof(uint32_t));
+                __install_commit(st, false);
+                trampoline = NULL;
+            }
+        } else {
+            /*
+             * 近距离跳转: 只需一条 B 指令
+             *
+             * 这是最理想的情况, 只需覆盖一条指令(4字节), 对原函数影响最小。
+             * 当替换函数与原函数在同一个共享库中或相邻库中时通常会走这个分支。
+             */
+            if (trampoline) {
+                if (rwx_size < __fix_bound(1)) {
+                    A64_LOGE("rwx size is too small to hold %zu bytes backup instructions!", __fix_bound(1));
+                    __install_commit(st, false);
+                    return NULL;
+                }
+                __fix_trampoline(original, 1, trampoline, rwx_size, st, map, out_bias);
+                trampoline = reinterpret_cast<uint32_t *>(__intval(trampoline) + out_bias);
+            }
+
+            if (__make_rwx_timed(original, 1 * sizeof(uint32_t), st) == 0) {
+                /*
+                 * 使用原子比较交换来写入跳转指令
+                 *
+                 * __code_cmpswap 确保写入的原子性: 如果 original[0] 的当前值
+                 * 等于 *original(即我们之前读取的值), 则将其替换为新的 B 指令。
+                 *
+                 * 这可以避免与其他线程的竞争条件, 虽然在 Hook 场景中竞争不太常见,
+                 * 但这是一个好习惯。
+                 */
+                __patch_backup(entry, original, 1, trampoline != NULL ? map : NULL);
+                t0 = __read_cntvct();
+                const uint32_t insn0 = *original;
+                __code_cmpswap(original, insn0, 0x14000000u | (pc_offset & mask));
+                st->phase_ns[A64_PHASE_PATCH] += __read_cntvct() - t0;
+
+                t0 = __read_cntvct();
+                __flush_cache(symbol, 1 * sizeof(uint32_t));
+                st->phase_ns[A64_PHASE_FLUSH] += __read_cntvct() - t0;
+
+                __patch_record(entry, original, 0x14000000u | (pc_offset & mask), insn0);
+                __registry_publish(entry, symbol, replace, trampoline, A64_PATCH_NEAR, 1 * sizeof(uint32_t), st);
+            } else {
+                A64_LOGE("mprotect failed with errno = %d, p = %p, size = %zu",
+                         errno, original, 1 * sizeof(uint32_t));
+                __install_commit(st, false);
+                trampoline = NULL;
+            }
+        }
+
+        return trampoline;
+    }
+
+    A64_JNIEXPORT void *A64HookFunctionV(void *const symbol, void *const replace,
+                                         void *const rwx, const uintptr_t rwx_size)
+    {
+        A64InstallStats st = {};
+        const uint64_t  t0 = __read_cntvct();
+        A64HookStatsEntry *entry = __registry_alloc();
+        st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+        void *trampoline = __hook_function(symbol, replace, rwx, rwx_size, entry, &st);
+        __registry_release(entry);
+        return trampoline;
+    }
+
+    /*
+     * A64HookFunctionVX: 跳板的写入地址和执行地址分离的 A64HookFunctionV
+     *
+     * 跳板只通过 rw 写入, 修复时的 PC 相对计算、缓存刷新、返回值和注册表中的跳板地址都使用 rx。
+     */
+    A64_JNIEXPORT void *A64HookFunctionVX(void *const symbol, void *const replace,
+                                          void *const rw, void *const rx, const uintptr_t size)
+    {
+        if (rw == NULL || rx == NULL || ((__uintval(rw) ^ __uintval(rx)) & 7u) != 0u) {
+            A64_LOGE("invalid trampoline mapping rw = %p, rx = %p!", rw, rx);
+            return NULL;
+        }
+
+        A64InstallStats st = {};
+        const uint64_t  t0 = __read_cntvct();
+        A64HookStatsEntry *entry = __registry_alloc();
+        st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+        void *trampoline = __hook_function(symbol, replace, rw, size, entry, &st, __intval(rx) - __intval(rw));
+        __registry_release(entry);
+        return trampoline;
+    }
+
+    //-------------------------------------------------------------------------
+
+    A64_JNIEXPORT int A64HookFind(void *const symbol)
+    {
+        if (__load_acquire(&__stats) == NULL) return -1;
+        for (int32_t i = static_cast<int32_t>(__load_acquire(&__stats->count)) - 1; i >= 0; --i) {
+            const A64HookStatsEntry *e = __stats_entry(static_cast<uint32_t>(i));
+            if (__load_acquire(&e->seq) != 0u && e->symbol == __uintval(symbol)) return i;
+        }
+        return -1;
+    }
+
+    /*
+     * A64HookSetEnabled: 用一次原子比较交换改写入口字, 见 hook_patch
+     *
+     * 比较交换的期望值是本 Hook 自己写入的字, 入口被之后安装的 Hook 覆盖时会失败,
+     * 因此不会破坏 Hook 链。同一个 Hook 不应在多个线程中同时切换。
+     */
+    A64_JNIEXPORT int A64HookSetEnabled(int hook_id, int enabled)
+    {
+        if (__load_acquire(&__stats) == NULL || hook_id < 0 ||
+            static_cast<uint32_t>(hook_id) >= __load_acquire(&__stats->count)) {
+            return -1;
+        }
+        A64HookStatsEntry *e = __stats_entry(static_cast<uint32_t>(hook_id));
+        if (__load_acquire(&e->seq) == 0u || (e->flags & A64_HOOK_REMOVED) != 0u) return -1;
+
+        const hook_patch *p = &__patches[hook_id];
+        if (p->word == NULL || p->disabled == 0u) {
+            A64_LOGE("hook %d cannot be toggled!", hook_id);
+            return -1;
+        }
+
+        const uint32_t from = enabled ? p->disabled : p->enabled;
+        const uint32_t to   = enabled ? p->enabled : p->disabled;
+        if (__load_acquire(p->word) != to) {
+            if (__make_rwx(p->word, sizeof(uint32_t)) != 0) {
+                A64_LOGE("mprotect failed with errno = %d, p = %p", errno, p->word);
+                return -1;
+            }
+            if (!__code_cmpswap(p->word, from, to)) {
+                A64_LOGE("entry of hook %d was overwritten by another hook!", hook_id);
+                return -1;
+            }
+            __flush_cache(p->word, sizeof(uint32_t));
+        }
+
+        __seq_write_begin(&e->seq);
+        e->flags = enabled ? e->flags | A64_HOOK_ENABLED : e->flags & ~A64_HOOK_ENABLED;
+        __seq_write_end(&e->seq);
+        return 0;
+    }
+
+    A64_JNIEXPORT int A64UnhookFunction(int hook_id)
+    {
+        if (A64HookSetEnabled(hook_id, 0) != 0) return -1;
+
+        A64HookStatsEntry *e = __stats_entry(static_cast<uint32_t>(hook_id));
+        __seq_write_begin(&e->seq);
+        e->flags |= A64_HOOK_REMOVED;
+        __seq_write_end(&e->seq);
+        return 0;
+    }
+
+    /*
+     * A64HookDescribe: 按注册表条目和 hook_patch 中保存的备份输出文本描述
+     *
+     * 补丁和跳板直接从内存读取, 因此反映的是当前实际执行的内容(例如停用后入口的第一个字)。
+     */
+    A64_JNIEXPORT int A64HookDescribe(int hook_id, char *buf, size_t len)
+    {
+        const A64HookStats *stats = __load_acquire(&__stats);
+        if (stats == NULL || hook_id < 0 || static_cast<uint32_t>(hook_id) >= __load_acquire(&stats->count) ||
+            (buf == NULL && len != 0u)) {
+            return -1;
+        }
+
+        A64HookStatsEntry e;
+        if (!A64StatsReadEntry(stats, static_cast<uint32_t>(hook_id), &e) || e.symbol == 0u) return -1;
+
+        const hook_patch *p     = &__patches[hook_id];
+        const int32_t     count = static_cast<int32_t>(e.patch_size / sizeof(uint32_t));
+        const int32_t     words = static_cast<int32_t>(e.trampoline_size / sizeof(uint32_t));
+        if (count < 1 || count > A64_MAX_INSTRUCTIONS || words > static_cast<int32_t>(__trampoline_bound(A64_MAX_INSTRUCTIONS) / sizeof(uint32_t))) {
+            return -1;
+        }
+
+        buf_writer w = { buf, len, 0u };
+        w.put("hook %d: symbol 0x%" PRIx64 ", replace 0x%" PRIx64 ", %s patch, %s%s%s\n", hook_id, e.symbol, e.replace,
+              e.patch_shape == A64_PATCH_NEAR ? "near" : e.patch_shape == A64_PATCH_TRAP ? "trap" : "far", (e.flags & A64_HOOK_ENABLED) != 0u ? "enabled" : "disabled",
+              (e.flags & A64_HOOK_REMOVED) != 0u ? ", removed" : "", (e.flags & A64_HOOK_PROBE) != 0u ? ", probe" : "");
+
+        uint32_t code[__trampoline_bound(A64_MAX_INSTRUCTIONS) / sizeof(uint32_t)];
+        memcpy(code, reinterpret_cast<const void *>(e.symbol), e.patch_size);
+        w.put("patch (%u bytes):\n", e.patch_size);
+        __describe_code(&w, code, count, e.symbol, NULL, 0);
+        w.put("original:\n");
+        __describe_code(&w, p->backup, count, e.symbol, NULL, 0);
+
+        if (e.trampoline == 0u) {
+            w.put("trampoline: none\n");
+        } else {
+            memcpy(code, reinterpret_cast<const void *>(e.trampoline), e.trampoline_size);
+            w.put("trampoline (%u bytes, expansion %.2fx):\n", e.trampoline_size,
+                  static_cast<double>(e.trampoline_size) / static_cast<double>(e.patch_size));
+            __describe_code(&w, code, words, e.trampoline, p->map, count);
+            w.put("map:");
+            for (int32_t i = 0; i < count; ++i) {
+                w.put(" [%d]+0x%x", static_cast<int>(i), p->map[i] * 4u);
+            }
+            w.put(" [>]+0x%x\n", p->map[count] * 4u);
+        }
+        return static_cast<int>(w.pos);
+    }
+
+    //-------------------------------------------------------------------------
+
+    /*
+     * A64HookFunction: 使用内置跳板池的 Hook 接口
+     *
+     * 这是面向用户的主要接口。它自动从跳板池分配槽位, 简化了使用流程。
+     *
+     * @param symbol:  要 Hook 的目标函数
+     * @param replace: 替换函数
+     * @param result:  输出参数, 返回跳板地址用于调用原函数。传 NULL 表示不需要调用原函数。
+     */
+    A64_JNIEXPORT void A64HookFunction(void *const symbol, void *const replace, void **result)
+    {
+        void *trampoline = NULL;
+
+        A64InstallStats st = {};
+        const uint64_t  t0 = __read_cntvct();
+        A64HookStatsEntry *entry = __registry_alloc();
+        if (result != NULL) {
+            // 用户需要调用原函数, 分配跳板
+            trampoline = FastAllocateTrampoline();
+            *result = trampoline;
+            if (trampoline == NULL) {  // 分配失败
+                __registry_release(entry);
+                __install_commit(&st, false);
+                return;
+            }
+        }
+        st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+
+        /*
+         * Android 10 及以上版本的兼容性处理
+         *
+         * 从 Android 10 开始, 系统默认将 .text 段映射为只读+可执行(R-X),
+         * 不再是之前的可读+可写+可执行(RWX)。这是一个安全加固措施。
+         *
+         * 因此在修改原函数入口之前, 需要先调用 mprotect 添加写权限。
+         * 这里预先调用一次 __make_rwx 确保后续的写入操作能成功。
+         *
+         * 注意: 5 * sizeof(size_t) = 40 字节, 比实际需要的稍大一些, 以确保覆盖。
+         */
+        __make_rwx_timed(symbol, 5 * sizeof(size_t), &st);
+
+        trampoline = __hook_function(symbol, replace, trampoline, sizeof(__insns_pool[0]), entry, &st);
+        __registry_release(entry);
+
+        if (trampoline == NULL && result != NULL) {
+            *result = NULL;  // Hook 失败, 清空结果
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+// 映射在目标函数附近的代码区域
+//-------------------------------------------------------------------------
+
+/*
+ * __branch_reachable: [p, p + bytes) 是否都在 symbol 的 B 指令范围(+/-128MB)内
+ */
+static inline bool __branch_reachable(const void *p, const uintptr_t bytes, const void *symbol)
+{
+    static constexpr intptr_t range = 0x7fffffc;
+    const intptr_t lo = __intval(p) - __intval(symbol);
+    return lo >= -range && lo + static_cast<intptr_t>(bytes) <= range;
+}
+
+/*
+ * __map_near: 在 symbol 的 B 指令范围内映射 size 字节的 RWX 内存, 找不到时返回 NULL
+ *
+ * 依次以 symbol 前后不同距离作为 mmap 的提示地址, 内核不采用提示时检查实际地址是否可用。
+ */
+static void *__map_near(const void *symbol, const size_t size)
+{
+    static const intptr_t hints[] = { -(32 << 20), 32 << 20, -(96 << 20), 96 << 20, -(8 << 20), 8 << 20 };
+    for (size_t i = 0; i < sizeof(hints) / sizeof(hints[0]); ++i) {
+        void *hint = __ptr(__align_down(static_cast<uintptr_t>(__intval(symbol) + hints[i]), static_cast<uintptr_t>(__page_size)));
+        void *p    = mmap(hint, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) continue;
+        if (__branch_reachable(p, size, symbol)) return p;
+        munmap(p, size);
+    }
+    return NULL;
+}
+
+//-------------------------------------------------------------------------
+// 探针(Probe)与调用追踪(Trace)
+//-------------------------------------------------------------------------
+
+/*
+ * hook_record: 单个探针的描述信息
+ *
+ * 桩代码通过字面量持有指向它的指针, 并把它作为第一个参数传给入口/出口回调。
+ * symbol 在探针安装成功之后才会被写入(release 语义), 读取方据此判断记录是否有效。
+ */
+struct hook_record
+{
+    uint32_t           id;          // hook id, 即注册表条目下标
+    uint32_t           flags;       // A64_PROBE_* 标志
+    void              *symbol;      // 目标函数地址
+    void              *trampoline;  // 跳板地址(原函数)
+    const char        *name;        // 探针名称, 可以为 NULL
+    A64HookStatsEntry *stats;       // 注册表条目, 用于累加调用计数和耗时
+    uint32_t           marker_every;  // 每 N 次调用输出一次切片标记
+    uint32_t           marker_max;    // 每秒最多输出的切片数量
+    uint64_t           marker_calls;  // 用于采样的调用计数
+    uint64_t           marker_sec;    // 当前限速窗口(秒)
+    uint32_t           marker_used;   // 当前窗口内已输出的切片数量
+};
+
+static hook_record      __probe_records[A64_MAX_BACKUPS];  // 探针描述, 由 probe_site::hook 引用
+static volatile int32_t __probe_count = 0;  // 已安装的探针数量, 只在 __stub_arena_lock 下增加
+
+/*
+ * shadow_frame: 影子栈中的一帧
+ *
+ * 入口回调把真实的返回地址和入口时刻的状态保存在这里, 出口回调据此恢复 LR
+ * 并生成完整的追踪记录。sp 用于识别被 longjmp 跳过、永远不会返回的帧。
+ */
+struct shadow_frame
+{
+    uint64_t     lr;       // 真实返回地址
+    uint64_t     sp;       // 进入被探测函数时的 SP, 函数返回时 SP 恢复为该值
+    hook_record *hook;     // 所属探针
+    uint64_t     ts;       // 进入时的 CNTVCT_EL0
+    uint64_t     args[4];  // 进入时的 X0-X3
+    uint32_t     marked;   // 非 0 表示入口已输出 "B" 标记, 值为当时的标记会话序号, 出口只向同一会话输出配对的 "E"
+    uint32_t     node;     // 调用上下文树中的节点(从 1 开始, 0 表示根)
+    uint64_t     child;    // 已返回的子调用耗时之和, 用于计算不包含子调用的耗时
+};
+
+// 探针桩代码入口/出口部分在栈上开辟的空间, 见 __probe_stub_template
+static constexpr uint64_t __probe_enter_frame = 0xe0;
+static constexpr uint64_t __probe_leave_frame = 0x60;
+
+/*
+ * profile_table: 每个线程的调用上下文树(Calling Context Tree)
+ *
+ * 节点以 (父节点, hook id) 为键存放在开放寻址哈希表中, 因此从影子栈上的父节点
+ * 找到子节点只需一次哈希查找。父节点总是先于子节点创建, 即 nodes[i].parent < i,
+ * 输出时可以按下标顺序一次性算出每个节点的调用栈哈希。
+ *
+ * 只有所属线程会插入节点和累加计数; A64ProfileDump 在其他线程中读取, 通过
+ * 槽位的 release/acquire 保证看到的节点已经完整初始化。
+ */
+struct profile_node
+{
+    uint32_t parent;  // 父节点(0 表示根)
+    uint32_t hook_id; // hook id
+    uint64_t calls;   // 调用次数
+    uint64_t incl;    // 包含子调用的耗时(计数周期)
+    uint64_t excl;    // 不包含子调用的耗时(计数周期)
+};
+
+struct profile_table
+{
+    uint32_t     used;                            // 已使用的节点数量(nodes[0] 保留为根)
+    uint32_t     slots[A64_PROFILE_NODES * 2];    // 哈希槽位, 存放节点下标, 0 表示空
+    profile_node nodes[A64_PROFILE_NODES];
+};
+
+/*
+ * trace_ring: 每个线程私有的单生产者/单消费者(SPSC)环形缓冲区
+ *
+ * 生产者是所属线程(出口回调), 消费者是 drainer 线程。head 只由生产者写入,
+ * tail 只由消费者写入, 两者位于不同的缓存行以避免伪共享(False Sharing)。
+ * 生产者缓存一份 tail(tail_cache), 只有缓冲区看起来已满时才去读取真实的 tail,
+ * 因此热路径上只有几次普通存储和一次 head 的 release 存储, 没有任何系统调用。
+ */
+struct trace_ring
+{
+    uint64_t head;        // 生产者写入位置(单调递增)
+    uint64_t tail_cache;  // 生产者缓存的消费位置
+    uint64_t dropped;     // 因缓冲区已满而丢弃的记录数, 由 drainer 取走并清零
+    __attribute__((__aligned__(64))) uint64_t       tail;  // 消费者读取位置(单调递增)
+    __attribute__((__aligned__(64))) A64TraceRecord recs[A64_TRACE_RING_RECORDS];
+};
+
+/*
+ * thread_block: 每个线程的私有状态
+ *
+ * 线程第一次经过探针时通过 mmap 分配, 并挂到全局链表 __thread_blocks 上供
+ * drainer 遍历。链表只增不减: 线程退出后线程块被标记为 dead, 其环形缓冲区被
+ * 取空后变为 free, 可以被新线程复用, 因此不需要任何锁。
+ */
+struct thread_block
+{
+    static constexpr int32_t free  = 0;  // 可被新线程复用
+    static constexpr int32_t alive = 1;  // 属于一个存活的线程
+    static constexpr int32_t dead  = 2;  // 所属线程已退出, 环形缓冲区可能还有数据
+
+    thread_block    *next;      // 全局链表中的下一个线程块
+    volatile int32_t state;     // free / alive / dead
+    int32_t          tid;       // 所属线程的 id
+    uint32_t         busy;      // 非 0 表示正在执行回调, 用于防止重入
+    uint32_t         depth;     // 影子栈当前深度
+    uint32_t         slot;      // 在 __thread_index 中的槽位
+    trace_ring      *ring;      // 追踪环形缓冲区, 第一次产生记录时才分配
+    profile_table   *profile;   // 调用上下文树, 第一次经过 A64_PROBE_PROFILE 探针时才分配
+    shadow_frame     frames[A64_SHADOW_DEPTH];
+};
+
+/*
+ * thread_slot: 以线程指针(TPIDR_EL0)为键的线程块索引, tp 为 0 表示空闲
+ *
+ * 不能用 __thread 变量保存当前线程的线程块: 库被 dlopen 时它是 global-dynamic TLS, 线程第一次
+ * 访问时 __tls_get_addr 可能调用 malloc, 被探测的 malloc 会在防止递归的标志生效之前再次进入
+ * __probe_enter。线程指针由 libc 在线程创建时设置, 读取它不经过任何函数调用。
+ *
+ * 槽位只由对应的线程写入, 其他线程只会把空闲槽位改为它们自己的线程指针, 因此每个线程在自己的
+ * 8 个槽位中最多出现一次。tb 为 __thread_acquiring 表示该线程正在分配线程块。
+ */
+struct thread_slot
+{
+    uint64_t      tp;
+    thread_block *tb;
+};
+
+static thread_block *volatile     __thread_blocks = NULL;
+static thread_slot                __thread_index[A64_THREAD_SLOTS];
+static thread_block *const        __thread_acquiring = reinterpret_cast<thread_block *>(1);
+static pthread_key_t              __thread_key;
+static pthread_once_t             __thread_once   = PTHREAD_ONCE_INIT;
+
+/*
+ * trace_session: 当前的调用追踪会话
+ *
+ * base 指向 mmap 映射的输出文件, 只有 drainer 线程(以及停止会话的线程, 在
+ * drainer 退出之后)会写入文件, 因此 pos 等字段不需要同步。
+ */
+struct trace_session
+{
+    volatile int32_t state;   // 0: 空闲, 1: 已占用(启动中/运行中/停止中)
+    volatile int32_t active;  // 非 0 时探针才会产生追踪记录, 2 表示 drainer 正在创建
+    int              fd;      // 输出文件
+    uint8_t         *base;    // 输出文件的映射地址
+    uint64_t         size;    // 映射的字节数, 即记录区的上限
+    uint64_t         pos;     // 下一条记录的写入偏移
+    pthread_t        drainer; // 后台 drainer 线程
+};
+
+static trace_session __trace = { 0, 0, -1, NULL, 0, 0, pthread_t() };
+
+/*
+ * marker_sink: 切片标记的输出目标
+ *
+ * fd 为 trace_marker(或备用文件)的描述符, -1 表示未开启。每个标记用一次 write
+ * 写出, 内核保证单次写入 trace_marker 的内容不会与其他线程交错。
+ */
+struct marker_sink
+{
+    volatile int      fd;       // 输出描述符
+    int               is_file;  // 非 0 表示写入的是备用文件, 需要自行添加时间戳和换行
+    int32_t           pid;      // 进程 id, atrace 格式要求
+    int               retired;  // 停止后保留的描述符(已指向 /dev/null), 下次启动时复用
+    volatile uint32_t session;  // 会话序号, 每次 A64MarkerStart 递增(从 1 开始)
+};
+
+static marker_sink __marker = { -1, 0, 0, -1, 0u };
+
+//-------------------------------------------------------------------------
+
+static inline uint64_t __thread_pointer()
+{
+    uint64_t tp;
+    __asm__("mrs %0, tpidr_el0" : "=r"(tp));
+    return tp;
+}
+
+/*
+ * __thread_slot_find: 在当前线程的 8 个槽位中查找它自己的槽位
+ *
+ * @param claim: 没有找到时是否占用一个空闲槽位
+ * @return:      槽位, 没有找到(或槽位都被占用)时返回 NULL
+ */
+static thread_slot *__thread_slot_find(const uint64_t tp, const bool claim)
+{
+    static constexpr intptr_t window = 8;
+    const intptr_t h = static_cast<intptr_t>((tp >> 4) * 0x9e3779b97f4a7c15ull >> 52) & (A64_THREAD_SLOTS - 1);
+
+    for (intptr_t i = 0; i < window; ++i) {
+        thread_slot *s = &__thread_index[(h + i) & (A64_THREAD_SLOTS - 1)];
+        if (__atomic_load_n(&s->tp, __ATOMIC_RELAXED) == tp) return s;
+    }
+    for (intptr_t i = 0; claim && i < window; ++i) {
+        thread_slot *s = &__thread_index[(h + i) & (A64_THREAD_SLOTS - 1)];
+        uint64_t expected = 0u;
+        if (__atomic_compare_exchange_n(&s->tp, &expected, tp, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            s->tb = NULL;
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * __thread_block_current: 当前线程已经分配的线程块, 没有时返回 NULL
+ */
+static inline thread_block *__thread_block_current()
+{
+    const thread_slot *s = __thread_slot_find(__thread_pointer(), false);
+    return s != NULL && s->tb != __thread_acquiring ? s->tb : NULL;
+}
+
+static void __thread_block_exit(void *p)
+{
+    thread_block *tb = static_cast<thread_block *>(p);
+    thread_slot  *s  = &__thread_index[tb->slot];
+    s->tb = NULL;
+    __atomic_store_n(&s->tp, 0u, __ATOMIC_RELEASE);
+    __store_release(&tb->state, thread_block::dead);
+}
+
+static void __thread_key_init()
+{
+    pthread_key_create(&__thread_key, __thread_block_exit);
+}
+
+/*
+ * __thread_block_acquire: 获取当前线程的线程块, 第一次调用时分配
+ *
+ * 优先复用已退出线程留下的 free 线程块, 否则通过 mmap 分配新的线程块并用
+ * CAS 挂到全局链表头部。分配过程中调用的 mmap/pthread 函数本身也可能被探测,
+ * 槽位中的 __thread_acquiring 用于阻止这种递归。
+ */
+static thread_block *__thread_block_acquire()
+{
+    thread_slot  *s  = __thread_slot_find(__thread_pointer(), true);
+    if (__predict_false(s == NULL)) return NULL;
+    thread_block *tb = s->tb;
+    if (__predict_true(tb != NULL)) return tb != __thread_acquiring ? tb : NULL;
+    s->tb = __thread_acquiring;
+
+    for (tb = __load_acquire(&__thread_blocks); tb != NULL; tb = tb->next) {
+        trace_ring *r = __load_acquire(&tb->ring);
+        if (tb->state == thread_block::dead && (r == NULL || __load_acquire(&r->tail) == r->head)) {
+            __sync_cmpswap(&tb->state, thread_block::dead, thread_block::free);
+        }
+        if (tb->state == thread_block::free && __sync_cmpswap(&tb->state, thread_block::free, thread_block::alive)) {
+            break;
+        }
+    }
+
+    if (tb == NULL) {
+        void *p = ::mmap(NULL, sizeof(thread_block), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            A64_LOGE("failed to allocate thread block, errno = %d", errno);
+            s->tb = NULL;
+            __atomic_store_n(&s->tp, 0u, __ATOMIC_RELEASE);
+            return NULL;
+        }
+        tb = static_cast<thread_block *>(p);
+        tb->state = thread_block::alive;
+        do {
+            tb->next = __thread_blocks;
+        } while (!__sync_cmpswap(&__thread_blocks, tb->next, tb));
+    }
+
+    tb->tid   = static_cast<int32_t>(::syscall(__NR_gettid));
+    tb->busy  = 0u;
+    tb->depth = 0u;
+    tb->slot  = static_cast<uint32_t>(s - __thread_index);
+    pthread_once(&__thread_once, __thread_key_init);
+    pthread_setspecific(__thread_key, tb);
+
+    s->tb = tb;
+    return tb;
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * __trace_emit: 把一次完整的调用写入当前线程的环形缓冲区
+ *
+ * 环形缓冲区在第一次写入时才分配。缓冲区已满时丢弃记录并计数, 绝不阻塞调用者。
+ */
+static void __trace_emit(thread_block *tb, const shadow_frame *f, const uint64_t retval, const uint64_t now)
+{
+    trace_ring *r = tb->ring;
+    if (__predict_false(r == NULL)) {
+        void *p = ::mmap(NULL, sizeof(trace_ring), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return;
+        r = static_cast<trace_ring *>(p);
+        __store_release(&tb->ring, r);
+    }
+
+    const uint64_t h = r->head;
+    if (__predict_false(h - r->tail_cache >= A64_TRACE_RING_RECORDS)) {
+        r->tail_cache = __load_acquire(&r->tail);
+        if (h - r->tail_cache >= A64_TRACE_RING_RECORDS) {
+            __atomic_fetch_add(&r->dropped, 1u, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    A64TraceRecord *rec = &r->recs[h & (A64_TRACE_RING_RECORDS - 1u)];
+    rec->hook_id  = f->hook->id;
+    rec->tid      = static_cast<uint32_t>(tb->tid);
+    rec->enter_ts = f->ts;
+    rec->leave_ts = now;
+    memcpy(rec->args, f->args, sizeof(rec->args));
+    rec->retval   = retval;
+    __store_release(&r->head, h + 1u);
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * __profile_node: 在当前线程的调用上下文树中查找或插入 (parent, hook_id) 节点
+ *
+ * @return: 节点下标, 节点已用完或无法分配时返回 0(不统计)
+ */
+static uint32_t __profile_node(thread_block *tb, const uint32_t parent, const uint32_t hook_id)
+{
+    profile_table *t = tb->profile;
+    if (__predict_false(t == NULL)) {
+        void *p = ::mmap(NULL, sizeof(profile_table), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return 0u;
+        t = static_cast<profile_table *>(p);
+        t->used = 1u;
+        __store_release(&tb->profile, t);
+    }
+
+    static constexpr uint32_t mask = A64_PROFILE_NODES * 2u - 1u;
+    uint32_t i = ((parent * 0x9e3779b1u) ^ (hook_id * 0x85ebca6bu)) & mask;
+    for (;;) {
+        const uint32_t n = t->slots[i];
+        if (n == 0u) break;
+        if (t->nodes[n].parent == parent && t->nodes[n].hook_id == hook_id) return n;
+        i = (i + 1u) & mask;
+    }
+
+    if (t->used >= A64_PROFILE_NODES) return 0u;
+    const uint32_t n = t->used;
+    t->nodes[n].parent  = parent;
+    t->nodes[n].hook_id = hook_id;
+    __store_release(&t->used, n + 1u);
+    __store_release(&t->slots[i], n);
+    return n;
+}
+
+/*
+ * __profile_enter / __profile_leave: 维护影子栈上的调用上下文
+ *
+ * 不带 A64_PROBE_PROFILE 的探针帧继承父帧的节点, 并在返回时把子调用耗时
+ * 原样转交给父帧, 因此火焰图中只出现被剖析的函数, 但耗时的归属保持正确。
+ */
+static inline void __profile_enter(thread_block *tb, shadow_frame *f, const hook_record *hr)
+{
+    const uint32_t parent = tb->depth > 1u ? tb->frames[tb->depth - 2u].node : 0u;
+    f->child = 0u;
+    f->node  = parent;
+    if ((hr->flags & A64_PROBE_PROFILE) != 0u) {
+        const uint32_t n = __profile_node(tb, parent, hr->id);
+        if (n != 0u) f->node = n;
+    }
+}
+
+static inline void __profile_leave(thread_block *tb, const shadow_frame *f, const uint64_t now)
+{
+    const uint64_t incl   = now - f->ts;
+    shadow_frame  *parent = tb->depth > 0u ? &tb->frames[tb->depth - 1u] : NULL;
+    const uint32_t pnode  = parent != NULL ? parent->node : 0u;
+
+    if (f->node != pnode) {
+        profile_node *n = &tb->profile->nodes[f->node];
+        __atomic_store_n(&n->calls, n->calls + 1u, __ATOMIC_RELAXED);
+        __atomic_store_n(&n->incl, n->incl + incl, __ATOMIC_RELAXED);
+        __atomic_store_n(&n->excl, n->excl + (incl > f->child ? incl - f->child : 0u), __ATOMIC_RELAXED);
+        if (parent != NULL) parent->child += incl;
+    } else if (parent != NULL) {
+        parent->child += f->child;
+    }
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * __marker_should_emit: 按采样率和每秒上限决定本次调用是否输出切片
+ *
+ * 限速窗口的切换没有加锁, 多个线程同时跨过秒边界时可能略微超出上限, 但输出
+ * 数量仍然有界。
+ */
+static bool __marker_should_emit(hook_record *hr, const uint64_t now)
+{
+    const uint64_t calls = __atomic_fetch_add(&hr->marker_calls, 1u, __ATOMIC_RELAXED);
+    if (hr->marker_every > 1u && calls % hr->marker_every != 0u) return false;
+
+    const uint64_t freq = __stats->counter_freq;
+    const uint64_t sec  = freq != 0u ? now / freq : 0u;
+    if (__atomic_load_n(&hr->marker_sec, __ATOMIC_RELAXED) != sec) {
+        __atomic_store_n(&hr->marker_used, 0u, __ATOMIC_RELAXED);
+        __atomic_store_n(&hr->marker_sec, sec, __ATOMIC_RELAXED);
+    }
+    return __atomic_fetch_add(&hr->marker_used, 1u, __ATOMIC_RELAXED) < hr->marker_max;
+}
+
+/*
+ * __marker_write: 输出一个切片标记
+ *
+ * 先读取描述符再读取会话序号: A64MarkerStart 在发布新的描述符之前递增序号, 因此读到新会话的
+ * 描述符时一定也能读到新的序号, 旧会话的 "E" 不会写进新会话。
+ *
+ * @param begin:   true 输出 "B|pid|name", false 输出 "E|pid"
+ * @param session: 输出 "E" 时为对应的 "B" 所属的会话序号, 会话已经结束时不输出
+ * @return:        输出 "B" 时返回当前会话序号, 没有输出返回 0
+ */
+static uint32_t __marker_write(const thread_block *tb, const hook_record *hr, const bool begin, const uint64_t now,
+                               const uint32_t session)
+{
+    const int      fd      = __load_acquire(&__marker.fd);
+    const uint32_t current = __load_acquire(&__marker.session);
+    if (fd < 0 || (!begin && current != session)) return 0u;
+
+    char buf[256];
+    int  n = 0;
+    if (__marker.is_file) {
+        n = snprintf(buf, sizeof(buf), "%" PRIu64 " %d ", now, tb->tid);
+    }
+    if (begin) {
+        n += hr->name != NULL ? snprintf(buf + n, sizeof(buf) - n, "B|%d|%s", __marker.pid, hr->name)
+                              : snprintf(buf + n, sizeof(buf) - n, "B|%d|hook#%u", __marker.pid, hr->id);
+    } else {
+        n += snprintf(buf + n, sizeof(buf) - n, "E|%d", __marker.pid);
+    }
+    if (n >= static_cast<int>(sizeof(buf)) - 1) n = static_cast<int>(sizeof(buf)) - 2;
+    if (__marker.is_file) buf[n++] = '\n';
+
+    if (write(fd, buf, static_cast<size_t>(n)) < 0) {
+        // trace_marker 在追踪关闭时可能返回 EBADF/EINVAL, 丢弃即可
+    }
+    return current;
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * __probe_enter: 桩代码入口回调
+ *
+ * @param hr:   探针描述信息
+ * @param regs: 桩代码保存在栈上的 X0-X8 和 X30(LR), regs[9] 即真实返回地址
+ * @return:     非 0 表示已压入影子栈, 桩代码需要把 LR 改写为出口地址;
+ *              返回 0 则桩代码直接跳转到跳板, 不再拦截函数返回
+ */
+static uint64_t __probe_enter(hook_record *hr, uint64_t *regs)
+{
+    thread_block *tb = __thread_block_acquire();
+    if (__predict_false(tb == NULL || tb->busy != 0u || tb->depth >= A64_SHADOW_DEPTH)) {
+        return 0u;
+    }
+
+    shadow_frame *f = &tb->frames[tb->depth++];
+    f->lr     = regs[9];
+    f->sp     = reinterpret_cast<uint64_t>(regs) + __probe_enter_frame;
+    f->hook   = hr;
+    f->ts     = __read_cntvct();
+    f->marked = 0u;
+    memcpy(f->args, regs, sizeof(f->args));
+    __profile_enter(tb, f, hr);
+
+    if ((hr->flags & A64_PROBE_MARKER) != 0u && __marker.fd >= 0 && __marker_should_emit(hr, f->ts)) {
+        ++tb->busy;
+        f->marked = __marker_write(tb, hr, true, f->ts, 0u);
+        --tb->busy;
+    }
+    return 1u;
+}
+
+/*
+ * __probe_leave: 桩代码出口回调
+ *
+ * 出口桩代码由所有探针共用, 探针描述信息从影子栈中取得。
+ *
+ * longjmp/siglongjmp 跳出被探测的函数时, 被跳过的帧留在影子栈上。栈向低地址增长,
+ * 这些帧的 SP 一定低于当前返回的函数的 SP, 出栈前先把它们丢弃(已输出的 "B" 标记
+ * 补上配对的 "E"), 否则会跳到被跳过的帧记录的返回地址。尾调用另一个被探测的函数时
+ * 两帧的 SP 相同, 不会被误丢弃。
+ *
+ * @param regs: 桩代码保存在栈上的 X0-X1(返回值)
+ * @return:     真实返回地址, 桩代码把它写回 LR 后返回调用者
+ */
+static uint64_t __probe_leave(uint64_t *regs)
+{
+    const uint64_t now = __read_cntvct();
+    const uint64_t sp  = reinterpret_cast<uint64_t>(regs) + __probe_leave_frame;
+    thread_block  *tb  = __thread_block_current();
+    while (__predict_true(tb != NULL) && tb->depth > 0u && tb->frames[tb->depth - 1u].sp < sp) {
+        const shadow_frame *f = &tb->frames[--tb->depth];
+        if (f->marked != 0u) {
+            ++tb->busy;
+            __marker_write(tb, f->hook, false, now, f->marked);
+            --tb->busy;
+        }
+    }
+    if (__predict_false(tb == NULL || tb->depth == 0u)) {
+        // 影子栈中没有属于当前返回的帧, 已经无法得知返回地址
+        A64_LOGE("shadow stack underflow!");
+        abort();
+    }
+
+    const shadow_frame *f  = &tb->frames[--tb->depth];
+    hook_record        *hr = f->hook;
+    __stats_record_call(hr->stats, now - f->ts);
+    __profile_leave(tb, f, now);
+    ++tb->busy;
+    if ((hr->flags & A64_PROBE_TRACE) != 0u && __load_acquire(&__trace.active) != 0) {
+        __trace_emit(tb, f, regs[0], now);
+    }
+    if (f->marked != 0u) {
+        __marker_write(tb, hr, false, now, f->marked);
+    }
+    --tb->busy;
+    return f->lr;
+}
+
+//-------------------------------------------------------------------------
+
+//-------------------------------------------------------------------------
+// 共享桩代码区域(stub_arena)
+//-------------------------------------------------------------------------
+
+/*
+ * 探针、通用处理函数和系统调用位置的桩代码与具体的 Hook 无关, 每块区域只放一份; 每个 Hook 只分配
+ * 一个小的数据块, 入口跳到数据块开头的两条指令:
+ *   ADR X17, #0       ; X17 = 数据块自身的地址
+ *   B   stub          ; 跳到所在区域的共享桩代码
+ * 共享桩代码按固定偏移从 X17 读取该 Hook 的数据, 因此数据块的布局不能改变。
+ * 探针的标志(A64_PROBE_*)只在回调中检查, 所有标志组合共用同一份桩代码。
+ */
+
+/*
+ * probe_site: 一个探针的数据块, 跳板紧接在其后
+ */
+struct probe_site
+{
+    uint32_t     code[2];
+    hook_record *hook;        // [x17, #8]
+    uint64_t     trampoline;  // [x17, #16]
+};
+
+/*
+ * universal_site: 一个通用处理函数 Hook 的数据块, 跳板紧接在其后
+ */
+struct universal_site
+{
+    uint32_t code[2];
+    uint32_t id;          // [x17, #8]
+    uint32_t reserved;
+    uint64_t trampoline;  // [x17, #16]
+    uint64_t handler;     // [x17, #24]
+};
+
+/*
+ * syscall_site: 一个 SVC #0 位置的数据块, SVC 被改写为 "B code", 见 A64SyscallHook
+ *
+ * SVC 前后的寄存器都可能是活跃的, 没有可用的临时寄存器, 因此 code 先把 X16/X17 压栈:
+ *   [0] STP X16, X17, [SP, #-16]!
+ *   [1] ADR X17, code          ; X17 = 数据块自身的地址
+ *   [2] B   stub
+ *   [3] LDP X16, X17, [SP], #16 ; 桩代码已代为执行系统调用, X0 是结果
+ *   [4] B   pc + 4
+ *   [5] LDP X16, X17, [SP], #16 ; 在原位执行系统调用(clone 等), 见 __syscall_inplace
+ *   [6] SVC #0
+ *   [7] B   pc + 4
+ */
+struct syscall_site
+{
+    uint32_t          code[8];
+    uint64_t          pc;    // SVC 指令的地址
+    A64SyscallHandler pre;
+    A64SyscallHandler post;
+};
+
+static_assert(sizeof(probe_site) == 24 && sizeof(universal_site) == 32 && sizeof(syscall_site) == 56,
+              "site layout is used by the shared stubs");
+
+static uint64_t __syscall_dispatch(syscall_site *site, A64SyscallRegs *regs);
+
+/*
+ * stub_arena: 一块 RWX 区域, 尽量映射在目标函数附近
+ *
+ * 布局: 共享桩代码(即区域的起始地址) | 头部 | 按 8 字节对齐顺序分配的数据块和跳板。
+ * 区域在目标函数 +/-128MB 以内时入口只需一条 B 指令, 跳板通常只有 8 字节(被覆盖的指令和跳回的 B)。
+ */
+#define __universal_stub_words 28
+#define __probe_stub_words     48
+#define __syscall_stub_words   60
+#define __stub_arena_size      (512u * 1024u)
+
+struct stub_arena
+{
+    uint32_t    universal[__universal_stub_words];
+    uint32_t    probe[__probe_stub_words];
+    uint32_t    syscall[__syscall_stub_words];
+    stub_arena *next;
+    uint32_t    used;   // 头部之后已分配的字节数
+    uint32_t    sites;  // 已安装的 Hook 数量
+
+    inline uint8_t *data() {
+        return reinterpret_cast<uint8_t *>(this + 1);
+    }
+};
+
+static constexpr uint32_t __stub_arena_room = __stub_arena_size - sizeof(stub_arena);
+
+static_assert(sizeof(stub_arena) % 8 == 0 && ((__universal_stub_words + __probe_stub_words) % 2) == 0, "8-byte align");
+
+/*
+ * __universal_stub_template: 通用处理函数的共享桩代码
+ *
+ * 进入时 X17 是 universal_site 的地址, 参数寄存器和 LR 都保持调用者设置的值。保存
+ * X0-X8, LR 和 Q0-Q7(即 A64UniversalRegs)以及 X17, 以 (id, regs) 调用 site->handler,
+ * 恢复全部寄存器(处理函数可以修改它们)后跳到 site->trampoline 继续执行目标函数。
+ * 栈指针保持 16 字节对齐, 目标函数看到的 SP 与直接调用时相同。
+ */
+static const uint32_t __universal_stub_template[__universal_stub_words] = {
+    0xd10383ffu, // sub  sp, sp, #0xe0
+    0xa90007e0u, // stp  x0, x1, [sp]
+    0xa9010fe2u, // stp  x2, x3, [sp, #0x10]
+    0xa90217e4u, // stp  x4, x5, [sp, #0x20]
+    0xa9031fe6u, // stp  x6, x7, [sp, #0x30]
+    0xa9047be8u, // stp  x8, x30, [sp, #0x40]
+    0xad0287e0u, // stp  q0, q1, [sp, #0x50]
+    0xad038fe2u, // stp  q2, q3, [sp, #0x70]
+    0xad0497e4u, // stp  q4, q5, [sp, #0x90]
+    0xad059fe6u, // stp  q6, q7, [sp, #0xb0]
+    0xf9006bf1u, // str  x17, [sp, #0xd0]
+    0xb9400a20u, // ldr  w0, [x17, #8]     ; id
+    0x910003e1u, // mov  x1, sp
+    0xf9400e30u, // ldr  x16, [x17, #24]   ; handler
+    0xd63f0200u, // blr  x16
+    0xf9406bf1u, // ldr  x17, [sp, #0xd0]
+    0xad459fe6u, // ldp  q6, q7, [sp, #0xb0]
+    0xad4497e4u, // ldp  q4, q5, [sp, #0x90]
+    0xad438fe2u, // ldp  q2, q3, [sp, #0x70]
+    0xad4287e0u, // ldp  q0, q1, [sp, #0x50]
+    0xa9447be8u, // ldp  x8, x30, [sp, #0x40]
+    0xa9431fe6u, // ldp  x6, x7, [sp, #0x30]
+    0xa94217e4u, // ldp  x4, x5, [sp, #0x20]
+    0xa9410fe2u, // ldp  x2, x3, [sp, #0x10]
+    0xa94007e0u, // ldp  x0, x1, [sp]
+    0x910383ffu, // add  sp, sp, #0xe0
+    0xf9400a31u, // ldr  x17, [x17, #16]   ; trampoline
+    0xd61f0220u, // br   x17
+};
+
+/*
+ * __probe_stub_template: 探针的共享桩代码
+ *
+ * 进入时 X17 是 probe_site 的地址, 参数寄存器和 LR 都保持调用者设置的值。X16/X17(IP0/IP1)
+ * 在函数入口处本就允许被破坏, 桩代码用它们作为临时寄存器。
+ *
+ * 入口部分:
+ *   保存 X0-X8, LR, Q0-Q7(浮点/向量参数)和 X17, 以 (site->hook, regs) 调用
+ *   __probe_enter, 恢复全部寄存器; 若回调返回非 0, 把 LR 改写为出口地址,
+ *   最后跳转到 site->trampoline 执行原函数。
+ *
+ * 出口部分(原函数返回到这里):
+ *   保存返回值 X0-X1 和 Q0-Q3(HFA 返回值), 调用 __probe_leave 从影子栈取回真实
+ *   返回地址并写入 LR, 恢复返回值后 RET。出口不需要知道是哪个探针, 影子栈中记录着。
+ *
+ * 栈指针在整个过程中保持 16 字节对齐, 原函数看到的 SP 与直接调用时完全相同,
+ * 因此通过栈传递的参数不受影响。
+ */
+static constexpr intptr_t __probe_stub_enter = 44;  // 字面量: __probe_enter
+static constexpr intptr_t __probe_stub_leave = 46;  // 字面量: __probe_leave
+
+static const uint32_t __probe_stub_template[__probe_stub_words] = {
+    // 入口
+    0xd10383ffu, // sub  sp, sp, #0xe0
+    0xa90007e0u, // stp  x0, x1, [sp]
+    0xa9010fe2u, // stp  x2, x3, [sp, #0x10]
+    0xa90217e4u, // stp  x4, x5, [sp, #0x20]
+    0xa9031fe6u, // stp  x6, x7, [sp, #0x30]
+    0xa9047be8u, // stp  x8, x30, [sp, #0x40]
+    0xad0287e0u, // stp  q0, q1, [sp, #0x50]
+    0xad038fe2u, // stp  q2, q3, [sp, #0x70]
+    0xad0497e4u, // stp  q4, q5, [sp, #0x90]
+    0xad059fe6u, // stp  q6, q7, [sp, #0xb0]
+    0xf9006bf1u, // str  x17, [sp, #0xd0]
+    0xf9400620u, // ldr  x0, [x17, #8]     ; hook
+    0x910003e1u, // mov  x1, sp
+    0x580003f0u, // ldr  x16, enter
+    0xd63f0200u, // blr  x16
+    0xaa0003f0u, // mov  x16, x0
+    0xf9406bf1u, // ldr  x17, [sp, #0xd0]
+    0xad459fe6u, // ldp  q6, q7, [sp, #0xb0]
+    0xad4497e4u, // ldp  q4, q5, [sp, #0x90]
+    0xad438fe2u, // ldp  q2, q3, [sp, #0x70]
+    0xad4287e0u, // ldp  q0, q1, [sp, #0x50]
+    0xa9447be8u, // ldp  x8, x30, [sp, #0x40]
+    0xa9431fe6u, // ldp  x6, x7, [sp, #0x30]
+    0xa94217e4u, // ldp  x4, x5, [sp, #0x20]
+    0xa9410fe2u, // ldp  x2, x3, [sp, #0x10]
+    0xa94007e0u, // ldp  x0, x1, [sp]
+    0x910383ffu, // add  sp, sp, #0xe0
+    0xb4000050u, // cbz  x16, #0x8
+    0x1000007eu, // adr  x30, exit
+    0xf9400a31u, // ldr  x17, [x17, #16]   ; trampoline
+    0xd61f0220u, // br   x17
+    // 出口
+    0xd10183ffu, // sub  sp, sp, #0x60
+    0xa90007e0u, // stp  x0, x1, [sp]
+    0xad0087e0u, // stp  q0, q1, [sp, #0x10]
+    0xad018fe2u, // stp  q2, q3, [sp, #0x30]
+    0x910003e0u, // mov  x0, sp
+    0x58000150u, // ldr  x16, leave
+    0xd63f0200u, // blr  x16
+    0xaa0003feu, // mov  x30, x0
+    0xad418fe2u, // ldp  q2, q3, [sp, #0x30]
+    0xad4087e0u, // ldp  q0, q1, [sp, #0x10]
+    0xa94007e0u, // ldp  x0, x1, [sp]
+    0x910183ffu, // add  sp, sp, #0x60
+    0xd65f03c0u, // ret
+    // 字面量
+    0u, 0u,      // enter
+    0u, 0u,      // leave
+};
+
+/*
+ * __syscall_stub_template: SVC #0 位置的共享桩代码
+ *
+ * 进入时 X17 是 syscall_site 的地址, 原来的 X16/X17 已由 code 压栈。保存全部调用者保存的
+ * 寄存器(X0-X15, X18, LR, Q0-Q7, Q16-Q31)和 NZCV, 以 (site, regs) 调用 __syscall_dispatch,
+ * 恢复全部寄存器(X0 可能已被改为系统调用的结果)后, 按返回值跳回 code[3] 或 code[5]。
+ * ADD 和 CBZ 都不影响 NZCV。
+ */
+static constexpr intptr_t __syscall_stub_dispatch = 58;  // 字面量: __syscall_dispatch
+
+static const uint32_t __syscall_stub_template[__syscall_stub_words] = {
+    0xd10883ffu, // sub  sp, sp, #0x220
+    0xa90007e0u, // stp  x0, x1, [sp]
+    0xa9010fe2u, // stp  x2, x3, [sp, #0x10]
+    0xa90217e4u, // stp  x4, x5, [sp, #0x20]
+    0xa9031fe6u, // stp  x6, x7, [sp, #0x30]
+    0xa90427e8u, // stp  x8, x9, [sp, #0x40]
+    0xa9052feau, // stp  x10, x11, [sp, #0x50]
+    0xa90637ecu, // stp  x12, x13, [sp, #0x60]
+    0xa9073feeu, // stp  x14, x15, [sp, #0x70]
+    0xa9087bf2u, // stp  x18, x30, [sp, #0x80]
+    0xd53b4210u, // mrs  x16, nzcv
+    0xa90947f0u, // stp  x16, x17, [sp, #0x90]
+    0xad0507e0u, // stp  q0, q1, [sp, #0xa0]
+    0xad060fe2u, // stp  q2, q3, [sp, #0xc0]
+    0xad0717e4u, // stp  q4, q5, [sp, #0xe0]
+    0xad081fe6u, // stp  q6, q7, [sp, #0x100]
+    0xad0947f0u, // stp  q16, q17, [sp, #0x120]
+    0xad0a4ff2u, // stp  q18, q19, [sp, #0x140]
+    0xad0b57f4u, // stp  q20, q21, [sp, #0x160]
+    0xad0c5ff6u, // stp  q22, q23, [sp, #0x180]
+    0xad0d67f8u, // stp  q24, q25, [sp, #0x1a0]
+    0xad0e6ffau, // stp  q26, q27, [sp, #0x1c0]
+    0xad0f77fcu, // stp  q28, q29, [sp, #0x1e0]
+    0xad107ffeu, // stp  q30, q31, [sp, #0x200]
+    0xaa1103e0u, // mov  x0, x17
+    0x910003e1u, // mov  x1, sp
+    0x58000410u, // ldr  x16, dispatch
+    0xd63f0200u, // blr  x16
+    0xaa0003f0u, // mov  x16, x0
+    0xad507ffeu, // ldp  q30, q31, [sp, #0x200]
+    0xad4f77fcu, // ldp  q28, q29, [sp, #0x1e0]
+    0xad4e6ffau, // ldp  q26, q27, [sp, #0x1c0]
+    0xad4d67f8u, // ldp  q24, q25, [sp, #0x1a0]
+    0xad4c5ff6u, // ldp  q22, q23, [sp, #0x180]
+    0xad4b57f4u, // ldp  q20, q21, [sp, #0x160]
+    0xad4a4ff2u, // ldp  q18, q19, [sp, #0x140]
+    0xad4947f0u, // ldp  q16, q17, [sp, #0x120]
+    0xad481fe6u, // ldp  q6, q7, [sp, #0x100]
+    0xad4717e4u, // ldp  q4, q5, [sp, #0xe0]
+    0xad460fe2u, // ldp  q2, q3, [sp, #0xc0]
+    0xad4507e0u, // ldp  q0, q1, [sp, #0xa0]
+    0xf9404bf1u, // ldr  x17, [sp, #0x90]
+    0xd51b4211u, // msr  nzcv, x17
+    0xf9404ff1u, // ldr  x17, [sp, #0x98]
+    0xa9487bf2u, // ldp  x18, x30, [sp, #0x80]
+    0xa9473feeu, // ldp  x14, x15, [sp, #0x70]
+    0xa94637ecu, // ldp  x12, x13, [sp, #0x60]
+    0xa9452feau, // ldp  x10, x11, [sp, #0x50]
+    0xa94427e8u, // ldp  x8, x9, [sp, #0x40]
+    0xa9431fe6u, // ldp  x6, x7, [sp, #0x30]
+    0xa94217e4u, // ldp  x4, x5, [sp, #0x20]
+    0xa9410fe2u, // ldp  x2, x3, [sp, #0x10]
+    0xa94007e0u, // ldp  x0, x1, [sp]
+    0x910883ffu, // add  sp, sp, #0x220
+    0x91003231u, // add  x17, x17, #12     ; code[3]
+    0xb4000050u, // cbz  x16, #0x8
+    0x91002231u, // add  x17, x17, #8      ; code[5]
+    0xd61f0220u, // br   x17
+    // 字面量
+    0u, 0u,      // dispatch
+};
+
+static stub_arena *volatile __stub_arenas     = NULL;
+static pthread_mutex_t      __stub_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * __stub_arena_near: 找到一块剩余空间不少于 bytes 且在 symbol 跳转范围内的区域, 没有则新映射一块
+ *
+ * anywhere 为 true 时附近找不到也映射不到就使用任意区域, 入口改为远跳转。
+ * 调用者持有 __stub_arena_lock。
+ */
+static stub_arena *__stub_arena_near(const void *symbol, const uint32_t bytes, const bool anywhere)
+{
+    for (stub_arena *a = __stub_arenas; a != NULL; a = a->next) {
+        if (__stub_arena_room - a->used >= bytes && __branch_reachable(a, __stub_arena_size, symbol)) return a;
+    }
+
+    stub_arena *a = static_cast<stub_arena *>(__map_near(symbol, __stub_arena_size));
+    if (a == NULL && anywhere) {
+        for (a = __stub_arenas; a != NULL; a = a->next) {
+            if (__stub_arena_room - a->used >= bytes) return a;
+        }
+        void *p = mmap(NULL, __stub_arena_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        a = p != MAP_FAILED ? static_cast<stub_arena *>(p) : NULL;
+    }
+    if (a == NULL) {
+        A64_LOGE("failed to map stub arena near %p!", symbol);
+        return NULL;
+    }
+    memcpy(a->universal, __universal_stub_template, sizeof(__universal_stub_template));
+    memcpy(a->probe, __probe_stub_template, sizeof(__probe_stub_template));
+    *reinterpret_cast<void **>(a->probe + __probe_stub_enter) = reinterpret_cast<void *>(__probe_enter);
+    *reinterpret_cast<void **>(a->probe + __probe_stub_leave) = reinterpret_cast<void *>(__probe_leave);
+    memcpy(a->syscall, __syscall_stub_template, sizeof(__syscall_stub_template));
+    *reinterpret_cast<void **>(a->syscall + __syscall_stub_dispatch) = reinterpret_cast<void *>(__syscall_dispatch);
+    __flush_cache(a, sizeof(a->universal) + sizeof(a->probe) + sizeof(a->syscall));
+    a->next = __stub_arenas;
+    __store_release(&__stub_arenas, a);
+    return a;
+}
+
+/*
+ * __stub_site: 在区域中写好数据块开头的 ADR X17, #0; B stub
+ */
+static inline void __stub_site(uint32_t *code, const uint32_t *stub)
+{
+    code[0] = 0x10000011u;  // ADR X17, #0
+    code[1] = 0x14000000u | (static_cast<uint32_t>((__intval(stub) - __intval(code + 1)) >> 2) & 0x03ffffffu);  // B stub
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * A64ProbeFunction: 在目标函数上安装入口/出口探针
+ *
+ * 安装顺序很重要: 先在共享桩代码区域中填好 probe_site, 再由 __hook_function 在它之后生成
+ * 跳板并改写目标函数入口, 这样任何线程一旦执行到新入口, 看到的都是完整的数据块和跳板。
+ * 每个探针占用 24 字节的数据块和实际大小的跳板, 桩代码由同一区域的所有探针共用。
+ */
+A64_JNIEXPORT int A64ProbeFunction(void *const symbol, const char *name, uint32_t flags, void **result)
+{
+    A64InstallStats st = {};
+    const uint64_t  t0 = __read_cntvct();
+    A64HookStatsEntry *entry = __registry_alloc(A64_HOOK_PROBE | flags, name);
+    if (entry == NULL) return __install_commit(&st, false), -1;
+
+    static constexpr uint32_t bound = sizeof(probe_site) + __trampoline_bound(A64_MAX_INSTRUCTIONS);
+
+    pthread_mutex_lock(&__stub_arena_lock);
+    // 探针槽位在 __stub_arena_lock 下分配, 安装成功后才计入 __probe_count, 失败时留给下一个探针
+    const int32_t slot = __probe_count;
+    if (slot >= __countof(__probe_records)) {
+        pthread_mutex_unlock(&__stub_arena_lock);
+        A64_LOGE("failed to allocate probe!");
+        __registry_release(entry);
+        return __install_commit(&st, false), -1;
+    }
+    stub_arena *arena = __stub_arena_near(symbol, bound, true);
+    if (arena == NULL) {
+        pthread_mutex_unlock(&__stub_arena_lock);
+        __registry_release(entry);
+        return __install_commit(&st, false), -1;
+    }
+    probe_site *site       = reinterpret_cast<probe_site *>(arena->data() + arena->used);
+    uint32_t   *trampoline = reinterpret_cast<uint32_t *>(site + 1);
+
+    hook_record *hr = &__probe_records[slot];
+    hr->id         = entry->id;
+    hr->flags      = flags;
+    hr->trampoline = trampoline;
+    hr->name       = name;
+    hr->stats      = entry;
+    hr->marker_every = 1u;
+    hr->marker_max   = A64_MARKER_MAX_PER_SEC;
+
+    __stub_site(site->code, arena->probe);
+    site->hook       = hr;
+    site->trampoline = __uintval(trampoline);
+    __flush_cache(site, sizeof(*site));
+    st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+
+    __make_rwx_timed(symbol, 5 * sizeof(size_t), &st);
+    const bool installed = __hook_function(symbol, site, trampoline, __trampoline_bound(A64_MAX_INSTRUCTIONS), entry, &st) != NULL;
+    if (installed) {
+        arena->used += static_cast<uint32_t>(__align_up(sizeof(*site) + st.trampoline_bytes, 8u));
+        __store_release(&arena->sites, arena->sites + 1u);
+        __store_release(&__probe_count, slot + 1);
+    }
+    pthread_mutex_unlock(&__stub_arena_lock);
+    if (!installed) return __registry_release(entry), -1;
+
+    __store_release(&hr->symbol, symbol);
+    if (result != NULL) *result = trampoline;
+    return static_cast<int>(hr->id);
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * __trace_drain_all: 把所有线程环形缓冲区中的记录批量写入输出文件
+ *
+ * 每个环形缓冲区最多分两段(环尾和环首)用 memcpy 整段复制, 然后一次性推进 tail。
+ * 文件写满后继续推进 tail, 并把无法写入的记录计入 lost_count。
+ */
+static void __trace_drain_all()
+{
+    A64TraceFileHeader *hdr = reinterpret_cast<A64TraceFileHeader *>(__trace.base);
+
+    for (thread_block *tb = __load_acquire(&__thread_blocks); tb != NULL; tb = tb->next) {
+        trace_ring *r = __load_acquire(&tb->ring);
+        if (r == NULL) continue;
+
+        uint64_t       t = r->tail;
+        const uint64_t h = __load_acquire(&r->head);
+        while (t != h) {
+            const uint64_t off  = t & (A64_TRACE_RING_RECORDS - 1u);
+            uint64_t       n    = h - t;
+            if (n > A64_TRACE_RING_RECORDS - off) n = A64_TRACE_RING_RECORDS - off;
+
+            const uint64_t room = (__trace.size - __trace.pos) / sizeof(A64TraceRecord);
+            const uint64_t w    = n < room ? n : room;
+            memcpy(__trace.base + __trace.pos, &r->recs[off], w * sizeof(A64TraceRecord));
+            __trace.pos       += w * sizeof(A64TraceRecord);
+            hdr->record_count += w;
+            hdr->lost_count   += n - w;
+            t += n;
+        }
+        __store_release(&r->tail, t);
+        hdr->lost_count += __atomic_exchange_n(&r->dropped, 0u, __ATOMIC_RELAXED);
+
+        if (tb->state == thread_block::dead) {
+            __sync_cmpswap(&tb->state, thread_block::dead, thread_block::free);
+        }
+    }
+}
+
+/*
+ * __trace_drainer: drainer 线程主循环
+ *
+ * drainer 自身的线程块被标记为 busy, 因此它调用到的被探测函数不会产生记录。
+ */
+static void *__trace_drainer(void *)
+{
+    thread_block *tb = __thread_block_acquire();
+    if (tb != NULL) ++tb->busy;
+
+    const timespec interval = { 0, A64_TRACE_DRAIN_MS * 1000000L };
+    while (__load_acquire(&__trace.active) != 0) {
+        __trace_drain_all();
+        nanosleep(&interval, NULL);
+    }
+
+    if (tb != NULL) --tb->busy;
+    return NULL;
+}
+
+/*
+ * __trace_close: 释放追踪会话占用的资源, 并把文件截断为 length 字节
+ */
+static void __trace_close(const uint64_t length)
+{
+    if (__trace.base != NULL) {
+        ::munmap(__trace.base, __trace.size);
+        __trace.base = NULL;
+    }
+    if (__trace.fd >= 0) {
+        if (ftruncate(__trace.fd, static_cast<off_t>(length)) != 0) {
+            A64_LOGE("ftruncate failed with errno = %d", errno);
+        }
+        close(__trace.fd);
+        __trace.fd = -1;
+    }
+    __store_release(&__trace.state, 0);
+}
+
+//-------------------------------------------------------------------------
+
+A64_JNIEXPORT int A64TraceStart(const char *path, uint64_t max_bytes)
+{
+    if (!__sync_cmpswap(&__trace.state, 0, 1)) {
+        A64_LOGE("trace session is already running!");
+        errno = EBUSY;
+        return -1;
+    }
+    if (max_bytes < sizeof(A64TraceFileHeader) + sizeof(A64TraceRecord)) {
+        __store_release(&__trace.state, 0);
+        errno = EINVAL;
+        return -1;
+    }
+
+    __trace.fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (__trace.fd < 0 || ftruncate(__trace.fd, static_cast<off_t>(max_bytes)) != 0) {
+        A64_LOGE("failed to create trace file %s, errno = %d", path, errno);
+        return __trace_close(0u), -1;
+    }
+
+    void *p = ::mmap(NULL, max_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, __trace.fd, 0);
+    if (p == MAP_FAILED) {
+        A64_LOGE("failed to map trace file %s, errno = %d", path, errno);
+        return __trace_close(0u), -1;
+    }
+    __trace.base = static_cast<uint8_t *>(p);
+    __trace.size = max_bytes;
+    __trace.pos  = sizeof(A64TraceFileHeader);
+
+    A64TraceFileHeader *hdr = static_cast<A64TraceFileHeader *>(p);
+    memcpy(hdr->magic, A64_TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version      = A64_TRACE_VERSION;
+    hdr->header_size  = sizeof(A64TraceFileHeader);
+    hdr->record_size  = sizeof(A64TraceRecord);
+    hdr->counter_freq = __read_cntfrq();
+
+    // drainer 创建完成之前 active 为 2, A64TraceStop 此时不会去 join 它
+    __store_release(&__trace.active, 2);
+    const int err = pthread_create(&__trace.drainer, NULL, __trace_drainer, NULL);
+    if (err != 0) {
+        __store_release(&__trace.active, 0);
+        A64_LOGE("failed to create drainer thread, error = %d", err);
+        errno = err;
+        return __trace_close(0u), -1;
+    }
+    __store_release(&__trace.active, 1);
+    return 0;
+}
+
+//-------------------------------------------------------------------------
+
+A64_JNIEXPORT void A64TraceStop(void)
+{
+    // 只有把 active 从 1 改为 0 的调用者才能 join drainer 并写出名称表
+    if (!__sync_cmpswap(&__trace.active, 1, 0)) return;
+
+    pthread_join(__trace.drainer, NULL);
+    __trace_drain_all();
+
+    // 名称表追加在最后一条记录之后, 不占用记录区的容量
+    A64TraceFileHeader *hdr = reinterpret_cast<A64TraceFileHeader *>(__trace.base);
+    hdr->names_offset = __trace.pos;
+
+    char    line[512];
+    off_t   offset = static_cast<off_t>(__trace.pos);
+    int32_t count  = __load_acquire(&__probe_count);
+    if (count > __countof(__probe_records)) count = __countof(__probe_records);
+    for (int32_t i = 0; i < count; ++i) {
+        const hook_record *hr = &__probe_records[i];
+        void *symbol = __load_acquire(&hr->symbol);
+        if (symbol == NULL) continue;
+
+        const int n = snprintf(line, sizeof(line), "%u\t%p\t%s\n", hr->id, symbol, hr->name != NULL ? hr->name : "");
+        if (n <= 0) continue;
+        const size_t len = static_cast<size_t>(n) < sizeof(line) ? static_cast<size_t>(n) : sizeof(line) - 1u;
+        if (pwrite(__trace.fd, line, len, offset) == static_cast<ssize_t>(len)) {
+            offset += static_cast<off_t>(len);
+        }
+    }
+    hdr->names_size = static_cast<uint64_t>(offset) - hdr->names_offset;
+
+    const uint64_t length = static_cast<uint64_t>(offset);
+    msync(__trace.base, __trace.size, MS_SYNC);
+    __trace_close(length);
+}
+
+//-------------------------------------------------------------------------
+
+A64_JNIEXPORT int A64MarkerStart(const char *fallback_path)
+{
+    static const char *const paths[] = {
+        "/sys/kernel/tracing/trace_marker",
+        "/sys/kernel/debug/tracing/trace_marker",
+    };
+
+    if (__marker.fd >= 0) return __marker.is_file;
+
+    int fd = -1, is_file = 0;
+    for (intptr_t i = 0; i < __countof(paths) && fd < 0; ++i) {
+        fd = open(paths[i], O_WRONLY | O_CLOEXEC);
+    }
+    if (fd < 0 && fallback_path != NULL) {
+        fd      = open(fallback_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        is_file = 1;
+    }
+    if (fd < 0) {
+        A64_LOGE("failed to open trace_marker, errno = %d", errno);
+        return -1;
+    }
+
+    if (__marker.retired >= 0 && dup2(fd, __marker.retired) >= 0) {
+        close(fd);
+        fd = __marker.retired;
+        __marker.retired = -1;
+    }
+
+    __marker.is_file = is_file;
+    __marker.pid     = static_cast<int32_t>(getpid());
+    __store_release(&__marker.session, __marker.session + 1u != 0u ? __marker.session + 1u : 1u);
+    __store_release(&__marker.fd, fd);
+    return is_file;
+}
+
+/*
+ * 其他线程可能刚刚读取了旧的描述符、正准备写入, 因此这里不能直接 close(否则
+ * 描述符号被复用后标记会写进无关的文件), 而是用 dup2 把它原子地指向 /dev/null
+ * 并保留下来, 供下一次 A64MarkerStart 复用。
+ */
+A64_JNIEXPORT void A64MarkerStop(void)
+{
+    const int fd = __atomic_exchange_n(&__marker.fd, -1, __ATOMIC_ACQ_REL);
+    if (fd < 0) return;
+
+    const int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd >= 0) {
+        dup2(null_fd, fd);
+        close(null_fd);
+    }
+    __marker.retired = fd;
+}
+
+A64_JNIEXPORT int A64ProbeSetMarkerLimit(int hook_id, uint32_t sample_every, uint32_t max_per_second)
+{
+    int32_t count = __load_acquire(&__probe_count);
+    if (count > __countof(__probe_records)) count = __countof(__probe_records);
+    for (int32_t i = 0; i < count; ++i) {
+        hook_record *hr = &__probe_records[i];
+        if (__load_acquire(&hr->symbol) != NULL && hr->id == static_cast<uint32_t>(hook_id)) {
+            hr->marker_every = sample_every != 0u ? sample_every : 1u;
+            hr->marker_max   = max_per_second;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * profile_agg: A64ProfileDump 合并各线程调用栈时使用的临时哈希表项
+ *
+ * 不同线程中同一条调用栈(由根到叶的 hook id 序列相同)会得到相同的 64 位哈希,
+ * 合并后只保留一个代表节点用于输出调用栈的名称。
+ */
+struct profile_agg
+{
+    uint64_t             hash;   // 调用栈哈希, 0 表示空槽位
+    const profile_table *table;  // 代表节点所在的线程表
+    uint32_t             node;   // 代表节点
+    uint64_t             value;  // 合并后的数值
+};
+
+static inline uint64_t __profile_hash(uint64_t h, const uint32_t hook_id)
+{
+    h = (h ^ hook_id) * 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h != 0u ? h : 1u;
+}
+
+/*
+ * fd_writer: 带缓冲的描述符输出, 避免每个调用栈一次 write
+ */
+struct fd_writer
+{
+    int    fd;
+    size_t len;
+    bool   failed;
+    char   buf[4096];
+
+    void flush() {
+        size_t off = 0u;
+        while (off < this->len && !this->failed) {
+            const ssize_t n = write(this->fd, this->buf + off, this->len - off);
+            if (n > 0) {
+                off += static_cast<size_t>(n);
+            } else if (n < 0 && errno != EINTR) {
+                this->failed = true;
+            }
+        }
+        this->len = 0u;
+    }
+
+    void put(const char *s, size_t n) {
+        while (n > 0u) {
+            if (this->len == sizeof(this->buf)) this->flush();
+            const size_t w = n < sizeof(this->buf) - this->len ? n : sizeof(this->buf) - this->len;
+            memcpy(this->buf + this->len, s, w);
+            this->len += w;
+            s += w;
+            n -= w;
+        }
+    }
+};
+
+static void __profile_put_name(fd_writer *w, const uint32_t hook_id)
+{
+    const A64HookStatsEntry *e = __stats != NULL && hook_id < __stats->capacity ? __stats_entry(hook_id) : NULL;
+    if (e != NULL && e->name[0] != '\0') {
+        w->put(e->name, strnlen(e->name, sizeof(e->name)));
+    } else {
+        char buf[32];
+        const int n = snprintf(buf, sizeof(buf), "hook#%u", hook_id);
+        w->put(buf, static_cast<size_t>(n));
+    }
+}
+
+static uint64_t __profile_value(const profile_node *n, const uint32_t metric, const uint64_t freq)
+{
+    uint64_t v;
+    switch (metric) {
+    case A64_PROFILE_CALLS:
+        return __atomic_load_n(&n->calls, __ATOMIC_RELAXED);
+    case A64_PROFILE_INCLUSIVE:
+        v = __atomic_load_n(&n->incl, __ATOMIC_RELAXED);
+        break;
+    default:
+        v = __atomic_load_n(&n->excl, __ATOMIC_RELAXED);
+        break;
+    }
+    // 计数周期换算为纳秒, 分两步计算以避免乘法溢出
+    return freq != 0u ? v / freq * 1000000000ull + v % freq * 1000000000ull / freq : v;
+}
+
+A64_JNIEXPORT int A64ProfileDump(int fd, uint32_t metric)
+{
+    const uint64_t freq = __stats != NULL ? __stats->counter_freq : 0u;
+
+    size_t total = 0u;
+    for (thread_block *tb = __load_acquire(&__thread_blocks); tb != NULL; tb = tb->next) {
+        const profile_table *t = __load_acquire(&tb->profile);
+        if (t != NULL) total += __load_acquire(&t->used);
+    }
+
+    size_t cap = 16u;
+    while (cap < total * 2u) cap <<= 1u;
+    const size_t agg_bytes  = cap * sizeof(profile_agg);
+    const size_t hash_bytes = A64_PROFILE_NODES * sizeof(uint64_t);
+    void *p = ::mmap(NULL, agg_bytes + hash_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return -1;
+    profile_agg *agg    = static_cast<profile_agg *>(p);
+    uint64_t    *hashes = reinterpret_cast<uint64_t *>(static_cast<char *>(p) + agg_bytes);
+
+    // 按 (调用栈哈希) 合并所有线程的节点
+    size_t unique = 0u;
+    for (thread_block *tb = __load_acquire(&__thread_blocks); tb != NULL; tb = tb->next) {
+        const profile_table *t = __load_acquire(&tb->profile);
+        if (t == NULL) continue;
+
+        const uint32_t used = __load_acquire(&t->used);
+        hashes[0] = 0u;
+        for (uint32_t i = 1u; i < used && unique < cap / 2u; ++i) {
+            const profile_node *n = &t->nodes[i];
+            hashes[i] = __profile_hash(hashes[n->parent], n->hook_id);
+
+            const uint64_t v = __profile_value(n, metric, freq);
+            if (v == 0u) continue;
+
+            size_t k = hashes[i] & (cap - 1u);
+            while (agg[k].hash != 0u && agg[k].hash != hashes[i]) k = (k + 1u) & (cap - 1u);
+            if (agg[k].hash == 0u) {
+                agg[k].hash  = hashes[i];
+                agg[k].table = t;
+                agg[k].node  = i;
+                ++unique;
+            }
+            agg[k].value += v;
+        }
+    }
+
+    // 输出 "name1;name2;...;nameN value"
+    fd_writer w;
+    w.fd     = fd;
+    w.len    = 0u;
+    w.failed = false;
+    int lines = 0;
+    for (size_t k = 0u; k < cap; ++k) {
+        if (agg[k].hash == 0u) continue;
+
+        uint32_t stack[A64_SHADOW_DEPTH];
+        uint32_t depth = 0u;
+        for (uint32_t n = agg[k].node; n != 0u && depth < A64_SHADOW_DEPTH; n = agg[k].table->nodes[n].parent) {
+            stack[depth++] = agg[k].table->nodes[n].hook_id;
+        }
+        while (depth > 0u) {
+            __profile_put_name(&w, stack[--depth]);
+            if (depth > 0u) w.put(";", 1u);
+        }
+
+        char buf[32];
+        const int n = snprintf(buf, sizeof(buf), " %" PRIu64 "\n", agg[k].value);
+        w.put(buf, static_cast<size_t>(n));
+        ++lines;
+    }
+    w.flush();
+
+    ::munmap(p, agg_bytes + hash_bytes);
+    return w.failed ? -1 : lines;
+}
+
+A64_JNIEXPORT void A64ProfileReset(void)
+{
+    for (thread_block *tb = __load_acquire(&__thread_blocks); tb != NULL; tb = tb->next) {
+        profile_table *t = __load_acquire(&tb->profile);
+        if (t == NULL) continue;
+
+        const uint32_t used = __load_acquire(&t->used);
+        for (uint32_t i = 1u; i < used; ++i) {
+            __atomic_store_n(&t->nodes[i].calls, 0u, __ATOMIC_RELAXED);
+            __atomic_store_n(&t->nodes[i].incl, 0u, __ATOMIC_RELAXED);
+            __atomic_store_n(&t->nodes[i].excl, 0u, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+// 一次性覆盖率探针(Coverage)
+//-------------------------------------------------------------------------
+
+/*
+ * coverage_site: 一个覆盖率探针, 与转发代码一一对应
+ *
+ * 在入口被改写之前写入, 之后只读。
+ */
+struct coverage_site
+{
+    uint32_t *symbol;    // 目标函数入口
+    uint64_t *bitmap;    // 调用者提供的命中位图
+    uint32_t  bit;       // 在位图中的位置
+    uint32_t  original;  // 被改写的原始入口字
+};
+
+/*
+ * coverage_arena: 一块映射在目标函数附近的 RWX 区域
+ *
+ * 布局: 共享桩代码(即区域的起始地址) | 头部 | 转发代码 2 * A64_COVERAGE_ARENA_SITES 字 |
+ * coverage_site * A64_COVERAGE_ARENA_SITES。
+ *
+ * 目标函数入口被改写为 "B 转发代码", 每段转发代码为:
+ *   ADR X17, #0       ; X17 = 转发代码自身的地址, 用于找到 coverage_site
+ *   B   stub          ; 跳到本区域的共享桩代码
+ * 所以每个探针只需要一个入口字和 8 字节转发代码, 不需要跳板或替换函数。
+ */
+#define __coverage_stub_words 28
+
+struct coverage_arena
+{
+    uint32_t        stub[__coverage_stub_words];
+    coverage_arena *next;
+    uint32_t        used;
+    uint32_t        reserved;
+
+    inline uint32_t *thunks() {
+        return reinterpret_cast<uint32_t *>(this + 1);
+    }
+    inline coverage_site *sites() {
+        return reinterpret_cast<coverage_site *>(this->thunks() + 2 * A64_COVERAGE_ARENA_SITES);
+    }
+};
+
+static constexpr size_t __coverage_arena_size = __page_align(sizeof(coverage_arena) +
+                                                             A64_COVERAGE_ARENA_SITES * (2 * sizeof(uint32_t) + sizeof(coverage_site)));
+static constexpr intptr_t __coverage_stub_hit = 26;  // 字面量: __coverage_hit
+
+static_assert(sizeof(coverage_arena) % 8 == 0, "8-byte align");
+
+/*
+ * __coverage_stub_template: 覆盖率探针的共享桩代码
+ *
+ * 进入时 X17 是转发代码的地址, 参数寄存器和 LR 都保持调用者设置的值。保存
+ * X0-X8, LR 和 Q0-Q7 后以 (转发代码, 区域) 调用 __coverage_hit, 它记录命中并恢复
+ * 原始入口字, 返回目标函数地址; 恢复全部寄存器后跳回目标函数重新执行。
+ */
+static const uint32_t __coverage_stub_template[__coverage_stub_words] = {
+    0xd10343ffu, // sub  sp, sp, #0xd0
+    0xa90007e0u, // stp  x0, x1, [sp]
+    0xa9010fe2u, // stp  x2, x3, [sp, #0x10]
+    0xa90217e4u, // stp  x4, x5, [sp, #0x20]
+    0xa9031fe6u, // stp  x6, x7, [sp, #0x30]
+    0xa9047be8u, // stp  x8, x30, [sp, #0x40]
+    0xad0287e0u, // stp  q0, q1, [sp, #0x50]
+    0xad038fe2u, // stp  q2, q3, [sp, #0x70]
+    0xad0497e4u, // stp  q4, q5, [sp, #0x90]
+    0xad059fe6u, // stp  q6, q7, [sp, #0xb0]
+    0xaa1103e0u, // mov  x0, x17
+    0x10fffea1u, // adr  x1, arena
+    0x580001d0u, // ldr  x16, hit
+    0xd63f0200u, // blr  x16
+    0xaa0003f1u, // mov  x17, x0
+    0xad459fe6u, // ldp  q6, q7, [sp, #0xb0]
+    0xad4497e4u, // ldp  q4, q5, [sp, #0x90]
+    0xad438fe2u, // ldp  q2, q3, [sp, #0x70]
+    0xad4287e0u, // ldp  q0, q1, [sp, #0x50]
+    0xa9447be8u, // ldp  x8, x30, [sp, #0x40]
+    0xa9431fe6u, // ldp  x6, x7, [sp, #0x30]
+    0xa94217e4u, // ldp  x4, x5, [sp, #0x20]
+    0xa9410fe2u, // ldp  x2, x3, [sp, #0x10]
+    0xa94007e0u, // ldp  x0, x1, [sp]
+    0x910343ffu, // add  sp, sp, #0xd0
+    0xd61f0220u, // br   x17
+    // 字面量
+    0u, 0u,      // hit
+};
+
+static coverage_arena *volatile __coverage_arenas = NULL;
+static pthread_mutex_t          __coverage_lock   = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * __coverage_hit: 探针第一次被执行时由桩代码调用
+ *
+ * 用一次比较交换把入口字恢复为原始指令: 入口之后被其他 Hook 改写时比较失败, 不会破坏它们。
+ * 多个线程可能同时进入(其他核心还没有看到恢复后的入口), 这里的操作都是幂等的。
+ * 运行在被探测线程中, 不能调用可能被探测的函数。
+ *
+ * @return: 目标函数地址, 桩代码跳回那里执行原始指令
+ */
+static uint64_t __coverage_hit(const uint32_t *thunk, coverage_arena *arena)
+{
+    const coverage_site *site = &arena->sites()[(thunk - arena->thunks()) / 2];
+    __atomic_fetch_or(&site->bitmap[site->bit / 64u], 1ull << (site->bit % 64u), __ATOMIC_RELAXED);
+
+    const uint32_t patched = 0x14000000u | (static_cast<uint32_t>((__intval(thunk) - __intval(site->symbol)) >> 2) & 0x03ffffffu);
+    if (__code_cmpswap(site->symbol, patched, site->original)) {
+        __flush_cache(site->symbol, sizeof(uint32_t));
+    }
+    return __uintval(site->symbol);
+}
+
+/*
+ * __coverage_arena_near: 找到一块能容纳新探针且在 symbol 跳转范围内的区域, 没有则新映射一块
+ *
+ * 调用者持有 __coverage_lock。
+ */
+static coverage_arena *__coverage_arena_near(const void *symbol)
+{
+    for (coverage_arena *a = __coverage_arenas; a != NULL; a = a->next) {
+        if (a->used < A64_COVERAGE_ARENA_SITES && __branch_reachable(a, __coverage_arena_size, symbol)) return a;
+    }
+
+    coverage_arena *a = static_cast<coverage_arena *>(__map_near(symbol, __coverage_arena_size));
+    if (a == NULL) {
+        A64_LOGE("failed to map coverage arena near %p!", symbol);
+        return NULL;
+    }
+    memcpy(a->stub, __coverage_stub_template, sizeof(__coverage_stub_template));
+    *reinterpret_cast<void **>(a->stub + __coverage_stub_hit) = reinterpret_cast<void *>(__coverage_hit);
+    __flush_cache(a->stub, sizeof(a->stub));
+    a->next = __coverage_arenas;
+    __store_release(&__coverage_arenas, a);
+    return a;
+}
+
+static int __uintptr_compare(const void *a, const void *b)
+{
+    const uintptr_t x = *static_cast<const uintptr_t *>(a), y = *static_cast<const uintptr_t *>(b);
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * __protect_symbols: 对 symbols 所在的全部页调用 mprotect, 相邻的页合并为一次调用, 用于批量安装
+ *
+ * @return: 失败的 mprotect 次数
+ */
+static int __protect_symbols(void *const *symbols, const int count)
+{
+    uintptr_t *pages = static_cast<uintptr_t *>(malloc(static_cast<size_t>(count) * sizeof(uintptr_t)));
+    if (pages == NULL) return count;
+    for (int i = 0; i < count; ++i) {
+        pages[i] = __align_down(__uintval(symbols[i]), static_cast<uintptr_t>(__page_size));
+    }
+    qsort(pages, static_cast<size_t>(count), sizeof(uintptr_t), __uintptr_compare);
+
+    int failures = 0;
+    for (int i = 0; i < count;) {
+        uintptr_t end = pages[i] + __page_size;
+        int k = i + 1;
+        while (k < count && pages[k] <= end) {
+            end = pages[k] + __page_size;
+            ++k;
+        }
+        if (::mprotect(__ptr(pages[i]), end - pages[i], PROT_READ | PROT_WRITE | PROT_EXEC) != 0) {
+            A64_LOGE("mprotect failed with errno = %d, p = %p, size = %zu", errno, __ptr(pages[i]), static_cast<size_t>(end - pages[i]));
+            ++failures;
+        }
+        i = k;
+    }
+    free(pages);
+    return failures;
+}
+
+/*
+ * A64CoverageInstall: 批量安装一次性覆盖率探针
+ *
+ * 先按页合并 mprotect, 再为每个函数写好 coverage_site 和转发代码并刷新缓存,
+ * 最后才逐个改写入口字, 保证任何线程执行到新入口时看到的都是完整的转发代码。
+ */
+A64_JNIEXPORT int A64CoverageInstall(void *const *symbols, int count, uint64_t *bitmap)
+{
+    if (symbols == NULL || bitmap == NULL || count < 0) return -1;
+
+    pthread_mutex_lock(&__coverage_lock);
+    const bool writable = __protect_symbols(symbols, count) == 0;
+
+    int installed = 0;
+    for (int i = 0; i < count; ++i) {
+        uint32_t *symbol = static_cast<uint32_t *>(symbols[i]);
+        if (symbol == NULL || (__uintval(symbol) & 3u) != 0u) continue;
+        if (!writable && __make_rwx(symbol, sizeof(uint32_t)) != 0) continue;
+
+        coverage_arena *arena = __coverage_arena_near(symbol);
+        if (arena == NULL) continue;
+
+        const uint32_t  index = arena->used++;
+        coverage_site  *site  = &arena->sites()[index];
+        uint32_t       *thunk = arena->thunks() + 2u * index;
+        site->symbol   = symbol;
+        site->bitmap   = bitmap;
+        site->bit      = static_cast<uint32_t>(i);
+        site->original = __load_acquire(symbol);
+        thunk[0] = 0x10000011u;  // ADR X17, #0
+        thunk[1] = 0x14000000u | (static_cast<uint32_t>((__intval(arena->stub) - __intval(thunk + 1)) >> 2) & 0x03ffffffu);  // B stub
+        __flush_cache(thunk, 2 * sizeof(uint32_t));
+
+        // 入口是单个对齐的字, 一次比较交换即可原子地改写; 期间被其他线程改写时放弃
+        const uint32_t patched = 0x14000000u | (static_cast<uint32_t>((__intval(thunk) - __intval(symbol)) >> 2) & 0x03ffffffu);
+        if (__code_cmpswap(symbol, site->original, patched)) {
+            __flush_cache(symbol, sizeof(uint32_t));
+            ++installed;
+        }
+    }
+    pthread_mutex_unlock(&__coverage_lock);
+    return installed;
+}
+
+//-------------------------------------------------------------------------
+// BRK 陷阱 Hook
+//-------------------------------------------------------------------------
+
+/*
+ * trap_slot: 一个陷阱 Hook, SIGTRAP 处理函数按 pc 查找
+ */
+struct trap_slot
+{
+    uint64_t pc;       // 目标函数入口, 即 BRK 所在的地址
+    uint64_t replace;  // 替换函数
+};
+
+/*
+ * trap_table: 所有陷阱 Hook 的最小完美哈希表(hash and displace)
+ *
+ * n 个入口 pc 先按 __trap_hash(pc, 0) 分到 r 个桶, 每个桶选一个位移 disp[b],
+ * 使桶内所有 pc 的 __trap_hash(pc, disp[b]) % n 互不相同且不与之前的桶冲突。
+ * 查找只需要两次哈希和一次比较, 不需要加锁, 可以在信号处理函数中使用。
+ *
+ * 表在安装时整体重建并以 release 语义发布; 旧表可能仍被其他线程的处理函数读取, 因此不释放。
+ */
+struct trap_table
+{
+    uint32_t  n;
+    uint32_t  r;
+    uint32_t *disp;
+    trap_slot slots[1];  // 实际为 n 个
+};
+
+static trap_slot           __trap_keys[A64_MAX_TRAPS];  // 已安装的陷阱 Hook, 仅在持有 __trap_lock 时访问
+static uint32_t            __trap_count    = 0u;
+static trap_table *volatile __trap_current = NULL;
+static struct sigaction    __trap_previous;
+static pthread_mutex_t     __trap_lock     = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t __trap_hash(uint64_t x, const uint32_t d)
+{
+    // splitmix64 的终结函数
+    x += (static_cast<uint64_t>(d) + 1u) * 0x9e3779b97f4a7c15ull;
+    x  = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x  = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static inline const trap_slot *__trap_lookup(const trap_table *t, const uint64_t pc)
+{
+    const uint32_t   b = static_cast<uint32_t>(__trap_hash(pc, 0u) % t->r);
+    const trap_slot *s = &t->slots[__trap_hash(pc, t->disp[b]) % t->n];
+    return s->pc == pc ? s : NULL;
+}
+
+/*
+ * __trap_build: 为 keys 构建完美哈希表, 每个桶平均 4 个 pc, 先放入较大的桶
+ *
+ * @return: 失败(内存不足或找不到位移)返回 NULL
+ */
+static trap_table *__trap_build(const trap_slot *keys, const uint32_t n)
+{
+    const uint32_t r    = (n + 3u) / 4u;
+    const size_t   size = sizeof(trap_table) + (n - 1u) * sizeof(trap_slot) + r * sizeof(uint32_t);
+    trap_table    *t    = static_cast<trap_table *>(calloc(1u, size));
+    uint32_t      *work = static_cast<uint32_t *>(malloc((2u * n + 2u * r + 1u) * sizeof(uint32_t)));
+    if (t == NULL || work == NULL) {
+        free(t);
+        free(work);
+        return NULL;
+    }
+    t->n    = n;
+    t->r    = r;
+    t->disp = reinterpret_cast<uint32_t *>(&t->slots[n]);
+
+    // 按桶排列 pc 的下标: 桶 i 的成员为 members[first[i] .. first[i + 1])
+    uint32_t *bucket  = work;
+    uint32_t *members = bucket + n;
+    uint32_t *first   = members + n;
+    uint32_t *order   = first + r + 1u;
+    memset(first, 0, (r + 1u) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; ++i) {
+        bucket[i] = static_cast<uint32_t>(__trap_hash(keys[i].pc, 0u) % r);
+        ++first[bucket[i] + 1u];
+    }
+    for (uint32_t i = 0; i < r; ++i) first[i + 1u] += first[i];
+    for (uint32_t i = 0; i < n; ++i) members[first[bucket[i]]++] = i;
+    for (uint32_t i = r; i > 0u; --i) first[i] = first[i - 1u];
+    first[0] = 0u;
+
+    // 桶按大小降序排列(插入排序, 桶的数量不超过 A64_MAX_TRAPS / 4)
+    for (uint32_t i = 0; i < r; ++i) {
+        uint32_t k = i;
+        for (; k > 0u && first[order[k - 1u] + 1u] - first[order[k - 1u]] < first[i + 1u] - first[i]; --k) {
+            order[k] = order[k - 1u];
+        }
+        order[k] = i;
+    }
+
+    bool ok = true;
+    for (uint32_t j = 0; j < r && ok; ++j) {
+        const uint32_t *m = members + first[order[j]];
+        const uint32_t  c = first[order[j] + 1u] - first[order[j]];
+        uint32_t        slots[A64_MAX_TRAPS];
+        uint32_t        d = 1u;
+        for (; d < (1u << 24); ++d) {
+            bool fits = true;
+            for (uint32_t i = 0; i < c && fits; ++i) {
+                slots[i] = static_cast<uint32_t>(__trap_hash(keys[m[i]].pc, d) % n);
+                fits = t->slots[slots[i]].pc == 0u;
+                for (uint32_t k = 0; k < i && fits; ++k) fits = slots[k] != slots[i];
+            }
+            if (fits) break;
+        }
+        if (d == (1u << 24)) {
+            ok = false;
+            break;
+        }
+        for (uint32_t i = 0; i < c; ++i) t->slots[slots[i]] = keys[m[i]];
+        t->disp[order[j]] = d;
+    }
+    free(work);
+    if (!ok) {
+        A64_LOGE("failed to build trap table for %u hooks!", n);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+/*
+ * __trap_handler: SIGTRAP 处理函数
+ *
+ * 入口是本库写入的 BRK 时把 PC 改为替换函数, 返回后直接在替换函数中继续执行,
+ * 所有寄存器(包括 LR)都保持调用者设置的值。其他 SIGTRAP 交给之前的处理函数;
+ * 之前没有处理函数时恢复默认处理, 返回后重新执行的 BRK 按默认方式终止进程。
+ */
+static void __trap_handler(int sig, siginfo_t *info, void *context)
+{
+    ucontext_t       *uc = static_cast<ucontext_t *>(context);
+    const trap_table *t  = __load_acquire(&__trap_current);
+    const trap_slot  *s  = t != NULL ? __trap_lookup(t, uc->uc_mcontext.pc) : NULL;
+    if (__predict_true(s != NULL)) {
+        uc->uc_mcontext.pc = s->replace;
+        return;
+    }
+
+    if ((__trap_previous.sa_flags & SA_SIGINFO) != 0) {
+        __trap_previous.sa_sigaction(sig, info, context);
+    } else if (__trap_previous.sa_handler != SIG_DFL && __trap_previous.sa_handler != SIG_IGN) {
+        __trap_previous.sa_handler(sig);
+    } else {
+        signal(sig, SIG_DFL);
+    }
+}
+
+/*
+ * __trap_insert: 记录一个陷阱 Hook 并发布新的哈希表, 第一次调用时安装 SIGTRAP 处理函数
+ */
+static bool __trap_insert(void *const symbol, void *const replace)
+{
+    pthread_mutex_lock(&__trap_lock);
+    bool ok = __trap_count < A64_MAX_TRAPS;
+    for (uint32_t i = 0; i < __trap_count && ok; ++i) {
+        ok = __trap_keys[i].pc != __uintval(symbol);
+    }
+    if (!ok) {
+        A64_LOGE("too many trap hooks or %p already has one!", symbol);
+    } else if (__trap_current == NULL) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = __trap_handler;
+        sa.sa_flags     = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGTRAP, &sa, &__trap_previous) != 0) {
+            A64_LOGE("sigaction failed with errno = %d", errno);
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        __trap_keys[__trap_count].pc      = __uintval(symbol);
+        __trap_keys[__trap_count].replace = __uintval(replace);
+        trap_table *table = __trap_build(__trap_keys, __trap_count + 1u);
+        if (table != NULL) {
+            ++__trap_count;
+            __store_release(&__trap_current, table);
+        } else {
+            ok = false;
+        }
+    }
+    pthread_mutex_unlock(&__trap_lock);
+    return ok;
+}
+
+/*
+ * A64TrapHookFunction: 以 BRK 陷阱安装 Hook
+ *
+ * 顺序与其他 Hook 相同: 先生成跳板(只修复入口的一条指令), 再安装处理函数并发布
+ * 包含新 Hook 的哈希表, 最后才把入口改写为 BRK。
+ */
+A64_JNIEXPORT int A64TrapHookFunction(void *const symbol, void *const replace, void **result)
+{
+    uint32_t *original = static_cast<uint32_t *>(symbol);
+    if (original == NULL || replace == NULL || (__uintval(original) & 3u) != 0u) return -1;
+
+    A64InstallStats st = {};
+    uint64_t        t0 = __read_cntvct();
+    A64HookStatsEntry *entry = __registry_alloc();
+    if (entry == NULL) return __install_commit(&st, false), -1;
+
+    uint32_t *trampoline = NULL;
+    if (result != NULL) {
+        trampoline = FastAllocateTrampoline();
+        *result = trampoline;
+        if (trampoline == NULL) return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+    st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+
+    if (__make_rwx_timed(original, sizeof(uint32_t), &st) != 0) {
+        A64_LOGE("mprotect failed with errno = %d, p = %p, size = %zu", errno, original, sizeof(uint32_t));
+        if (result != NULL) *result = NULL;
+        return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+
+    uint32_t map[2];
+    if (trampoline != NULL) __fix_instructions(original, 1, trampoline, &st, map);
+    if (!__trap_insert(symbol, replace)) {
+        if (result != NULL) *result = NULL;
+        return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+
+    __patch_backup(entry, original, 1, trampoline != NULL ? map : NULL);
+    t0 = __read_cntvct();
+    const uint32_t insn0 = *original;
+    __code_cmpswap(original, insn0, A64_TRAP_BRK);
+    st.phase_ns[A64_PHASE_PATCH] += __read_cntvct() - t0;
+
+    t0 = __read_cntvct();
+    __flush_cache(original, sizeof(uint32_t));
+    st.phase_ns[A64_PHASE_FLUSH] += __read_cntvct() - t0;
+
+    __patch_record(entry, original, A64_TRAP_BRK, insn0);
+    __registry_publish(entry, symbol, replace, trampoline, A64_PATCH_TRAP, sizeof(uint32_t), &st);
+    return static_cast<int>(entry->id);
+}
+
+//-------------------------------------------------------------------------
+// 内联代码片段(Snippet)
+//-------------------------------------------------------------------------
+
+/*
+ * 片段跳板从按需映射的 RWX 区域中顺序分配, 不回收; 换到新区域后旧区域剩余的空间不再使用。
+ * 安装期间持有 __snippet_lock, 先按最坏情况预留空间, 生成代码后只提交实际使用的部分。
+ */
+#define __snippet_chunk_size (64u * 1024u)
+
+static pthread_mutex_t __snippet_lock      = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t        *__snippet_pos       = NULL;
+static uint8_t        *__snippet_end       = NULL;
+static uint64_t        __snippet_committed = 0u;
+static uint64_t        __snippet_used      = 0u;
+
+/*
+ * __snippet_reserve: 返回至少 bytes 字节的可用空间, 当前区域不够或离 symbol 太远时映射新的一块
+ *
+ * 优先映射在 symbol 附近(__map_near), 这样入口只需改写一条 B 指令;
+ * 都不可用时退回任意地址, 入口使用远跳转。调用者持有 __snippet_lock。
+ */
+static uint32_t *__snippet_reserve(const void *symbol, const uintptr_t bytes)
+{
+    if (__snippet_pos != NULL && static_cast<uintptr_t>(__snippet_end - __snippet_pos) >= bytes &&
+        __branch_reachable(__snippet_pos, bytes, symbol)) {
+        return reinterpret_cast<uint32_t *>(__snippet_pos);
+    }
+
+    const size_t size = __snippet_chunk_size > bytes ? __snippet_chunk_size : __page_align(bytes);
+    void *chunk = __map_near(symbol, size);
+    if (chunk == NULL) {
+        chunk = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (chunk == MAP_FAILED) {
+        A64_LOGE("failed to map snippet memory, errno = %d", errno);
+        return NULL;
+    }
+    __snippet_pos = static_cast<uint8_t *>(chunk);
+    __snippet_end = __snippet_pos + size;
+    __store_release(&__snippet_committed, __snippet_committed + size);
+    return reinterpret_cast<uint32_t *>(__snippet_pos);
+}
+
+/*
+ * __snippet_frame: 生成保存(restore 为 false)或恢复 saved 中寄存器的指令
+ *
+ *   SUB SP, SP, #frame        ; 保存时
+ *   STR/LDR Xn, [SP, #8 * k]  ; 每个寄存器一条
+ *   ADD SP, SP, #frame        ; 恢复时
+ *
+ * frame 按 16 字节对齐, saved 为 0 时不生成任何指令。
+ */
+static uint32_t *__snippet_frame(uint32_t *outp, const uint32_t saved, const bool restore)
+{
+    const uint32_t frame = __align_up(static_cast<uint32_t>(__builtin_popcount(saved)) * 8u, 16u);
+    if (frame == 0u) return outp;
+
+    if (!restore) *(outp++) = 0xd10003ffu | (frame << 10);  // SUB SP, SP, #frame
+    uint32_t k = 0u;
+    for (uint32_t r = 0u; r < 31u; ++r) {
+        if ((saved & (1u << r)) == 0u) continue;
+        *(outp++) = (restore ? 0xf94003e0u : 0xf90003e0u) | (k++ << 10) | r;  // LDR/STR Xr, [SP, #8 * k]
+    }
+    if (restore) *(outp++) = 0x910003ffu | (frame << 10);   // ADD SP, SP, #frame
+    return outp;
+}
+
+/*
+ * A64HookInjectSnippet: 把代码片段内联到跳板中被覆盖的指令之前
+ *
+ * 跳板布局:
+ *   保存 clobbers 中的寄存器
+ *   修复后的片段, 末尾多一条 NOP, 跳到片段末尾的分支落在这里
+ *   恢复寄存器
+ *   修复后的被覆盖指令, 跳回原函数    <- 作为 __hook_function 的跳板
+ *
+ * 入口跳到跳板开头, 因此整段代码没有任何调用和返回。片段按它在 code 处的地址修复,
+ * 分支和字面量的处理与被覆盖的指令相同。
+ */
+A64_JNIEXPORT int A64HookInjectSnippet(void *const symbol, const void *code, size_t len, uint32_t clobbers)
+{
+    if (symbol == NULL || code == NULL || ((__uintval(symbol) | __uintval(code) | len) & 3u) != 0u ||
+        len == 0u || len > A64_MAX_SNIPPET_WORDS * sizeof(uint32_t)) {
+        A64_LOGE("invalid snippet %p (%zu bytes) for %p!", code, len, symbol);
+        return -1;
+    }
+
+    const int32_t  words = static_cast<int32_t>(len / sizeof(uint32_t));
+    const uint32_t saved = clobbers & A64_SNIPPET_SAVED;
+    const uintptr_t bound = (2u * 24u + 9u * static_cast<uintptr_t>(words + 1)) * sizeof(uint32_t) +
+                            __trampoline_bound(A64_MAX_INSTRUCTIONS);
+
+    A64InstallStats st = {};
+    uint64_t        t0 = __read_cntvct();
+    A64HookStatsEntry *entry = __registry_alloc();
+    if (entry == NULL) return __install_commit(&st, false), -1;
+
+    pthread_mutex_lock(&__snippet_lock);
+    uint32_t *const base = __snippet_reserve(symbol, bound);
+    st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+    if (base == NULL) {
+        pthread_mutex_unlock(&__snippet_lock);
+        return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+
+    // 片段复制到局部数组并在末尾追加 NOP, 修复时按 code 处的地址计算
+    uint32_t window[A64_MAX_SNIPPET_WORDS + 1];
+    memcpy(window, code, len);
+    window[words] = A64_NOP;
+
+    context::insns_info dat[A64_MAX_SNIPPET_WORDS + 1];
+    context ctx;
+    ctx.dat      = dat;
+    ctx.in_bias  = static_cast<int64_t>(__uintval(code) - __uintval(window));
+    ctx.out_bias = 0;
+    ctx.src      = NULL;
+
+    t0 = __read_cntvct();
+    uint32_t *outp = __snippet_frame(base, saved, false);
+    outp = __relocate_insns(ctx, window, words + 1, outp, NULL);
+    outp = __snippet_frame(outp, saved, true);
+    st.phase_ns[A64_PHASE_RELOCATE] += __read_cntvct() - t0;
+    if (ctx.failed) {
+        A64_LOGE("snippet %p has too many references to one instruction!", code);
+        pthread_mutex_unlock(&__snippet_lock);
+        return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+
+    t0 = __read_cntvct();
+    __flush_cache(base, __uintval(outp) - __uintval(base));
+    st.phase_ns[A64_PHASE_FLUSH] += __read_cntvct() - t0;
+
+    void *trampoline = __hook_function(symbol, base, outp, bound - (__uintval(outp) - __uintval(base)), entry, &st);
+    if (trampoline != NULL) {
+        const uintptr_t used = __align_up(__uintval(outp) - __uintval(base) + st.trampoline_bytes, 16u);
+        __snippet_pos += used;
+        __store_release(&__snippet_used, __snippet_used + used);
+    }
+    pthread_mutex_unlock(&__snippet_lock);
+    if (trampoline == NULL) return __registry_release(entry), -1;
+    return static_cast<int>(entry->id);
+}
+
+//-------------------------------------------------------------------------
+// 闭包转发代码(Closure)
+//-------------------------------------------------------------------------
+
+/*
+ * __closure_thunk_template: 每个闭包 Hook 一份的转发代码, 与代码片段共用 __snippet_reserve 的区域
+ *
+ * 把 X0-X6 依次后移一个寄存器, 以 data 作为第一个参数跳到共享的处理函数。
+ * 只使用入口处本就允许被破坏的 X16, 浮点参数寄存器、栈和 LR 都不变,
+ * 因此处理函数在任何编译选项下都能可靠地拿到 data。
+ */
+static constexpr intptr_t __closure_thunk_data    = 10;  // 字面量: data
+static constexpr intptr_t __closure_thunk_handler = 12;  // 字面量: 处理函数
+
+static const uint32_t __closure_thunk_template[14] = {
+    0xaa0603e7u, // mov  x7, x6
+    0xaa0503e6u, // mov  x6, x5
+    0xaa0403e5u, // mov  x5, x4
+    0xaa0303e4u, // mov  x4, x3
+    0xaa0203e3u, // mov  x3, x2
+    0xaa0103e2u, // mov  x2, x1
+    0xaa0003e1u, // mov  x1, x0
+    0x58000060u, // ldr  x0, data
+    0x58000090u, // ldr  x16, handler
+    0xd61f0200u, // br   x16
+    0u, 0u,      // data
+    0u, 0u,      // handler
+};
+
+/*
+ * A64HookClosure: 以 handler 替换 symbol, handler 的第一个参数是 data
+ *
+ * 与 A64ProbeFunction 一样先写好转发代码和跳板, 再改写目标函数入口。
+ * 转发代码尽量映射在 symbol 附近, 这样入口只需改写一条 B 指令。
+ */
+A64_JNIEXPORT int A64HookClosure(void *const symbol, void *const handler, void *data, void **result)
+{
+    if (symbol == NULL || handler == NULL) return -1;
+
+    A64InstallStats st = {};
+    const uint64_t  t0 = __read_cntvct();
+    A64HookStatsEntry *entry = __registry_alloc();
+    if (entry == NULL) return __install_commit(&st, false), -1;
+
+    uint32_t *trampoline = NULL;
+    if (result != NULL) {
+        trampoline = FastAllocateTrampoline();
+        *result = trampoline;
+        if (trampoline == NULL) return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+
+    pthread_mutex_lock(&__snippet_lock);
+    uint32_t *thunk = __snippet_reserve(symbol, sizeof(__closure_thunk_template));
+    if (thunk != NULL) {
+        memcpy(thunk, __closure_thunk_template, sizeof(__closure_thunk_template));
+        *reinterpret_cast<void **>(thunk + __closure_thunk_data)    = data;
+        *reinterpret_cast<void **>(thunk + __closure_thunk_handler) = handler;
+        __flush_cache(thunk, sizeof(__closure_thunk_template));
+        __snippet_pos += sizeof(__closure_thunk_template);
+        __store_release(&__snippet_used, __snippet_used + sizeof(__closure_thunk_template));
+    }
+    pthread_mutex_unlock(&__snippet_lock);
+    st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+    if (thunk == NULL) {
+        if (result != NULL) *result = NULL;
+        return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+
+    __make_rwx_timed(symbol, 5 * sizeof(size_t), &st);
+    // 没有跳板时 __hook_function 总是返回 NULL, 以条目是否已发布判断成败
+    __hook_function(symbol, thunk, trampoline, sizeof(__insns_pool[0]), entry, &st);
+    if ((entry->flags & A64_HOOK_ENABLED) == 0u) {
+        if (result != NULL) *result = NULL;
+        return __registry_release(entry), -1;
+    }
+    return static_cast<int>(entry->id);
+}
+
+//-------------------------------------------------------------------------
+// 通用处理函数(Universal)
+//-------------------------------------------------------------------------
+
+/*
+ * A64UniversalHook: 批量把函数交给同一个处理函数
+ *
+ * 与 A64CoverageInstall 相同: 先按页合并 mprotect, 再为每个函数修复入口指令、写好
+ * universal_site 并刷新缓存, 最后才用一次比较交换改写入口字。区域和入口都在 B 指令
+ * 范围内, 因此只覆盖一条指令, 跳板也只需跳回一条 B。
+ */
+A64_JNIEXPORT int A64UniversalHook(void *const *symbols, int count, A64UniversalHandler handler, uint32_t first_id)
+{
+    if (symbols == NULL || handler == NULL || count < 0) return -1;
+
+    static constexpr uint32_t bound = sizeof(universal_site) + __fix_bound(1);
 
-        int32_t i = __atomic_increase(&__index);
-        if (__predict_true(i >= 0 && i < __countof(__insns_pool))) {
-            return __insns_pool[i];
+    pthread_mutex_lock(&__stub_arena_lock);
+    const bool writable = __protect_symbols(symbols, count) == 0;
+
+    int installed = 0;
+    for (int i = 0; i < count; ++i) {
+        uint32_t *symbol = static_cast<uint32_t *>(symbols[i]);
+        if (symbol == NULL || (__uintval(symbol) & 3u) != 0u) continue;
+        if (!writable && __make_rwx(symbol, sizeof(uint32_t)) != 0) continue;
+
+        stub_arena *arena = __stub_arena_near(symbol, bound, false);
+        if (arena == NULL) continue;
+
+        universal_site *site       = reinterpret_cast<universal_site *>(arena->data() + arena->used);
+        uint32_t       *trampoline = reinterpret_cast<uint32_t *>(site + 1);
+        const uint32_t  insn0      = __load_acquire(symbol);
+        const uintptr_t size       = __fix_instructions(symbol, 1, trampoline);
+        __stub_site(site->code, arena->universal);
+        site->id         = first_id + static_cast<uint32_t>(i);
+        site->trampoline = __uintval(trampoline);
+        site->handler    = __uintval(handler);
+        __flush_cache(site, sizeof(*site));
+
+        const uint32_t patched = 0x14000000u | (static_cast<uint32_t>((__intval(site) - __intval(symbol)) >> 2) & 0x03ffffffu);
+        if (__code_cmpswap(symbol, insn0, patched)) {
+            __flush_cache(symbol, sizeof(uint32_t));
+            arena->used += static_cast<uint32_t>(__align_up(sizeof(*site) + size, 8u));
+            __store_release(&arena->sites, arena->sites + 1u);
+            ++installed;
         }
+    }
+    pthread_mutex_unlock(&__stub_arena_lock);
+    return installed;
+}
 
-        A64_LOGE("failed to allocate trampoline!");
-        return NULL;
+//-------------------------------------------------------------------------
+// 系统调用位置(SVC #0)拦截
+//-------------------------------------------------------------------------
+
+#define __svc0 0xd4000001u  // SVC #0
+
+typedef uint32_t __u32x4 __attribute__((vector_size(16)));
+
+/*
+ * __scan_svc: 在 [begin, end) 中查找 SVC #0
+ *
+ * 每次比较 16 个字(4 个 128 位向量, 在 AArch64 上编译为 NEON 的 CMEQ/ORR), 只有命中的
+ * 块才逐字检查。地址写入 out, 最多 max 个。
+ *
+ * @return: 找到的数量, 可能大于 max
+ */
+static size_t __scan_svc(const uint32_t *begin, const uint32_t *end, uint32_t **out, const size_t max)
+{
+    const __u32x4 svc = { __svc0, __svc0, __svc0, __svc0 };
+    size_t n = 0;
+    const uint32_t *p = begin;
+    for (; end - p >= 16; p += 16) {
+        __u32x4 v[4];
+        memcpy(v, p, sizeof(v));
+        const __u32x4 m = (v[0] == svc) | (v[1] == svc) | (v[2] == svc) | (v[3] == svc);
+        if (__predict_true((m[0] | m[1] | m[2] | m[3]) == 0u)) continue;
+        for (int i = 0; i < 16; ++i) {
+            if (p[i] == __svc0 && n++ < max) out[n - 1] = const_cast<uint32_t *>(p + i);
+        }
     }
+    for (; p < end; ++p) {
+        if (*p == __svc0 && n++ < max) out[n - 1] = const_cast<uint32_t *>(p);
+    }
+    return n;
+}
 
-    //-------------------------------------------------------------------------
+/*
+ * __syscall_inplace: 必须在 SVC 原来的位置执行的系统调用
+ *
+ * clone/clone3 的子进程(包括 vfork)从新的栈或共享的栈上返回, rt_sigreturn 依赖 SP 指向信号帧,
+ * 它们都不能在桩代码的栈帧中代为执行。这些调用不经过 post 处理函数。
+ */
+static inline bool __syscall_inplace(const uint64_t nr)
+{
+    return nr == 220u /* clone */ || nr == 435u /* clone3 */ || nr == 139u /* rt_sigreturn */;
+}
 
-    /*
-     * A64HookFunctionV: 带自定义跳板缓冲区的 Hook 实现
-     *
-     * 这是 Hook 的核心实现函数。它完成以下工作:
-     *   1. 备份并修复原函数开头的指令到跳板
-     *   2. 将原函数入口替换为跳转到替换函数的代码
-     *
-     * Hook 后的执行流程:
-     *   调用原函数 -> 跳转到替换函数 -> (可选)调用跳板执行原逻辑 -> 返回
-     *
-     * @param symbol:   要 Hook 的目标函数地址
-     * @param replace:  替换函数地址
-     * @param rwx:      跳板缓冲区(需要有 RWX 权限)
-     * @param rwx_size: 跳板缓冲区大小
-     * @return:         成功返回跳板地址, 失败返回 NULL
-     */
-    A64_JNIEXPORT void *A64HookFunctionV(void *const symbol, void *const replace,
-                                         void *const rwx, const uintptr_t rwx_size)
-    {
-        static constexpr uint_fast64_t mask = 0x03ffffffu;  // B 指令偏移掩码 0b00000011111111111111111111111111
+/*
+ * __raw_syscall: 以 regs 中的 X0-X5 和 X8 执行系统调用, 不经过 libc(也就不会经过被拦截的位置)
+ */
+static inline uint64_t __raw_syscall(const A64SyscallRegs *regs)
+{
+    register uint64_t x0 __asm__("x0") = regs->x[0];
+    register uint64_t x1 __asm__("x1") = regs->x[1];
+    register uint64_t x2 __asm__("x2") = regs->x[2];
+    register uint64_t x3 __asm__("x3") = regs->x[3];
+    register uint64_t x4 __asm__("x4") = regs->x[4];
+    register uint64_t x5 __asm__("x5") = regs->x[5];
+    register uint64_t x8 __asm__("x8") = regs->x[8];
+    __asm__ __volatile__("svc #0" : "+r"(x0) : "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5), "r"(x8) : "memory");
+    return x0;
+}
 
-        uint32_t *trampoline = static_cast<uint32_t *>(rwx);
-        uint32_t *original = static_cast<uint32_t *>(symbol);
+/*
+ * __syscall_guard: 正在执行处理函数的线程, 以线程指针(TPIDR_EL0)标识, 0 表示空闲
+ *
+ * 不能用 __thread 变量防止重入: 库被 dlopen 时它是 global-dynamic TLS, 线程第一次访问时
+ * __tls_get_addr 会调用 malloc/mmap, 而它们的 SVC 可能正是被拦截的位置, 在防护生效之前
+ * 就再次进入 __syscall_dispatch。线程指针由 libc 在线程创建时设置, 读取它不经过任何函数调用。
+ */
+static uint64_t __syscall_guard[A64_SYSCALL_GUARD_SLOTS];
 
-        static_assert(A64_MAX_INSTRUCTIONS >= 5, "please fix A64_MAX_INSTRUCTIONS!");
+/*
+ * __syscall_guard_enter: 登记当前线程进入处理函数
+ *
+ * 每个线程只会出现在自己的 8 个槽位中, 其他线程只会把空闲槽位改为它们自己的线程指针,
+ * 因此在这 8 个槽位中找到自己就说明是重入。
+ *
+ * @return: 登记的槽位; 已经在处理函数中(重入)或槽位都被占用时返回 -1
+ */
+static intptr_t __syscall_guard_enter(const uint64_t tp)
+{
+    static constexpr intptr_t window = 8;
+    const intptr_t h = static_cast<intptr_t>((tp >> 4) * 0x9e3779b97f4a7c15ull >> 56) & (A64_SYSCALL_GUARD_SLOTS - 1);
 
-        /*
-         * 计算从原函数到替换函数的 PC 相对偏移
-         *
-         * 如果偏移在 +/-128MB 范围内, 只需覆盖一条指令(B 指令)。
-         * 否则需要使用 LDR+BR 间接跳转, 需要覆盖 4-5 条指令。
-         */
-        auto pc_offset = static_cast<int64_t>(__intval(replace) - __intval(symbol)) >> 2;
+    intptr_t free = -1;
+    for (intptr_t i = 0; i < window; ++i) {
+        const intptr_t k = (h + i) & (A64_SYSCALL_GUARD_SLOTS - 1);
+        const uint64_t v = __atomic_load_n(&__syscall_guard[k], __ATOMIC_RELAXED);
+        if (v == tp) return -1;
+        if (v == 0u && free < 0) free = k;
+    }
+    for (intptr_t i = 0; free >= 0 && i < window; ++i) {
+        const intptr_t k = (h + i) & (A64_SYSCALL_GUARD_SLOTS - 1);
+        uint64_t expected = 0u;
+        if (__atomic_compare_exchange_n(&__syscall_guard[k], &expected, tp, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return k;
+        }
+    }
+    return -1;
+}
 
-        if (llabs(pc_offset) >= (mask >> 1)) {
-            /*
-             * 远距离跳转: 需要使用 LDR+BR 组合
-             *
-             * 指令序列:
-             *   [NOP]             ; 可选, 用于对齐
-             *   LDR X17, #8       ; 从 PC+8 加载目标地址
-             *   BR  X17           ; 跳转到目标
-             *   <64-bit address>  ; 替换函数地址
-             *
-             * 是否需要 NOP 取决于 original+2 的对齐情况:
-             *   - 如果 (original+2) 已经 8 字节对齐 -> 不需要 NOP, 共 4 条指令
-             *   - 否则 -> 需要 NOP 对齐, 共 5 条指令
-             */
-            int32_t count = (reinterpret_cast<uint64_t>(original + 2) & 7u) != 0u ? 5 : 4;
+/*
+ * __syscall_dispatch: 桩代码保存寄存器后调用
+ *
+ * 处理函数中再次执行被拦截的系统调用时(例如 pre 中调用 write)不再调用处理函数, 避免无限递归。
+ *
+ * @return: 0 表示已代为执行(或被 pre 跳过), 结果在 regs->x[0]; 1 表示回到原位置执行 SVC
+ */
+static uint64_t __syscall_dispatch(syscall_site *site, A64SyscallRegs *regs)
+{
+    if (__syscall_inplace(regs->x[8])) return 1u;
+    const intptr_t slot = __syscall_guard_enter(__thread_pointer());
+    if (slot < 0) {
+        regs->x[0] = __raw_syscall(regs);
+        return 0u;
+    }
 
-            if (trampoline) {
-                // 检查跳板缓冲区大小
-                if (rwx_size < count * 10u) {
-                    A64_LOGE("rwx size is too small to hold %u bytes backup instructions!", count * 10u);
-                    return NULL;
-                }
-                // 备份并修复原始指令
-                __fix_instructions(original, count, trampoline);
-            }
+    if (site->pre == NULL || site->pre(site->pc, regs) == 0) {
+        regs->x[0] = __raw_syscall(regs);
+        if (site->post != NULL) site->post(site->pc, regs);
+    }
+    __atomic_store_n(&__syscall_guard[slot], 0u, __ATOMIC_RELAXED);
+    return 0u;
+}
 
-            // 修改原函数入口
-            if (__make_rwx(original, 5 * sizeof(uint32_t)) == 0) {
-                if (count == 5) {
-                    // 需要 NOP 对齐
-                    original[0] = A64_NOP;
-                    ++original;
-                }
-                original[0] = 0x58000051u; // LDR X17, #0x8
-                original[1] = 0xd61f0220u; // BR X17
-                *reinterpret_cast<int64_t *>(original + 2) = __intval(replace);
-                __flush_cache(symbol, 5 * sizeof(uint32_t));
+/*
+ * syscall_scan: A64SyscallHook 传给 dl_iterate_phdr 的参数
+ */
+struct syscall_scan
+{
+    const char *module;
+    uint32_t  **sites;
+    size_t      count;
+    size_t      capacity;
+};
 
-                A64_LOGI("inline hook %p->%p successfully! %zu bytes overwritten",
-                         symbol, replace, 5 * sizeof(uint32_t));
-            } else {
-                A64_LOGE("mprotect failed with errno = %d, p = %p, size = %zu",
-                         errno, original, 5 * sizeof(uint32_t));
-                trampoline = NULL;
-            }
-        } else {
-            /*
-             * 近距离跳转: 只需一条 B 指令
-             *
-             * 这是最理想的情况, 只需覆盖一条指令(4字节), 对原函数影响最小。
-             * 当替换函数与原函数在同一个共享库中或相邻库中时通常会走这个分支。
-             */
-            if (trampoline) {
-                if (rwx_size < 1u * 10u) {
-                    A64_LOGE("rwx size is too small to hold %u bytes backup instructions!", 1u * 10u);
-                    return NULL;
-                }
-                __fix_instructions(original, 1, trampoline);
-            }
+/*
+ * __syscall_scan_module: 在名称包含 module 的模块的可执行段中查找 SVC #0
+ *
+ * 跳过本库自身所在的段, __raw_syscall 中的 SVC 被改写后会无限递归。
+ */
+static int __syscall_scan_module(struct dl_phdr_info *info, size_t, void *data)
+{
+    syscall_scan *scan = static_cast<syscall_scan *>(data);
+    if (info->dlpi_name == NULL || strstr(info->dlpi_name, scan->module) == NULL) return 0;
 
-            if (__make_rwx(original, 1 * sizeof(uint32_t)) == 0) {
-                /*
-                 * 使用原子比较交换来写入跳转指令
-                 *
-                 * __sync_cmpswap 确保写入的原子性: 如果 original[0] 的当前值
-                 * 等于 *original(即我们之前读取的值), 则将其替换为新的 B 指令。
-                 *
-                 * 这可以避免与其他线程的竞争条件, 虽然在 Hook 场景中竞争不太常见,
-                 * 但这是一个好习惯。
-                 */
-                __sync_cmpswap(original, *original, 0x14000000u | (pc_offset & mask));
-                __flush_cache(symbol, 1 * sizeof(uint32_t));
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || (ph->p_flags & PF_X) == 0u) continue;
 
-                A64_LOGI("inline hook %p->%p successfully! %zu bytes overwritten",
-                         symbol, replace, 1 * sizeof(uint32_t));
-            } else {
-                A64_LOGE("mprotect failed with errno = %d, p = %p, size = %zu",
-                         errno, original, 1 * sizeof(uint32_t));
-                trampoline = NULL;
-            }
+        const uintptr_t start = __align_up(static_cast<uintptr_t>(info->dlpi_addr + ph->p_vaddr), 4u);
+        const uintptr_t end   = __align_down(static_cast<uintptr_t>(info->dlpi_addr + ph->p_vaddr + ph->p_memsz), 4u);
+        const uintptr_t self  = __uintval(__syscall_dispatch);
+        if (self >= start && self < end) continue;
+        scan->count += __scan_svc(reinterpret_cast<const uint32_t *>(start), reinterpret_cast<const uint32_t *>(end),
+                                  scan->sites + scan->count, scan->capacity - scan->count);
+        if (scan->count > scan->capacity) scan->count = scan->capacity;
+    }
+    return 0;
+}
+
+/*
+ * A64SyscallHook: 拦截模块中所有 SVC #0 位置
+ *
+ * 与 A64UniversalHook 相同: 先按页合并 mprotect, 为每个位置在附近的 stub_arena 中写好
+ * syscall_site 并刷新缓存, 最后用一次比较交换把 SVC 改写为 B。只改写 SVC 这一条指令,
+ * 它在 code 中重新生成, 因此前后的指令都不需要修复; 附近映射不到区域的位置被跳过。
+ */
+A64_JNIEXPORT int A64SyscallHook(const char *module, A64SyscallHandler pre, A64SyscallHandler post)
+{
+    if (module == NULL || (pre == NULL && post == NULL)) return -1;
+
+    syscall_scan scan = { module, NULL, 0u, A64_MAX_SYSCALL_SITES };
+    scan.sites = static_cast<uint32_t **>(malloc(scan.capacity * sizeof(uint32_t *)));
+    if (scan.sites == NULL) return -1;
+    dl_iterate_phdr(__syscall_scan_module, &scan);
+
+    pthread_mutex_lock(&__stub_arena_lock);
+    const bool writable = __protect_symbols(reinterpret_cast<void *const *>(scan.sites), static_cast<int>(scan.count)) == 0;
+
+    int installed = 0;
+    for (size_t i = 0; i < scan.count; ++i) {
+        uint32_t *pc = scan.sites[i];
+        if (!writable && __make_rwx(pc, sizeof(uint32_t)) != 0) continue;
+
+        stub_arena *arena = __stub_arena_near(pc, sizeof(syscall_site), false);
+        if (arena == NULL) continue;
+
+        syscall_site *site = reinterpret_cast<syscall_site *>(arena->data() + arena->used);
+        site->code[0] = 0xa9bf47f0u;  // STP X16, X17, [SP, #-16]!
+        site->code[1] = 0x10fffff1u;  // ADR X17, code
+        site->code[2] = 0x14000000u | (static_cast<uint32_t>((__intval(arena->syscall) - __intval(&site->code[2])) >> 2) & 0x03ffffffu);
+        site->code[3] = 0xa8c147f0u;  // LDP X16, X17, [SP], #16
+        site->code[4] = 0x14000000u | (static_cast<uint32_t>((__intval(pc + 1) - __intval(&site->code[4])) >> 2) & 0x03ffffffu);
+        site->code[5] = 0xa8c147f0u;  // LDP X16, X17, [SP], #16
+        site->code[6] = __svc0;
+        site->code[7] = 0x14000000u | (static_cast<uint32_t>((__intval(pc + 1) - __intval(&site->code[7])) >> 2) & 0x03ffffffu);
+        site->pc      = __uintval(pc);
+        site->pre     = pre;
+        site->post    = post;
+        __flush_cache(site, sizeof(*site));
+
+        const uint32_t patched = 0x14000000u | (static_cast<uint32_t>((__intval(site) - __intval(pc)) >> 2) & 0x03ffffffu);
+        if (__code_cmpswap(pc, __svc0, patched)) {
+            __flush_cache(pc, sizeof(uint32_t));
+            arena->used += sizeof(syscall_site);
+            __store_release(&arena->sites, arena->sites + 1u);
+            ++installed;
         }
+    }
+    pthread_mutex_unlock(&__stub_arena_lock);
+    free(scan.sites);
+    return installed;
+}
 
-        return trampoline;
+//-------------------------------------------------------------------------
+// 整函数重写与基本块计数
+//-------------------------------------------------------------------------
+
+/*
+ * 重写后函数内的 TBZ/TBNZ 只有 +/-32KB 的范围, 修复函数内的引用时不会扩展,
+ * 整段代码不超过这个大小就能保证它们都在范围内。
+ */
+#define __rewrite_max_bytes (32u * 1024u)
+
+/*
+ * __branch_target: 函数内 B / B.cond / CBZ / CBNZ / TBZ / TBNZ 的目标指令下标, 其他指令返回 -1
+ *
+ * BL 不划分基本块: 调用返回后继续执行同一个块。
+ */
+static intptr_t __branch_target(const uint32_t ins, const intptr_t i)
+{
+    int64_t offset;
+    if ((ins & 0xfc000000u) == 0x14000000u) {
+        offset = static_cast<int32_t>(ins << 6) >> 6;
+    } else if ((ins & 0xff000010u) == 0x54000000u || (ins & 0x7e000000u) == 0x34000000u) {
+        offset = static_cast<int32_t>(ins << 8) >> 13;
+    } else if ((ins & 0x7e000000u) == 0x36000000u) {
+        offset = static_cast<int32_t>(ins << 13) >> 18;
+    } else {
+        return -1;
     }
+    return i + static_cast<intptr_t>(offset);
+}
 
-    //-------------------------------------------------------------------------
+/*
+ * __find_blocks: 划分基本块, blocks[i] 为第 i 条指令所在块的编号(块的开头)或 -1
+ *
+ * 块从函数入口、函数内分支的目标和分支(含 BR/RET)之后的指令开始。LDXR 到 STXR 之间
+ * 不开始新的块, 插入的访存会清除独占监视器, 使 STXR 一直失败。
+ *
+ * @return: 基本块数量
+ */
+static int32_t __find_blocks(const uint32_t *insns, const int32_t count, int32_t *blocks)
+{
+    for (int32_t i = 0; i < count; ++i) blocks[i] = -1;
+    blocks[0] = 0;
+    for (int32_t i = 0; i < count; ++i) {
+        const uint32_t ins    = insns[i];
+        const intptr_t target = __branch_target(ins, i);
+        if (target >= 0 && target < count) blocks[target] = 0;
+        if ((target != -1 || (ins & 0xffbffc1fu) == 0xd61f0000u) && i + 1 < count) blocks[i + 1] = 0;
+    }
 
-    /*
-     * A64HookFunction: 使用内置跳板池的 Hook 接口
-     *
-     * 这是面向用户的主要接口。它自动从跳板池分配槽位, 简化了使用流程。
-     *
-     * @param symbol:  要 Hook 的目标函数
-     * @param replace: 替换函数
-     * @param result:  输出参数, 返回跳板地址用于调用原函数。传 NULL 表示不需要调用原函数。
-     */
-    A64_JNIEXPORT void A64HookFunction(void *const symbol, void *const replace, void **result)
-    {
-        void *trampoline = NULL;
+    int32_t n = 0;
+    bool    exclusive = false;
+    for (int32_t i = 0; i < count; ++i) {
+        if (blocks[i] == 0 && !exclusive) blocks[i] = n++;
+        else blocks[i] = -1;
+        if ((insns[i] & 0x3fc00000u) == 0x08400000u) exclusive = true;        // LDXR / LDAXR / LDXP ...
+        else if ((insns[i] & 0x3fc00000u) == 0x08000000u) exclusive = false;  // STXR / STLXR / STXP ...
+    }
+    return n;
+}
 
-        if (result != NULL) {
-            // 用户需要调用原函数, 分配跳板
-            trampoline = FastAllocateTrampoline();
-            *result = trampoline;
-            if (trampoline == NULL) return;  // 分配失败
+/*
+ * A64HookBlocks: 把整个函数重写到片段区域, 在每个基本块的开头插入计数代码, 再把入口改写为跳到重写后的函数
+ *
+ * 区域布局:
+ *   counters[blocks]    每个块的执行次数
+ *   offsets[blocks]     每个块在原函数中的字节偏移
+ *   重写后的函数, 末尾跳回原函数的 symbol + size
+ *   被覆盖的入口指令的跳板(__hook_function)
+ *
+ * 修复分两遍: 第一遍得到每条指令(含插入的计数代码)的位置, 第二遍在相同的位置按这些位置直接回填
+ * 向后的引用。函数外的引用与入口跳板一样修复, 必要时扩展为绝对地址。
+ */
+A64_JNIEXPORT int A64HookBlocks(void *const symbol, size_t size, A64BlockProfile *out)
+{
+    if (symbol == NULL || out == NULL || ((__uintval(symbol) | size) & 3u) != 0u ||
+        size == 0u || size > A64_MAX_REWRITE_WORDS * sizeof(uint32_t)) {
+        A64_LOGE("invalid function %p (%zu bytes) to rewrite!", symbol, size);
+        return -1;
+    }
+
+    uint32_t *const insns = static_cast<uint32_t *>(symbol);
+    const int32_t   count = static_cast<int32_t>(size / sizeof(uint32_t));
+
+    A64InstallStats st = {};
+    uint64_t        t0 = __read_cntvct();
+    A64HookStatsEntry *entry = __registry_alloc();
+    if (entry == NULL) return __install_commit(&st, false), -1;
+
+    int32_t             *blocks = static_cast<int32_t *>(malloc(static_cast<size_t>(count) * sizeof(int32_t)));
+    uint64_t            *layout = static_cast<uint64_t *>(malloc(static_cast<size_t>(count) * sizeof(uint64_t)));
+    context::insns_info *dat    = static_cast<context::insns_info *>(malloc(static_cast<size_t>(count) * sizeof(context::insns_info)));
+    if (blocks == NULL || layout == NULL || dat == NULL) {
+        free(blocks), free(layout), free(dat);
+        return __registry_release(entry), __install_commit(&st, false), -1;
+    }
+
+    const int32_t   nblocks = __find_blocks(insns, count, blocks);
+    const uintptr_t header  = __align_up(static_cast<uintptr_t>(nblocks) * (sizeof(uint64_t) + sizeof(uint32_t)), 16u);
+    const uintptr_t bound   = header + __fix_bound(count) + 9u * sizeof(uint32_t) * static_cast<uintptr_t>(nblocks) +
+                              __trampoline_bound(A64_MAX_INSTRUCTIONS);
+
+    pthread_mutex_lock(&__snippet_lock);
+    uint32_t *const base = __snippet_reserve(symbol, bound);
+    st.phase_ns[A64_PHASE_ALLOC] = __read_cntvct() - t0;
+    void *trampoline = NULL;
+    if (base != NULL) {
+        uint64_t *counters = reinterpret_cast<uint64_t *>(base);
+        uint32_t *offsets  = reinterpret_cast<uint32_t *>(counters + nblocks);
+        uint32_t *code     = reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(base) + header);
+        memset(counters, 0, static_cast<size_t>(nblocks) * sizeof(uint64_t));
+        for (int32_t i = 0; i < count; ++i) {
+            if (blocks[i] >= 0) offsets[blocks[i]] = static_cast<uint32_t>(i) * sizeof(uint32_t);
         }
 
-        /*
-         * Android 10 及以上版本的兼容性处理
-         *
-         * 从 Android 10 开始, 系统默认将 .text 段映射为只读+可执行(R-X),
-         * 不再是之前的可读+可写+可执行(RWX)。这是一个安全加固措施。
-         *
-         * 因此在修改原函数入口之前, 需要先调用 mprotect 添加写权限。
-         * 这里预先调用一次 __make_rwx 确保后续的写入操作能成功。
-         *
-         * 注意: 5 * sizeof(size_t) = 40 字节, 比实际需要的稍大一些, 以确保覆盖。
-         */
-        __make_rwx(symbol, 5 * sizeof(size_t));
+        context ctx;
+        ctx.dat      = dat;
+        ctx.in_bias  = 0;
+        ctx.out_bias = 0;
+        ctx.src      = NULL;
+        ctx.blocks   = blocks;
+        ctx.counters = counters;
+        ctx.lse      = __cpu_has(A64_CPU_LSE);
 
-        trampoline = A64HookFunctionV(symbol, replace, trampoline, A64_MAX_INSTRUCTIONS * 10u);
+        t0 = __read_cntvct();
+        const uintptr_t bytes = __relocate(ctx, insns, count, code, NULL);
+        for (int32_t i = 0; i < count; ++i) layout[i] = dat[i].insu;
+        ctx.layout = layout;
+        if (bytes <= __rewrite_max_bytes && __relocate(ctx, insns, count, code, NULL) == bytes && !ctx.failed) {
+            st.phase_ns[A64_PHASE_RELOCATE] += __read_cntvct() - t0;
 
-        if (trampoline == NULL && result != NULL) {
-            *result = NULL;  // Hook 失败, 清空结果
+            t0 = __read_cntvct();
+            __flush_cache(code, bytes);
+            st.phase_ns[A64_PHASE_FLUSH] += __read_cntvct() - t0;
+
+            trampoline = __hook_function(symbol, code, code + bytes / sizeof(uint32_t), __trampoline_bound(A64_MAX_INSTRUCTIONS), entry, &st);
+        } else {
+            A64_LOGE("function %p (%zu bytes) cannot be rewritten!", symbol, size);
+            __install_commit(&st, false);
         }
+
+        if (trampoline != NULL) {
+            const uintptr_t used = __align_up(header + bytes + st.trampoline_bytes, 16u);
+            __snippet_pos += used;
+            __store_release(&__snippet_used, __snippet_used + used);
+
+            out->symbol   = __uintval(symbol);
+            out->size     = static_cast<uint32_t>(size);
+            out->blocks   = static_cast<uint32_t>(nblocks);
+            out->offsets  = offsets;
+            out->counters = counters;
+        }
+    } else {
+        __install_commit(&st, false);
+    }
+    pthread_mutex_unlock(&__snippet_lock);
+
+    free(blocks), free(layout), free(dat);
+    if (trampoline == NULL) return __registry_release(entry), -1;
+    return static_cast<int>(entry->id);
+}
+
+//-------------------------------------------------------------------------
+
+/*
+ * A64GetMemoryStats: 汇总各个内存池和按需分配的线程数据
+ *
+ * 池的分配计数可能超过容量(分配失败时也会递增), 这里按容量截断。
+ */
+A64_JNIEXPORT void A64GetMemoryStats(A64MemoryStats *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    const intptr_t slots  = __load_acquire(&__insns_index) + 1;
+    const intptr_t probes = __load_acquire(&__probe_count);
+    out->trampoline_committed = sizeof(__insns_pool);
+    out->trampoline_used      = sizeof(__insns_pool[0]) * static_cast<uint64_t>(slots < __countof(__insns_pool) ? slots : __countof(__insns_pool));
+    out->stub_committed       = sizeof(__probe_records);
+    out->stub_used            = sizeof(__probe_records[0]) * static_cast<uint64_t>(probes < __countof(__probe_records) ? probes : __countof(__probe_records));
+
+    if (__stats != NULL) {
+        out->hooks              = __load_acquire(&__stats->count);
+        out->registry_committed = __stats_size;
+        out->registry_used      = __stats->header_size + static_cast<uint64_t>(out->hooks) * __stats->entry_size;
+    }
+
+    for (const coverage_arena *a = __load_acquire(&__coverage_arenas); a != NULL; a = a->next) {
+        out->coverage_committed += __coverage_arena_size;
+        out->coverage_sites     += __load_acquire(&a->used);
+    }
+
+    for (const stub_arena *a = __load_acquire(&__stub_arenas); a != NULL; a = a->next) {
+        out->arena_committed += __stub_arena_size;
+        out->arena_used      += sizeof(stub_arena) + __load_acquire(&a->used);
+        out->arena_sites     += __load_acquire(&a->sites);
+    }
+
+    out->snippet_committed = __load_acquire(&__snippet_committed);
+    out->snippet_used      = __load_acquire(&__snippet_used);
+
+    for (thread_block *tb = __load_acquire(&__thread_blocks); tb != NULL; tb = tb->next) {
+        ++out->threads;
+        out->thread_bytes += sizeof(thread_block);
+        if (__load_acquire(&tb->ring) != NULL) out->trace_bytes += sizeof(trace_ring);
+        if (__load_acquire(&tb->profile) != NULL) out->profile_bytes += sizeof(profile_table);
     }
 }
 
 #endif // defined(__aarch64__)
+
+#endif // defined(__aarch64__) || defined(A64_HOST_RELOCATOR)
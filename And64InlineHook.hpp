@@ -28,6 +28,9 @@
  */
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
+
 /*
  * A64_MAX_BACKUPS: 定义最大可同时 Hook 的函数数量
  *
@@ -40,10 +43,37 @@
  */
 #define A64_MAX_BACKUPS 256
 
+/*
+ * A64_MAX_HOOKS: Hook 注册表的容量
+ *
+ * 每个通过 A64HookFunction / A64HookFunctionV / A64ProbeFunction 安装的 Hook
+ * 都会在注册表中占用一个条目(A64HookStatsEntry, 544 字节), 条目下标即 hook id。
+ * 注册表按需提交物理内存, 未使用的条目不占用 RSS。注册表已满时普通 Hook 仍可安装,
+ * 只是不再被记录; 探针则会安装失败。
+ */
+#define A64_MAX_HOOKS 4096
+
+/*
+ * A64_LOG_INFO / A64_LOG_ERROR: 日志优先级, 取值与 Android 的 ANDROID_LOG_INFO / ANDROID_LOG_ERROR 相同
+ */
+#define A64_LOG_INFO  4
+#define A64_LOG_ERROR 6
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+    /*
+     * A64LogWrite: 自定义日志输出(仅在以 A64_LOG_SINK=3 编译时使用)
+     *
+     * 由使用者实现, 库内部的所有日志都会转发到这里。可能在任意线程、持有内部锁
+     * 的情况下被调用, 实现中不要再调用本库的 API。
+     *
+     * @param prio: A64_LOG_INFO 或 A64_LOG_ERROR
+     * @param fmt:  printf 风格的格式字符串, 不带换行
+     */
+    void A64LogWrite(int prio, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
     /*
      * A64HookFunction - ARM64 内联 Hook 的主要接口
      *
@@ -82,12 +112,703 @@ extern "C" {
      *   - 需要精确控制跳板内存的位置(例如需要在特定地址范围内)
      *   - 需要在 Hook 之后释放跳板内存
      *
-     * 注意: rwx 必须是具有执行权限的内存, 且大小至少为 count * 10 * sizeof(uint32_t)
-     * 其中 count 是被覆盖的指令数量(通常为 4 或 5)。
+     * 注意: rwx 必须是具有执行权限的内存, 且大小至少为 (9 * count + 5) * sizeof(uint32_t)
+     * 其中 count 是被覆盖的指令数量(近跳转为 1, 远跳转为 4 或 5), 200 字节总是足够。
      */
     void *A64HookFunctionV(void *const symbol, void *const replace,
                            void *const rwx, const uintptr_t rwx_size);
 
+    /*
+     * A64HookFunctionVX - 跳板的写入地址和执行地址分离的 A64HookFunctionV
+     *
+     * @param symbol:  目标函数地址
+     * @param replace: 替换函数地址
+     * @param rw:      跳板的写入地址(可读/可写)
+     * @param rx:      同一块内存的执行地址(可读/可执行), 与 rw 的低 3 位必须相同
+     * @param size:    跳板缓冲区的大小(字节), 要求与 A64HookFunctionV 相同
+     * @return:        成功返回跳板的执行地址(位于 rx), 失败返回 NULL
+     *
+     * 用于双映射的代码缓存(例如同一个 memfd 分别映射为 RW 和 RX): 跳板只通过 rw 写入,
+     * 修复 PC 相对指令时按 rx 计算偏移, 跳板内存不需要 RWX 权限, 也不需要切换保护属性。
+     * rx 必须可读: 缓存刷新和 A64HookDescribe 通过 rx 读取跳板。
+     * 目标函数入口的改写方式不变, 仍然通过 mprotect 临时修改权限。
+     */
+    void *A64HookFunctionVX(void *const symbol, void *const replace,
+                            void *const rw, void *const rx, const uintptr_t size);
+
+    /*
+     * A64TrapHookFunction - 只改写入口的一条指令, 用于太短而无法安全改写的函数
+     *
+     * @param symbol:  目标函数地址
+     * @param replace: 替换函数地址, 距离不受限制
+     * @param result:  与 A64HookFunction 相同, 返回用于调用原函数的跳板, 可以为 NULL
+     * @return:        成功返回 hook id, 失败返回 -1
+     *
+     * 远跳转需要覆盖 16~20 字节, 只有 2~3 条指令的函数(例如 getter)会被覆盖到下一个函数。
+     * 这里入口只写入一条 BRK 指令, 执行到它时产生 SIGTRAP, 处理函数在安装时构建的最小完美哈希表中
+     * 按 PC 查找 Hook(O(1), 无锁), 把 PC 改为替换函数后返回; 被覆盖的那条指令和普通 Hook 一样
+     * 修复到跳板中。每次调用都要经过一次信号处理, 只适合调用不频繁的函数。
+     *
+     * 会安装进程级的 SIGTRAP 处理函数, 不属于本库的 SIGTRAP 转交给之前的处理函数。
+     * 最多 A64_MAX_TRAPS(1024) 个, 同一个函数只能安装一次。
+     */
+    int A64TrapHookFunction(void *const symbol, void *const replace, void **result);
+
+    /*
+     * A64HookInjectSnippet - 在目标函数入口处内联执行一段代码, 然后继续执行原函数
+     *
+     * @param symbol:   目标函数地址
+     * @param code:     代码片段, 位置无关的 AArch64 指令, 4 字节对齐
+     * @param len:      片段字节数, 4 的倍数, 最多 A64_MAX_SNIPPET_WORDS(64) 条指令
+     * @param clobbers: 片段会修改的通用寄存器, 第 n 位对应 Xn
+     * @return:         成功返回 hook id, 失败返回 -1
+     *
+     * 片段被复制到跳板中, 紧接在修复后的被覆盖指令之前, 与 A64HookFunction 相比没有
+     * 替换函数的调用和返回, 适合计数、打标记之类只有几条指令的逻辑。片段中的分支和字面量
+     * 按它在 code 处的地址修复; ADR/ADRP 和片段之外的分支仍指向原来的地址, 因此 code 之外
+     * 被引用的数据要一直有效。
+     *
+     * 片段的约定:
+     *   - 从末尾顺序执行出去, 或者跳到片段末尾(code + len); 不能 RET, 也不能跳出片段不再回来
+     *   - X9~X17 和 NZCV 可以直接使用; clobbers 中的 X0~X8、X18~X30 由库保存和恢复,
+     *     有寄存器需要保存时 SP 比函数入口低 16~192 字节, 片段可以继续使用 SP 以下的栈
+     *   - 不保存 SIMD/浮点寄存器, 片段需要自己保存用到的 V0~V7 和 V8~V15 的低 64 位
+     *   - 片段中调用其他函数(BL)时要在 clobbers 中包含 X30 和调用会修改的寄存器
+     *
+     * A64HookSetEnabled 可以停用片段, 停用后入口直接跳到修复后的被覆盖指令。
+     */
+    int A64HookInjectSnippet(void *const symbol, const void *code, size_t len, uint32_t clobbers);
+
+    /*
+     * A64HookClosure - 安装一个携带私有数据的 Hook, 多个 Hook 可以共用同一个处理函数
+     *
+     * @param symbol:  目标函数地址
+     * @param handler: 共享的处理函数, 签名是在目标函数的参数前加一个 void *data
+     * @param data:    本 Hook 的私有数据, 作为 handler 的第一个参数传入
+     * @param result:  与 A64HookFunction 相同, 返回用于调用原函数的跳板, 可以为 NULL
+     * @return:        成功返回 hook id, 失败返回 -1
+     *
+     * 每个 Hook 生成一段 56 字节的转发代码: 把 X0-X6 后移一个寄存器, X0 = data, 然后跳到 handler。
+     * 浮点参数寄存器、栈和 LR 都保持调用者设置的值。因此目标函数的整数/指针参数(按值传递的
+     * 小结构体按所占的寄存器计)最多只能使用 X0-X6 共 7 个寄存器, X7 中的参数会丢失。
+     * C++ 中可以用 A64HookLambda 直接以带捕获的 lambda 作为替换函数。
+     */
+    int A64HookClosure(void *const symbol, void *const handler, void *data, void **result);
+
+    /*
+     * A64HookFind - 查找最近一次安装在 symbol 上的 Hook
+     *
+     * @return: hook id, 没有找到(或注册表已满时安装的 Hook)返回 -1
+     */
+    int A64HookFind(void *const symbol);
+
+    /*
+     * A64HookSetEnabled - 在其他线程继续调用目标函数的同时启用或停用 Hook
+     *
+     * @param hook_id: A64HookFind / A64ProbeFunction 返回的 hook id
+     * @param enabled: 非 0 启用, 0 停用
+     * @return:        成功返回 0, 失败返回 -1
+     *
+     * 每次切换只原子地改写入口处的一个 32 位字:
+     *   - 近跳转(B): 在 B 指令和原始的第一条指令之间切换
+     *   - 远跳转(LDR/BR): 停用时第一个字改为跳到跳板的 B 指令, 要求安装时有跳板
+     *     (A64HookFunction 的 result 不为 NULL, 或使用 A64HookFunctionV)且跳板
+     *     距离目标在 +/-128MB 以内, 否则返回 -1
+     *   - 陷阱(BRK): 在 BRK 和原始的第一条指令之间切换
+     * 只有入口仍是本 Hook 写入的内容时才能切换, 入口被之后安装的 Hook 覆盖后返回 -1。
+     */
+    int A64HookSetEnabled(int hook_id, int enabled);
+
+    /*
+     * A64UnhookFunction - 永久停用 Hook
+     *
+     * 相当于 A64HookSetEnabled(hook_id, 0) 并标记为 A64_HOOK_REMOVED, 之后不能再启用。
+     * 其他线程可能仍在替换函数或跳板中执行, 因此跳板不会被回收; 远跳转的入口
+     * 保持 "B 跳板" 的形式, 不会恢复全部原始指令。
+     */
+    int A64UnhookFunction(int hook_id);
+
+    /*
+     * A64HookDescribe - 输出一个 Hook 实际生成的代码, 用于排查异常的 Hook
+     *
+     * @param hook_id: A64HookFind / A64ProbeFunction 返回的 hook id
+     * @param buf:     输出缓冲区, 总是以 '\0' 结尾(len 为 0 时可以为 NULL)
+     * @param len:     buf 的字节数
+     * @return:        与 snprintf 相同, 返回完整描述的长度(不含 '\0'), 大于等于 len 表示被截断;
+     *                 hook id 无效返回 -1
+     *
+     * 描述包括:
+     *   - 入口当前的补丁字和被覆盖的原始指令
+     *   - 跳板的每个字, 附带修复器会生成的几类指令(B/BL/B.cond/CBZ/TBZ/LDR literal/ADR/ADRP/BR/NOP)
+     *     的反汇编, 其他指令输出为 .inst; 内联的字面量按 .word/.quad 输出, 引用它们的 LDR 后附上加载的值
+     *   - 每条原始指令修复后在跳板中的位置([i] 标在对应的字前, [>] 是跳回原函数的指令序列)
+     *   - 膨胀率, 即跳板字节数 / 被覆盖的字节数
+     */
+    int A64HookDescribe(int hook_id, char *buf, size_t len);
+
+    /*
+     * Hook 统计信息的共享内存布局
+     *
+     * 注册表本身就存放在一块可以导出为共享内存的区域中: 一个 A64HookStats 头部,
+     * 随后是 capacity 个 A64HookStatsEntry(位于 header_size + i * entry_size 处)。
+     * 外部采集进程 mmap 同一个文件后即可直接读取, 不需要任何系统调用或 IPC。
+     *
+     * 并发约定:
+     *   - 元数据(symbol 到 flags, name)由每个条目自己的 seqlock(seq)保护,
+     *     seq 为 0 表示条目尚未写入, 为奇数表示正在更新, 读取方式见 A64StatsReadEntry
+     *   - 计数器(calls, total_ticks, hist)只增不减, 由被 Hook 的线程以原子加更新,
+     *     读取方可以直接读取, 不受 seqlock 保护
+     *   - 头部的 generation 在任何条目的元数据变化后递增, 采集方可据此判断是否需要重新读取
+     */
+#define A64_STATS_MAGIC         "A64STATS"
+#define A64_STATS_VERSION       2u
+#define A64_STATS_HIST_BUCKETS  32   // 耗时直方图的桶数, 第 i 个桶统计耗时在 [2^i, 2^(i+1)) 个计数周期内的调用
+
+    /*
+     * A64_PATCH_*: 目标函数入口的改写方式(A64HookStatsEntry::patch_shape)
+     */
+#define A64_PATCH_NEAR          1u   // 单条 B 指令, 覆盖 4 字节
+#define A64_PATCH_FAR           2u   // [NOP +] LDR X17 + BR X17 + 64 位地址, 覆盖 16 或 20 字节
+#define A64_PATCH_TRAP          3u   // 单条 BRK, 由 SIGTRAP 处理函数转到替换函数, 见 A64TrapHookFunction
+
+    /*
+     * A64_HOOK_*: 条目的状态标志(A64HookStatsEntry::flags), 与 A64_PROBE_* 共用同一个字段
+     */
+#define A64_HOOK_ENABLED        0x80000000u  // Hook 已生效
+#define A64_HOOK_PROBE          0x40000000u  // 该条目是探针(A64ProbeFunction)
+#define A64_HOOK_REMOVED        0x20000000u  // 已通过 A64UnhookFunction 永久停用
+
+    /*
+     * Hook 安装遥测(Telemetry)
+     *
+     * 每次安装 Hook 都会按阶段计时, 并统计系统调用次数和被重定位指令的种类,
+     * 结果既写入该 Hook 的注册表条目(A64HookStatsEntry::install), 也累加到全局汇总中。
+     * 膨胀率 = trampoline_bytes / original_bytes。
+     *
+     * 计时基于 CNTVCT_EL0, 精度取决于计数频率(通常为 19.2MHz 到 1GHz)。
+     */
+#define A64_PHASE_ALLOC         0   // 分配跳板槽位、桩代码与注册表条目
+#define A64_PHASE_PROTECT       1   // mprotect 修改目标页权限
+#define A64_PHASE_RELOCATE      2   // __fix_instructions 修复原始指令(不含缓存刷新)
+#define A64_PHASE_PATCH         3   // 改写目标函数入口
+#define A64_PHASE_FLUSH         4   // 刷新跳板和目标函数入口的指令缓存
+#define A64_PHASE_COUNT         5
+
+#define A64_RELOC_BRANCH        0   // B / BL
+#define A64_RELOC_COND          1   // B.cond / CBZ / CBNZ / TBZ / TBNZ
+#define A64_RELOC_LITERAL       2   // LDR / LDRSW / PRFM (literal)
+#define A64_RELOC_PCREL         3   // ADR / ADRP
+#define A64_RELOC_COPY          4   // 与 PC 无关, 原样复制
+#define A64_RELOC_KINDS         5
+
+    typedef struct A64InstallStats
+    {
+        uint64_t hooks;                         // 成功安装的 Hook 数量(单个 Hook 为 1)
+        uint64_t failures;                      // 安装失败的次数(仅全局汇总)
+        uint64_t phase_ns[A64_PHASE_COUNT];     // 各阶段耗时(纳秒)
+        uint64_t syscalls;                      // 系统调用次数(mprotect)
+        uint64_t relocated[A64_RELOC_KINDS];    // 各类被重定位的指令数量
+        uint64_t expanded[A64_RELOC_KINDS];     // 其中因超出范围等原因展开为多条指令的数量
+        uint64_t original_bytes;                // 被重定位的原始指令字节数
+        uint64_t trampoline_bytes;              // 跳板实际使用的字节数
+    } A64InstallStats;
+
+    typedef struct A64HookStatsEntry
+    {
+        uint32_t seq;              // 条目的 seqlock 序号
+        uint32_t id;               // hook id, 即条目下标
+        uint64_t symbol;           // 目标函数地址
+        uint64_t replace;          // 替换函数地址(探针为它的数据块地址, 见 A64ProbeFunction)
+        uint64_t trampoline;       // 跳板地址, 0 表示没有跳板
+        uint32_t patch_shape;      // A64_PATCH_*
+        uint32_t patch_size;       // 目标函数入口被覆盖的字节数
+        uint32_t trampoline_size;  // 跳板实际使用的字节数
+        uint32_t flags;            // A64_HOOK_* | A64_PROBE_*
+        char     name[64];         // 名称(探针名), 以 '\0' 结尾, 可能被截断
+        uint64_t calls;            // 调用次数(仅探针)
+        uint64_t total_ticks;      // 累计耗时, 单位为 CNTVCT_EL0 计数(仅探针)
+        uint64_t hist[A64_STATS_HIST_BUCKETS];  // 耗时直方图(仅探针)
+        A64InstallStats install;   // 安装遥测, 受 seqlock 保护
+    } A64HookStatsEntry;
+
+    typedef struct A64HookStats
+    {
+        char     magic[8];      // A64_STATS_MAGIC, 不含结尾的 '\0'
+        uint32_t version;       // A64_STATS_VERSION
+        uint32_t header_size;   // 第一个条目相对头部的偏移
+        uint32_t entry_size;    // sizeof(A64HookStatsEntry)
+        uint32_t capacity;      // 条目总数, 即 A64_MAX_HOOKS
+        uint32_t count;         // 已分配的条目数量(单调递增, 不超过 capacity)
+        uint32_t generation;    // 元数据变化计数
+        uint64_t counter_freq;  // CNTFRQ_EL0, total_ticks 与 hist 的计数频率(Hz)
+        uint64_t reserved[3];
+    } A64HookStats;
+
+    /*
+     * A64StatsEntryAt - 取得第 index 个条目的地址(进程内或外部映射均可使用)
+     */
+    static inline const A64HookStatsEntry *A64StatsEntryAt(const A64HookStats *stats, uint32_t index)
+    {
+        return (const A64HookStatsEntry *)((const char *)stats + stats->header_size + (size_t)index * stats->entry_size);
+    }
+
+    /*
+     * A64StatsReadEntry - 按 seqlock 协议读取一个条目的一致快照
+     *
+     * @return: 读取成功返回 1; 条目尚未写入或持续处于更新中返回 0
+     */
+    static inline int A64StatsReadEntry(const A64HookStats *stats, uint32_t index, A64HookStatsEntry *out)
+    {
+        const A64HookStatsEntry *e = A64StatsEntryAt(stats, index);
+        int retry;
+        for (retry = 0; retry < 64; ++retry) {
+            const uint32_t s0 = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+            if (s0 == 0u) return 0;
+            if ((s0 & 1u) != 0u) continue;
+            memcpy(out, e, sizeof(*out));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == s0) return 1;
+        }
+        return 0;
+    }
+
+    /*
+     * A64StatsGet - 返回进程内的注册表/统计区域, 尚未安装过任何 Hook 时返回 NULL
+     */
+    const A64HookStats *A64StatsGet(void);
+
+    /*
+     * A64StatsExport - 把注册表/统计区域导出为共享内存
+     *
+     * @param path: 共享文件路径(例如 Linux 上的 /dev/shm/xxx), 传入 NULL 则使用 memfd
+     * @return:     成功返回文件描述符, 失败返回 -1。重复调用返回第一次导出的描述符
+     *
+     * 导出时会把当前内容复制到共享文件, 然后在原地址上以 MAP_FIXED 重新映射,
+     * 之后所有的更新都直接写入共享内存, 热路径上没有额外开销。导出期间 Hook 的安装和
+     * 切换会等待导出完成, 元数据不会丢失; 只有导出瞬间正在进行的调用计数更新可能会丢失。memfd 的描述符可以通过 Binder/Unix Socket 传递给采集进程,
+     * 或由有权限的进程通过 /proc/<pid>/fd/<fd> 打开。
+     */
+    int A64StatsExport(const char *path);
+
+    /*
+     * A64GetInstallStats - 读取所有 Hook 安装遥测的全局汇总
+     */
+    void A64GetInstallStats(A64InstallStats *out);
+
+    /*
+     * A64GetHookInstallStats - 读取单个 Hook 的安装遥测
+     *
+     * @return: 成功返回 0, hook id 无效或条目不可用返回 -1
+     */
+    int A64GetHookInstallStats(int hook_id, A64InstallStats *out);
+
+    /*
+     * A64_PROBE_*: 探针(Probe)功能标志, 用于 A64ProbeFunction 的 flags 参数
+     *
+     * 探针与普通 Hook 的区别在于: 探针不需要用户提供替换函数, 而是由库生成一段
+     * 入口/出口桩代码(Stub), 在原函数执行前后回调库内部的记录逻辑, 然后照常
+     * 执行原函数。探针的 hook id 就是它在注册表中的条目下标。
+     *
+     *   A64_PROBE_TRACE:  将每次调用的 (hook id, 时间戳, X0-X3, 返回值) 写入调用追踪
+     *   A64_PROBE_MARKER: 在函数入口/出口向 ftrace trace_marker 写入 atrace 格式的
+     *                     "B|pid|name" / "E|pid" 切片标记, 见 A64MarkerStart
+     *   A64_PROBE_PROFILE: 把调用计入每个线程的调用上下文树(由带有该标志的探针组成的
+     *                     调用栈), 统计包含/不包含子调用的耗时, 见 A64ProfileDump
+     */
+#define A64_PROBE_TRACE         0x00000001u
+#define A64_PROBE_MARKER        0x00000002u
+#define A64_PROBE_PROFILE       0x00000004u
+
+    /*
+     * A64ProbeFunction - 在目标函数上安装入口/出口探针
+     *
+     * @param symbol: 目标函数地址
+     * @param name:   探针名称(通常为符号名), 会写入追踪文件的名称表, 可以为 NULL。
+     *                库只保存该指针, 调用者需保证其生命周期
+     * @param flags:  A64_PROBE_* 标志的组合
+     * @param result: 输出参数, 返回跳板地址(可用于绕过探针直接调用原函数), 可以为 NULL
+     * @return:       成功返回 hook id(>= 0, 即注册表条目下标), 失败返回 -1
+     *
+     * 探针的数量受 A64_MAX_BACKUPS 限制(每个探针占用一个探针描述),
+     * 同时需要一个空闲的注册表条目。桩代码由所有探针共用, 每个探针只占用共享桩代码区域中
+     * 24 字节的数据块和实际大小的跳板(计入 A64MemoryStats::arena_*); 区域映射在目标函数
+     * 附近时入口只改写一条 B 指令。
+     *
+     * 出口探针把被探测函数的返回地址改写为桩代码区域中的地址, 该区域没有展开信息(FDE):
+     *   - longjmp/siglongjmp 跳出被探测的函数是安全的, 被跳过的调用不会产生出口记录;
+     *   - C++ 异常不能穿过被探测的函数传播, 展开器遇到桩代码地址时会调用 std::terminate。
+     *     可能有异常穿过的函数不要使用探针。
+     */
+    int A64ProbeFunction(void *const symbol, const char *name, uint32_t flags, void **result);
+
+    /*
+     * 调用追踪(Trace)文件格式
+     *
+     * 文件由一个 A64TraceFileHeader, 紧随其后的 record_count 个 A64TraceRecord,
+     * 以及位于 names_offset 处的名称表组成。名称表为文本格式, 每行一条:
+     *   "<hook id>\t<symbol 地址(十六进制)>\t<名称>\n"
+     *
+     * 时间戳为 CNTVCT_EL0 的原始计数值, 除以 counter_freq 即可换算为秒。
+     * 所有字段均为小端序, 与 AArch64 进程的内存布局一致, 解码工具见 tools/a64_trace_decode.cpp。
+     */
+#define A64_TRACE_MAGIC         "A64TRACE"
+#define A64_TRACE_VERSION       1u
+
+    typedef struct A64TraceRecord
+    {
+        uint32_t hook_id;   // A64ProbeFunction 返回的 hook id
+        uint32_t tid;       // 线程 id(gettid)
+        uint64_t enter_ts;  // 进入函数时的 CNTVCT_EL0
+        uint64_t leave_ts;  // 函数返回时的 CNTVCT_EL0
+        uint64_t args[4];   // 进入函数时的 X0-X3
+        uint64_t retval;    // 函数返回时的 X0
+    } A64TraceRecord;
+
+    typedef struct A64TraceFileHeader
+    {
+        char     magic[8];      // A64_TRACE_MAGIC, 不含结尾的 '\0'
+        uint32_t version;       // A64_TRACE_VERSION
+        uint32_t header_size;   // sizeof(A64TraceFileHeader)
+        uint32_t record_size;   // sizeof(A64TraceRecord)
+        uint32_t reserved;
+        uint64_t counter_freq;  // CNTFRQ_EL0, 时间戳的计数频率(Hz)
+        uint64_t record_count;  // 文件中有效记录的数量
+        uint64_t lost_count;    // 因线程缓冲区或文件已满而丢弃的记录数量
+        uint64_t names_offset;  // 名称表相对文件起始的偏移, 0 表示没有名称表
+        uint64_t names_size;    // 名称表的字节数
+    } A64TraceFileHeader;
+
+    /*
+     * A64TraceStart - 开始一次调用追踪会话
+     *
+     * @param path:      输出文件路径, 文件会被截断并通过 mmap 映射
+     * @param max_bytes: 文件头与记录区的最大字节数, 写满后新记录会被丢弃。
+     *                   名称表在 A64TraceStop 时追加到最后一条记录之后, 不占用该容量
+     * @return:          成功返回 0, 失败返回 -1(errno 包含错误码)
+     *
+     * 会话期间, 带有 A64_PROBE_TRACE 标志的探针会把记录写入各线程私有的
+     * 单生产者/单消费者环形缓冲区, 后台的 drainer 线程定期把它们批量写入文件。
+     * 同一时刻只能有一个追踪会话。
+     */
+    int A64TraceStart(const char *path, uint64_t max_bytes);
+
+    /*
+     * A64TraceStop - 结束当前的追踪会话
+     *
+     * 停止 drainer 线程, 写入剩余记录和名称表, 并把文件截断为实际大小。
+     */
+    void A64TraceStop(void);
+
+    /*
+     * A64MarkerStart - 打开 trace_marker, 开始为 A64_PROBE_MARKER 探针输出切片标记
+     *
+     * @param fallback_path: tracefs 不可用(未挂载或没有权限)时使用的文件路径, 可以为 NULL。
+     *                       文件中每行为 "<CNTVCT_EL0> <tid> B|pid|name" 或 "<CNTVCT_EL0> <tid> E|pid"
+     * @return:              写入 trace_marker 返回 0, 写入备用文件返回 1, 失败返回 -1
+     *
+     * 依次尝试 /sys/kernel/tracing/trace_marker 和 /sys/kernel/debug/tracing/trace_marker。
+     * 标记与内核调度事件出现在同一份系统追踪(systrace/perfetto)中。
+     */
+    int A64MarkerStart(const char *fallback_path);
+
+    /*
+     * A64MarkerStop - 停止输出切片标记并关闭 trace_marker 或备用文件
+     *
+     * 停止时尚未返回的函数的切片不会再输出 "E", 也不会在下一次 A64MarkerStart 之后补上。
+     */
+    void A64MarkerStop(void);
+
+    /*
+     * A64ProbeSetMarkerLimit - 设置探针输出切片标记的采样率和速率上限
+     *
+     * @param hook_id:        A64ProbeFunction 返回的 hook id
+     * @param sample_every:   每 N 次调用输出一次切片, 0 视为 1
+     * @param max_per_second: 每秒最多输出的切片数量, 0 表示不输出
+     * @return:               成功返回 0, hook id 无效返回 -1
+     *
+     * 每个切片需要两次 write 系统调用, 默认每个探针每秒最多 A64_MARKER_MAX_PER_SEC 个切片。
+     */
+#define A64_MARKER_MAX_PER_SEC  1000u
+    int A64ProbeSetMarkerLimit(int hook_id, uint32_t sample_every, uint32_t max_per_second);
+
+    /*
+     * A64_PROFILE_*: A64ProfileDump 输出的数值
+     */
+#define A64_PROFILE_EXCLUSIVE   0u   // 不包含子调用的耗时(纳秒), 适合直接生成火焰图
+#define A64_PROFILE_INCLUSIVE   1u   // 包含子调用的耗时(纳秒)
+#define A64_PROFILE_CALLS       2u   // 调用次数
+
+    /*
+     * A64ProfileDump - 以火焰图 "folded" 格式输出所有线程合并后的调用栈
+     *
+     * @param fd:     输出的文件描述符
+     * @param metric: A64_PROFILE_* 之一
+     * @return:       成功返回输出的调用栈数量, 失败返回 -1
+     *
+     * 每行格式为 "name1;name2;...;nameN <value>", 名称取自探针名称, 没有名称的探针
+     * 输出为 "hook#<id>"。输出可直接交给 flamegraph.pl 或 speedscope 等工具。
+     * 可以在被探测线程运行期间调用, 得到的是近似一致的快照。
+     */
+    int A64ProfileDump(int fd, uint32_t metric);
+
+    /*
+     * A64ProfileReset - 清零所有线程的调用上下文计数, 调用上下文树本身保持不变
+     */
+    void A64ProfileReset(void);
+
+    /*
+     * A64MemoryStats: 本库自身占用的内存(字节), 用于评估每个 Hook 的内存开销
+     *
+     * committed 是已经预留(静态池或映射)的大小, used 是其中已分配出去的部分。
+     * 静态池在进程加载时即存在, 但只有被写入的页才会计入 RSS。
+     */
+    typedef struct A64MemoryStats
+    {
+        uint64_t trampoline_committed; // 跳板池(__insns_pool)大小
+        uint64_t trampoline_used;      // 已分配的跳板槽位
+        uint64_t stub_committed;       // 探针描述表大小
+        uint64_t stub_used;            // 已分配的探针描述
+        uint64_t registry_committed;   // 注册表映射大小(MAP_NORESERVE, 按需提交)
+        uint64_t registry_used;        // 注册表头部和已分配的条目
+        uint64_t thread_bytes;         // 线程块(含影子栈)
+        uint64_t trace_bytes;          // 追踪环形缓冲区
+        uint64_t profile_bytes;        // 调用上下文树
+        uint32_t hooks;                // 注册表中的 Hook 数量
+        uint32_t threads;              // 已分配的线程块数量
+        uint64_t coverage_committed;   // 覆盖率探针区域(A64CoverageInstall)
+        uint64_t coverage_sites;       // 已安装的覆盖率探针数量
+        uint64_t snippet_committed;    // 代码片段跳板和闭包转发代码的区域(A64HookInjectSnippet / A64HookClosure)
+        uint64_t snippet_used;         // 其中已分配的部分
+        uint64_t arena_committed;      // 共享桩代码区域(A64ProbeFunction / A64UniversalHook / A64SyscallHook)
+        uint64_t arena_used;           // 其中已分配的部分(桩代码、每个 Hook 的数据和跳板)
+        uint64_t arena_sites;          // 使用共享桩代码的 Hook 数量
+    } A64MemoryStats;
+
+    /*
+     * A64GetMemoryStats - 读取本库的内存占用
+     */
+    void A64GetMemoryStats(A64MemoryStats *out);
+
+    /*
+     * A64CoverageInstall - 批量安装一次性覆盖率探针, 用于找出哪些函数被执行过
+     *
+     * @param symbols: 函数地址数组
+     * @param count:   函数数量
+     * @param bitmap:  命中位图, 至少 (count + 63) / 64 个元素, 由调用者清零并一直保持有效;
+     *                 symbols[i] 第一次执行时原子地置位 bitmap[i / 64] 的第 i % 64 位
+     * @return:        成功安装的探针数量, 参数无效返回 -1
+     *
+     * 每个函数入口只改写为一条跳到转发代码的 B 指令。探针第一次被执行时记录命中,
+     * 并用一次原子存储恢复原始入口字, 之后的调用没有任何额外开销。不使用跳板池和
+     * 注册表, 因此不受 A64_MAX_BACKUPS / A64_MAX_HOOKS 的限制; 每个探针约占 32 字节,
+     * 映射在目标函数 +/-128MB 以内, 找不到这样的地址时跳过该函数。
+     * 记录命中的代码运行在被探测线程中, 不要对本库依赖的 libc 函数安装探针。
+     */
+    int A64CoverageInstall(void *const *symbols, int count, uint64_t *bitmap);
+
+    /*
+     * A64UniversalRegs: 通用处理函数看到的寄存器, 处理函数返回后写回, 可以用来修改参数
+     */
+    typedef struct A64UniversalRegs
+    {
+        uint64_t x[9];     // X0-X8
+        uint64_t lr;       // 返回地址
+        uint64_t q[8][2];  // Q0-Q7(浮点/向量参数), 每个 128 位
+    } A64UniversalRegs;
+
+    typedef void (*A64UniversalHandler)(uint32_t id, A64UniversalRegs *regs);
+
+    /*
+     * A64UniversalHook - 批量把函数交给同一个处理函数, 用于对大量函数做通用追踪
+     *
+     * @param symbols:  目标函数地址数组
+     * @param count:    函数数量
+     * @param handler:  处理函数, 每次调用 symbols[i] 时以 (first_id + i, 寄存器) 调用
+     * @param first_id: symbols[0] 的 id
+     * @return:         成功安装的数量, 参数无效时返回 -1
+     *
+     * 处理函数返回后恢复(可能被修改的)寄存器, 然后执行被覆盖的入口指令并继续执行原函数,
+     * 不需要为每个函数编写替换函数。所有 Hook 共用映射在目标函数 +/-128MB 以内的桩代码,
+     * 每个函数只改写入口的一条指令, 另外占用 32 字节数据和约 8 字节跳板。
+     * 与 A64CoverageInstall 一样不使用跳板池和注册表, 不受 A64_MAX_BACKUPS / A64_MAX_HOOKS 的限制,
+     * 也不能停用; 找不到附近的地址或入口正被其他线程改写时跳过该函数。
+     * 处理函数运行在被 Hook 的线程中, 不要在其中调用被 Hook 的函数。
+     */
+    int A64UniversalHook(void *const *symbols, int count, A64UniversalHandler handler, uint32_t first_id);
+
+    /*
+     * A64SyscallRegs: 系统调用处理函数看到的寄存器, x[0] ~ x[5] 是参数, x[8] 是系统调用号
+     */
+    typedef struct A64SyscallRegs
+    {
+        uint64_t x[9];  // X0-X8
+    } A64SyscallRegs;
+
+    /*
+     * A64SyscallHandler: pc 是被拦截的 SVC #0 的地址
+     *
+     * pre 在系统调用之前调用, 可以修改参数和系统调用号; 返回非 0 时跳过系统调用, 以 regs->x[0] 作为结果。
+     * post 在系统调用之后调用, regs->x[0] 是结果(失败时为 -errno), 可以修改。post 的返回值被忽略。
+     */
+    typedef int (*A64SyscallHandler)(uint64_t pc, A64SyscallRegs *regs);
+
+    /*
+     * A64SyscallHook - 拦截模块中直接发起系统调用的位置(libc 的系统调用封装函数等)
+     *
+     * @param module: 模块路径中包含的字符串, 例如 "libc.so"
+     * @param pre:    系统调用之前的处理函数, 可以为 NULL
+     * @param post:   系统调用之后的处理函数, 可以为 NULL(不能两者都为 NULL)
+     * @return:       成功拦截的位置数量, 参数无效时返回 -1
+     *
+     * 在模块的可执行段中查找 SVC #0 指令(每次比较 16 个字), 把每一条改写为跳到共享桩代码的 B 指令,
+     * 桩代码保存寄存器后调用处理函数并代为执行系统调用。每个位置占用 56 字节(计入 A64MemoryStats::arena_*),
+     * 不能停用。clone / clone3 / rt_sigreturn 必须在原位置执行, 不经过处理函数。
+     * 处理函数中发起的系统调用不会再次进入处理函数(按线程指针识别, 不依赖 TLS, 库被 dlopen 时同样有效);
+     * 同时在处理函数中的线程非常多(数百个)时, 个别系统调用可能直接执行而不经过处理函数。
+     * 按指令值查找, .text 中恰好等于 0xd4000001 的数据字也会被改写, 只对确认没有内嵌数据的模块使用。
+     */
+    int A64SyscallHook(const char *module, A64SyscallHandler pre, A64SyscallHandler post);
+
+    /*
+     * A64BlockProfile: A64HookBlocks 的结果, 数组位于本库的代码区域中, 一直有效
+     */
+    typedef struct A64BlockProfile
+    {
+        uint64_t        symbol;    // 函数地址
+        uint32_t        size;      // 函数字节数
+        uint32_t        blocks;    // 基本块数量
+        const uint32_t *offsets;   // 每个基本块的开头在函数中的字节偏移, 递增
+        const uint64_t *counters;  // 每个基本块的执行次数, 原子地递增
+    } A64BlockProfile;
+
+    /*
+     * A64HookBlocks - 重写整个函数, 统计每个基本块的执行次数
+     *
+     * @param symbol: 函数地址
+     * @param size:   函数字节数(通常取自符号表的 st_size), 最多 A64_MAX_REWRITE_WORDS 条指令
+     * @param out:    成功时写入基本块的偏移和计数器
+     * @return:       hook id, 失败返回 -1
+     *
+     * 函数被复制到片段区域, 分支目标和分支之后的指令开始新的基本块, 在块的开头插入一次原子加一
+     * (支持 LSE 时为 STADD, 否则为 LDXR/STXR 循环), 函数内外的 PC 相对引用都重新修复,
+     * 最后把入口改写为跳到重写后的函数。可以用 A64HookSetEnabled 暂停计数。
+     * 原函数保持不变: 通过跳转表(ADR 基址加偏移)的间接跳转回到原函数继续执行, 结果正确,
+     * 但这次调用之后的块不再计数。函数中内嵌的数据(字面量池)会被当作指令复制。
+     */
+    int A64HookBlocks(void *const symbol, size_t size, A64BlockProfile *out);
+
+    /*
+     * A64_CPU_*: 本库生成代码和改写入口时使用的 CPU 特性, 见 A64GetCpuFeatures
+     */
+#define A64_CPU_LSE             0x00000001u  // ARMv8.1 LSE 原子指令: CASAL 改写入口字, STADD 递增计数器
+#define A64_CPU_BTI             0x00000004u  // ARMv8.5 BTI: 跳板开头放一条 BTI c
+#define A64_CPU_PAC             0x00000008u  // ARMv8.3 PAC: 只检测和报告
+
+    /*
+     * A64GetCpuFeatures - 读取当前使用的 A64_CPU_* 特性
+     *
+     * 第一次调用本库的任何安装函数时通过 getauxval(AT_HWCAP / AT_HWCAP2) 检测, 之后不再改变。
+     */
+    uint32_t A64GetCpuFeatures(void);
+
+    /*
+     * A64SetCpuFeatures - 把使用的特性限制为 检测到的特性 & mask, 用于测试各个特性的 ARMv8.0 回退路径
+     *
+     * 只影响之后安装的 Hook; 不能启用 CPU 不支持的特性。
+     *
+     * @return: 新的 A64GetCpuFeatures()
+     */
+    uint32_t A64SetCpuFeatures(uint32_t mask);
+
+    /*
+     * A64RelocRequest: 离线指令修复的输入, 见 A64Relocate
+     */
+    typedef struct A64RelocRequest
+    {
+        const void *src;       // 源代码字节, 被修复的指令和它们引用的字面量都必须在其中(例如整个 .text 节)
+        uint64_t    src_size;  // src 的字节数
+        uint64_t    src_va;    // src[0] 的虚拟地址
+        uint64_t    pc;        // 第一条被修复指令的虚拟地址, 4 字节对齐, 位于 src 内
+        uint64_t    dst_va;    // 跳板将被放置的虚拟地址, 4 字节对齐
+        int32_t     count;     // 被修复的指令数, 1 ~ 5(近跳转补丁 1 条, 远跳转补丁 4 或 5 条)
+    } A64RelocRequest;
+
+#define A64_RELOC_MAX_BYTES     200  // 修复 5 条指令时跳板的最大字节数
+
+    /*
+     * A64Relocate - 在任意主机上修复一段 AArch64 指令, 不执行也不修改任何代码
+     *
+     * @param req:      输入, 见 A64RelocRequest
+     * @param out:      输出缓冲区, 写入放到 dst_va 处即可执行的跳板代码(小端序)
+     * @param out_size: out 的字节数, A64_RELOC_MAX_BYTES 总是足够
+     * @param map:      可以为 NULL, 否则需要 count + 1 个元素: map[i] 是第 i 条原始指令修复后在 out 中的字节偏移,
+     *                  map[count] 是跳回 pc + count * 4 的指令序列的偏移
+     * @return:         成功返回跳板的字节数; 参数无效、out 太小或引用的字面量不在 src 内时返回 -1
+     *
+     * 与 Hook 安装使用同一套修复逻辑, 在非 AArch64 主机上构建的库只包含这个函数。
+     */
+    intptr_t A64Relocate(const A64RelocRequest *req, void *out, size_t out_size, uint32_t *map);
+
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#if defined(__cplusplus) && defined(__aarch64__)
+#include <type_traits>
+#include <utility>
+
+/*
+ * A64ClosureGprs: 参数列表 A... 占用的通用寄存器数量的上界(AAPCS64)
+ *
+ * 浮点数使用浮点寄存器; 不超过 16 字节的结构体按大小占 1-2 个, 更大的按引用传递占 1 个。
+ * 由浮点数组成的小结构体(HFA)实际使用浮点寄存器, 这里按通用寄存器计, 只会偏保守。
+ */
+template <typename... A>
+struct A64ClosureGprs
+{
+    static constexpr unsigned value = 0u;
+};
+
+template <typename T, typename... A>
+struct A64ClosureGprs<T, A...>
+{
+    static constexpr unsigned value =
+        (std::is_floating_point<T>::value ? 0u
+         : (std::is_class<T>::value || std::is_union<T>::value) && sizeof(T) <= 16u ? (sizeof(T) + 7u) / 8u
+                                                                                     : 1u) +
+        A64ClosureGprs<A...>::value;
+};
+
+/*
+ * A64ClosureInvoke: A64HookLambda 使用的共享处理函数, 每种 lambda 类型和函数签名实例化一份
+ */
+template <typename F, typename R, typename... A>
+static R A64ClosureInvoke(void *data, A... args)
+{
+    return (*static_cast<F *>(data))(args...);
+}
+
+/*
+ * A64HookLambda - 以 lambda(可以带捕获)或其他函数对象替换 symbol
+ *
+ * @param symbol: 目标函数
+ * @param f:      替换函数对象, 调用签名与 symbol 相同; 复制到堆上, 与 Hook 一样不会被释放
+ * @param result: 与 A64HookFunction 相同, 返回用于调用原函数的跳板, 可以为 NULL
+ * @return:       成功返回 hook id, 失败返回 -1
+ *
+ * 函数对象作为 A64HookClosure 的 data, 因此捕获的状态就是每个 Hook 的私有数据。
+ * 参数个数的限制与 A64HookClosure 相同, 超出时编译失败。
+ */
+template <typename R, typename... A, typename F>
+static int A64HookLambda(R (*symbol)(A...), F &&f, R (**result)(A...) = NULL)
+{
+    static_assert(A64ClosureGprs<A...>::value <= 7u, "A64HookLambda: arguments must fit in X0-X6, see A64HookClosure");
+    typedef typename std::decay<F>::type functor;
+    functor *closure = new functor(std::forward<F>(f));
+    const int id = A64HookClosure(reinterpret_cast<void *>(symbol),
+                                  reinterpret_cast<void *>(&A64ClosureInvoke<functor, R, A...>),
+                                  closure, reinterpret_cast<void **>(result));
+    if (id < 0) delete closure;
+    return id;
+}
+#endif // defined(__cplusplus) && defined(__aarch64__)
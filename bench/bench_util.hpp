@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * bench_util: 基准测试共用的计时、代码生成和输出工具
+ *
+ * 计时使用 CNTVCT_EL0(用户态可读的虚拟计数器); 如果 perf_event_open 可用,
+ * 同时读取用户态 CPU 周期数。qemu-aarch64 下通常没有周期计数器, 此时只报告时间。
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static inline uint64_t bench_ticks()
+{
+    uint64_t v;
+    __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(v) : : "memory");
+    return v;
+}
+
+static inline uint64_t bench_freq()
+{
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(v));
+    return v;
+}
+
+static inline double bench_ticks_to_ns(const double ticks)
+{
+    static const double scale = 1e9 / static_cast<double>(bench_freq());
+    return ticks * scale;
+}
+
+/*
+ * bench_cycles: perf_event_open 用户态周期计数器, 打开失败时 available() 返回 false
+ */
+struct bench_cycles
+{
+    int fd;
+
+    bench_cycles()
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.config         = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~bench_cycles()
+    {
+        if (fd >= 0) close(fd);
+    }
+    bool available() const
+    {
+        return fd >= 0;
+    }
+    uint64_t read_now() const
+    {
+        uint64_t v = 0u;
+        if (fd < 0 || ::read(fd, &v, sizeof(v)) != static_cast<ssize_t>(sizeof(v))) return 0u;
+        return v;
+    }
+};
+
+/*
+ * bench_code: 运行时生成的代码区域
+ *
+ * far 为 true 时尽量映射到距离 near_to 约 4GB 的位置, 使其中的函数只能用远跳转 Hook;
+ * 否则尽量映射到 near_to 之后 16MB 处, 使其中的函数可以用近跳转 Hook。
+ */
+struct bench_code
+{
+    uint32_t *base;
+    uint32_t *cur;
+    size_t    size;
+
+    bench_code(const void *near_to, const size_t bytes, const bool far)
+    {
+        size = (bytes + 4095u) & ~static_cast<size_t>(4095u);
+        const uintptr_t distance = far ? (1ull << 32) : (1ull << 24);
+        void *hint = reinterpret_cast<void *>((reinterpret_cast<uintptr_t>(near_to) + distance) & ~static_cast<uintptr_t>(4095u));
+        void *p = mmap(hint, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        base = cur = static_cast<uint32_t *>(p);
+    }
+    ~bench_code()
+    {
+        munmap(base, size);
+    }
+
+    // 把当前位置对齐到 n 字节(用 NOP 填充), 返回当前位置
+    uint32_t *align(const size_t n)
+    {
+        while ((reinterpret_cast<uintptr_t>(cur) & (n - 1u)) != 0u) *cur++ = 0xd503201fu;
+        return cur;
+    }
+    void emit(const uint32_t insn)
+    {
+        *cur++ = insn;
+    }
+    void flush()
+    {
+        __builtin___clear_cache(reinterpret_cast<char *>(base), reinterpret_cast<char *>(cur));
+    }
+};
+
+// 常用指令编码
+#define BENCH_RET          0xd65f03c0u
+#define BENCH_NOP          0xd503201fu
+#define BENCH_ADD_W0_1     0x11000400u  // add w0, w0, #1
+#define BENCH_SUB_W0_1     0x51000400u  // sub w0, w0, #1
+#define BENCH_CMP_W0_0     0x7100001fu  // cmp w0, #0
+#define BENCH_ADD_X0_X1    0x8b010000u  // add x0, x0, x1
+#define BENCH_PUSH_FP_LR   0xa9bf7bfdu  // stp x29, x30, [sp, #-16]!
+#define BENCH_MOV_FP_SP    0x910003fdu  // mov x29, sp
+#define BENCH_POP_FP_LR    0xa8c17bfdu  // ldp x29, x30, [sp], #16
+
+static inline uint32_t bench_bl(const uint32_t *from, const uint32_t *to)
+{
+    return 0x94000000u | (static_cast<uint32_t>(to - from) & 0x3ffffffu);
+}
+
+static inline uint32_t bench_b_cond(const uint32_t *from, const uint32_t *to, const uint32_t cond)
+{
+    return 0x54000000u | ((static_cast<uint32_t>(to - from) & 0x7ffffu) << 5) | cond;
+}
+
+static inline uint32_t bench_ldr_lit_x(const uint32_t *from, const void *to, const uint32_t rt)
+{
+    return 0x58000000u | ((static_cast<uint32_t>(static_cast<const uint32_t *>(to) - from) & 0x7ffffu) << 5) | rt;
+}
+
+static inline uint32_t bench_adrp(const uint32_t rd, const int64_t pages)
+{
+    const uint32_t imm = static_cast<uint32_t>(pages) & 0x1fffffu;
+    return 0x90000000u | ((imm & 3u) << 29) | ((imm >> 2) << 5) | rd;
+}
+
+/*
+ * bench_rss_bytes: 当前进程的常驻内存(/proc/self/statm 第二列)
+ */
+static inline uint64_t bench_rss_bytes()
+{
+    unsigned long size = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) return 0u;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(fp);
+    return static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+/*
+ * bench_json: 逐个输出结果对象的简单 JSON 写入器
+ */
+struct bench_json
+{
+    FILE *fp;
+    bool  first;
+
+    explicit bench_json(FILE *out) : fp(out), first(true) {}
+
+    void begin(const char *benchmark)
+    {
+        fprintf(fp, "{\"benchmark\":\"%s\",\"counter_freq\":%llu,\"results\":[", benchmark,
+                static_cast<unsigned long long>(bench_freq()));
+    }
+    void next()
+    {
+        fprintf(fp, first ? "\n  {" : ",\n  {");
+        first = false;
+    }
+    void end()
+    {
+        fprintf(fp, "\n]}\n");
+    }
+};
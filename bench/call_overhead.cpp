@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * call_overhead: 被 Hook 函数的单次调用开销
+ *
+ * 用法: call_overhead [--json] [--quick] [--iterations N]
+ *   --json:       以 JSON 格式输出, 便于在 CI 中比较
+ *   --quick:      减少迭代次数, 用于冒烟测试
+ *
+ * 每个用例取多轮测量中的最小值。overhead_ns 是相对同一函数未 Hook 副本的增量。
+ * 需要远跳转的用例运行在距离本模块约 4GB 的运行时生成代码上。
+ */
+#include "../And64InlineHook.hpp"
+#include "bench_util.hpp"
+
+typedef int (*int_fn)(int);
+
+static volatile int sink;
+
+//-------------------------------------------------------------------------
+// 模块内(近跳转)的目标函数
+
+#define NEAR_TARGET(name) \
+    extern "C" __attribute__((noinline)) int name(int x) { __asm__ __volatile__(""); return x + 1; }
+
+NEAR_TARGET(near_direct)
+NEAR_TARGET(near_hooked)
+NEAR_TARGET(near_tramp)
+NEAR_TARGET(near_chain)
+NEAR_TARGET(near_probe)
+NEAR_TARGET(near_sampled)
+
+static int replace_plain(int x)
+{
+    return x + 1;
+}
+
+/*
+ * tramp_replace: 通过跳板调用原函数的替换函数, 每个用例一个实例
+ */
+template <int N> struct tramp_replace
+{
+    static int_fn orig;
+    static int call(int x)
+    {
+        return orig(x);
+    }
+};
+template <int N> int_fn tramp_replace<N>::orig;
+
+template <int N> static void hook_through(void *symbol)
+{
+    A64HookFunction(symbol, reinterpret_cast<void *>(tramp_replace<N>::call),
+                    reinterpret_cast<void **>(&tramp_replace<N>::orig));
+    if (tramp_replace<N>::orig == NULL) {
+        fprintf(stderr, "failed to hook %p\n", symbol);
+        exit(1);
+    }
+}
+
+//-------------------------------------------------------------------------
+// 运行时生成的远距离目标函数
+
+enum prologue_kind { PROLOGUE_PLAIN, PROLOGUE_BL, PROLOGUE_COND, PROLOGUE_LITERAL };
+
+/*
+ * emit_function: 生成一个 "x + 4" 语义的函数, 前几条指令是要测试的重定位类型
+ */
+static int_fn emit_function(bench_code &code, const prologue_kind kind)
+{
+    uint32_t *leaf = NULL;
+    if (kind == PROLOGUE_BL) {
+        leaf = code.align(16);
+        code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_RET);
+    }
+
+    uint32_t *fn = code.align(16);
+    switch (kind) {
+    case PROLOGUE_PLAIN:
+        for (int i = 0; i < 4; ++i) code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_RET);
+        break;
+    case PROLOGUE_BL:
+        code.emit(BENCH_PUSH_FP_LR);
+        code.emit(BENCH_MOV_FP_SP);
+        code.emit(bench_bl(code.cur, leaf));
+        code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_POP_FP_LR);
+        code.emit(BENCH_RET);
+        break;
+    case PROLOGUE_COND:
+        // b.lt 的目标在被覆盖的窗口之外, 重定位时会被扩展为绝对跳转
+        code.emit(BENCH_CMP_W0_0);
+        code.emit(bench_b_cond(code.cur, fn + 7, 0xbu));
+        for (int i = 0; i < 4; ++i) code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_RET);
+        code.emit(BENCH_SUB_W0_1);
+        code.emit(BENCH_RET);
+        break;
+    case PROLOGUE_LITERAL:
+        code.emit(bench_ldr_lit_x(code.cur, fn + 6, 1u));
+        code.emit(BENCH_ADD_X0_X1);
+        code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_RET);
+        code.emit(1u);  // .quad 1
+        code.emit(0u);
+        break;
+    }
+    return reinterpret_cast<int_fn>(fn);
+}
+
+//-------------------------------------------------------------------------
+
+struct bench_case
+{
+    const char *name;
+    int_fn      fn;
+    int_fn      baseline;
+};
+
+struct bench_result
+{
+    double ns;
+    double cycles;  // < 0 表示不可用
+};
+
+static bench_result measure(int_fn volatile fn, const long iterations, const int repeats, const bench_cycles &cycles)
+{
+    bench_result best = { 1e300, -1.0 };
+    for (int i = 0; i < 1000; ++i) sink = fn(i);  // 预热, 探针在首次调用时分配线程数据
+
+    for (int r = 0; r < repeats; ++r) {
+        int acc = 0;
+        const uint64_t c0 = cycles.read_now();
+        const uint64_t t0 = bench_ticks();
+        for (long i = 0; i < iterations; ++i) acc += fn(static_cast<int>(i));
+        const uint64_t t1 = bench_ticks();
+        const uint64_t c1 = cycles.read_now();
+        sink = acc;
+
+        const double ns = bench_ticks_to_ns(static_cast<double>(t1 - t0)) / static_cast<double>(iterations);
+        if (ns < best.ns) {
+            best.ns     = ns;
+            best.cycles = cycles.available() ? static_cast<double>(c1 - c0) / static_cast<double>(iterations) : -1.0;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    long iterations = 1000000;
+    int  repeats    = 5;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            iterations = 10000;
+            repeats    = 2;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--quick] [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // 近跳转用例
+    A64HookFunction(reinterpret_cast<void *>(near_hooked), reinterpret_cast<void *>(replace_plain), NULL);
+    hook_through<0>(reinterpret_cast<void *>(near_tramp));
+    hook_through<1>(reinterpret_cast<void *>(near_chain));
+    hook_through<2>(reinterpret_cast<void *>(near_chain));  // 第二层 Hook 重定位的是第一层写入的 B 指令
+    if (A64ProbeFunction(reinterpret_cast<void *>(near_probe), "near_probe", 0u, NULL) < 0) return 1;
+
+    A64MarkerStart("/dev/null");
+    const int sampled = A64ProbeFunction(reinterpret_cast<void *>(near_sampled), "near_sampled", A64_PROBE_MARKER, NULL);
+    if (sampled < 0) return 1;
+    A64ProbeSetMarkerLimit(sampled, 64u, A64_MARKER_MAX_PER_SEC);
+
+    // 远跳转用例: 每种序言生成 "被 Hook" 和 "基准" 两份
+    bench_code code(reinterpret_cast<void *>(replace_plain), 4096, true);
+    int_fn far_base    = emit_function(code, PROLOGUE_PLAIN);
+    int_fn far_hooked  = emit_function(code, PROLOGUE_PLAIN);
+    int_fn far_tramp   = emit_function(code, PROLOGUE_PLAIN);
+    int_fn bl_base     = emit_function(code, PROLOGUE_BL);
+    int_fn bl_hooked   = emit_function(code, PROLOGUE_BL);
+    int_fn cond_base   = emit_function(code, PROLOGUE_COND);
+    int_fn cond_hooked = emit_function(code, PROLOGUE_COND);
+    int_fn lit_base    = emit_function(code, PROLOGUE_LITERAL);
+    int_fn lit_hooked  = emit_function(code, PROLOGUE_LITERAL);
+    code.flush();
+
+    A64HookFunction(reinterpret_cast<void *>(far_hooked), reinterpret_cast<void *>(replace_plain), NULL);
+    hook_through<3>(reinterpret_cast<void *>(far_tramp));
+    hook_through<4>(reinterpret_cast<void *>(bl_hooked));
+    hook_through<5>(reinterpret_cast<void *>(cond_hooked));
+    hook_through<6>(reinterpret_cast<void *>(lit_hooked));
+
+    const bench_case cases[] = {
+        { "direct",           near_direct,  near_direct },
+        { "near_hook",        near_hooked,  near_direct },
+        { "near_trampoline",  near_tramp,   near_direct },
+        { "near_chained",     near_chain,   near_direct },
+        { "probe_entry_exit", near_probe,   near_direct },
+        { "probe_sampled",    near_sampled, near_direct },
+        { "far_direct",       far_base,     far_base    },
+        { "far_hook",         far_hooked,   far_base    },
+        { "far_trampoline",   far_tramp,    far_base    },
+        { "reloc_bl",         bl_hooked,    bl_base     },
+        { "reloc_cond",       cond_hooked,  cond_base   },
+        { "reloc_literal",    lit_hooked,   lit_base    },
+    };
+
+    bench_cycles cycles;
+    bench_result results[sizeof(cases) / sizeof(cases[0])];
+    bench_result bases[sizeof(cases) / sizeof(cases[0])];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        results[i] = measure(cases[i].fn, iterations, repeats, cycles);
+        bases[i]   = cases[i].fn == cases[i].baseline ? results[i] : measure(cases[i].baseline, iterations, repeats, cycles);
+    }
+    A64MarkerStop();
+
+    if (json) {
+        bench_json out(stdout);
+        out.begin("call_overhead");
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+            out.next();
+            fprintf(stdout, "\"name\":\"%s\",\"ns_per_call\":%.3f,\"overhead_ns\":%.3f,", cases[i].name,
+                    results[i].ns, results[i].ns - bases[i].ns);
+            if (results[i].cycles >= 0.0) {
+                fprintf(stdout, "\"cycles_per_call\":%.2f}", results[i].cycles);
+            } else {
+                fprintf(stdout, "\"cycles_per_call\":null}");
+            }
+        }
+        out.end();
+    } else {
+        printf("%-18s %12s %12s %12s\n", "case", "ns/call", "overhead_ns", "cycles/call");
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+            printf("%-18s %12.2f %12.2f ", cases[i].name, results[i].ns, results[i].ns - bases[i].ns);
+            if (results[i].cycles >= 0.0) printf("%12.1f\n", results[i].cycles);
+            else printf("%12s\n", "n/a");
+        }
+    }
+    return 0;
+}
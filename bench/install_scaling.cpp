@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * install_scaling: Hook 安装延迟随 Hook 数量(1 ~ 100k)的变化
+ *
+ * 用法: install_scaling [--json] [--quick] [--max N]
+ *
+ * 运行时生成一个由大量小函数组成的合成模块, 序言依次为普通指令、BL、B.cond、
+ * LDR 字面量和 ADRP, 分别放在可近跳转和只能远跳转的位置, 再通过
+ * A64HookFunction 和 A64HookFunctionV 逐个 Hook。报告总耗时、每个 Hook 的
+ * 耗时、系统调用次数、各阶段耗时和常驻内存增量。
+ *
+ * 跳板池只有 A64_MAX_BACKUPS 个槽位, 因此 A64HookFunction 用例不请求原函数指针;
+ * A64HookFunctionV 用例的跳板来自本程序映射的 RWX 区域(计入内存)。
+ * 注册表满(A64_MAX_HOOKS)之后的 Hook 仍会安装, 只是不再记录。
+ */
+#include "../And64InlineHook.hpp"
+#include "bench_util.hpp"
+
+typedef int (*int_fn)(int);
+
+#define FUNCTION_WORDS  8     // 每个合成函数占用 32 字节, 足够容纳远跳转改写
+#define TRAMPOLINE_SIZE 256   // A64HookFunctionV 每个 Hook 的跳板大小(字节)
+#define REPLACED_VALUE  12345
+
+static int replace_marker(int)
+{
+    return REPLACED_VALUE;
+}
+
+/*
+ * emit_module: 生成 n 个函数, 返回第一个函数的地址, 函数 i 位于 base + i * FUNCTION_WORDS
+ */
+static uint32_t *emit_module(bench_code &code, const size_t n)
+{
+    uint32_t *leaf = code.align(16);
+    code.emit(BENCH_ADD_W0_1);
+    code.emit(BENCH_RET);
+
+    uint32_t *first = code.align(32);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t *fn = first + i * FUNCTION_WORDS;
+        code.cur = fn;
+        switch (i % 5u) {
+        case 0:  // 普通指令
+            for (int k = 0; k < 5; ++k) code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_RET);
+            break;
+        case 1:  // BL
+            code.emit(BENCH_PUSH_FP_LR);
+            code.emit(BENCH_MOV_FP_SP);
+            code.emit(bench_bl(code.cur, leaf));
+            code.emit(BENCH_POP_FP_LR);
+            code.emit(BENCH_RET);
+            break;
+        case 2:  // B.cond, 目标在改写窗口之外
+            code.emit(BENCH_CMP_W0_0);
+            code.emit(bench_b_cond(code.cur, fn + 6, 0xbu));
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_RET);
+            code.emit(BENCH_SUB_W0_1);
+            code.emit(BENCH_RET);
+            break;
+        case 3:  // LDR 字面量
+            code.emit(bench_ldr_lit_x(code.cur, fn + 6, 1u));
+            code.emit(BENCH_ADD_X0_X1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_RET);
+            code.emit(1u);
+            code.emit(0u);
+            break;
+        default:  // ADRP
+            code.emit(bench_adrp(1u, 0));
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_ADD_W0_1);
+            code.emit(BENCH_RET);
+            break;
+        }
+    }
+    code.cur = first + n * FUNCTION_WORDS;
+    code.flush();
+    return first;
+}
+
+struct scaling_row
+{
+    const char *api;
+    const char *layout;
+    size_t      hooks;
+    double      total_ms;
+    double      us_per_hook;
+    double      syscalls_per_hook;
+    double      phase_ns[A64_PHASE_COUNT];  // 每个 Hook 各阶段的平均耗时
+    double      bytes_per_hook;
+    uint64_t    failures;
+};
+
+static const char *const phase_names[A64_PHASE_COUNT] = { "alloc", "protect", "relocate", "patch", "flush" };
+
+static bool run(const bool use_v, const bool far, const size_t n, scaling_row &row)
+{
+    bench_code code(reinterpret_cast<void *>(replace_marker), (n + 1u) * FUNCTION_WORDS * sizeof(uint32_t) + 64u, far);
+    uint32_t *module = emit_module(code, n);
+
+    uint8_t *arena = NULL;
+    const size_t arena_size = use_v ? (n * TRAMPOLINE_SIZE + 4095u) & ~static_cast<size_t>(4095u) : 0u;
+    if (use_v) {
+        void *p = mmap(NULL, arena_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+        arena = static_cast<uint8_t *>(p);
+    }
+
+    A64InstallStats before, after;
+    A64GetInstallStats(&before);
+    const uint64_t rss0 = bench_rss_bytes();
+    const uint64_t t0   = bench_ticks();
+    for (size_t i = 0; i < n; ++i) {
+        void *symbol = module + i * FUNCTION_WORDS;
+        if (use_v) {
+            A64HookFunctionV(symbol, reinterpret_cast<void *>(replace_marker), arena + i * TRAMPOLINE_SIZE, TRAMPOLINE_SIZE);
+        } else {
+            A64HookFunction(symbol, reinterpret_cast<void *>(replace_marker), NULL);
+        }
+    }
+    const uint64_t t1   = bench_ticks();
+    const uint64_t rss1 = bench_rss_bytes();
+    A64GetInstallStats(&after);
+
+    // 抽查: 被 Hook 的函数应当返回替换函数的结果
+    for (size_t i = 0; i < n; i += n / 7u + 1u) {
+        int_fn fn = reinterpret_cast<int_fn>(module + i * FUNCTION_WORDS);
+        if (fn(0) != REPLACED_VALUE) {
+            fprintf(stderr, "function %zu was not hooked\n", i);
+            return false;
+        }
+    }
+
+    row.api               = use_v ? "A64HookFunctionV" : "A64HookFunction";
+    row.layout            = far ? "far" : "near";
+    row.hooks             = n;
+    row.total_ms          = bench_ticks_to_ns(static_cast<double>(t1 - t0)) / 1e6;
+    row.us_per_hook       = row.total_ms * 1e3 / static_cast<double>(n);
+    row.syscalls_per_hook = static_cast<double>(after.syscalls - before.syscalls) / static_cast<double>(n);
+    for (int k = 0; k < A64_PHASE_COUNT; ++k) {
+        row.phase_ns[k] = static_cast<double>(after.phase_ns[k] - before.phase_ns[k]) / static_cast<double>(n);
+    }
+    row.bytes_per_hook = (static_cast<double>(rss1 > rss0 ? rss1 - rss0 : 0u) + static_cast<double>(arena_size))
+                       / static_cast<double>(n);
+    row.failures       = after.failures - before.failures;
+
+    if (arena != NULL) munmap(arena, arena_size);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool   json = false;
+    size_t max  = 100000u;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            max = 100u;
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            max = static_cast<size_t>(atol(argv[++i]));
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--quick] [--max N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    bench_json out(stdout);
+    if (json) {
+        out.begin("install_scaling");
+    } else {
+        printf("%-17s %-5s %7s %10s %9s %9s %9s %9s %9s %9s %9s %10s\n", "api", "shape", "hooks", "total_ms",
+               "us/hook", "sys/hook", "alloc", "protect", "relocate", "patch", "flush", "bytes/hook");
+    }
+
+    for (int api = 0; api < 2; ++api) {
+        for (int far = 0; far < 2; ++far) {
+            for (size_t n = 1u; n <= max; n *= 10u) {
+                scaling_row row;
+                if (!run(api != 0, far != 0, n, row)) return 1;
+                if (json) {
+                    out.next();
+                    printf("\"api\":\"%s\",\"layout\":\"%s\",\"hooks\":%zu,\"total_ms\":%.3f,\"us_per_hook\":%.3f,"
+                           "\"syscalls_per_hook\":%.2f,\"bytes_per_hook\":%.1f,\"failures\":%llu",
+                           row.api, row.layout, row.hooks, row.total_ms, row.us_per_hook, row.syscalls_per_hook,
+                           row.bytes_per_hook, static_cast<unsigned long long>(row.failures));
+                    for (int k = 0; k < A64_PHASE_COUNT; ++k) printf(",\"%s_ns\":%.1f", phase_names[k], row.phase_ns[k]);
+                    printf("}");
+                } else {
+                    printf("%-17s %-5s %7zu %10.3f %9.3f %9.2f %9.0f %9.0f %9.0f %9.0f %9.0f %10.1f\n", row.api,
+                           row.layout, row.hooks, row.total_ms, row.us_per_hook, row.syscalls_per_hook,
+                           row.phase_ns[0], row.phase_ns[1], row.phase_ns[2], row.phase_ns[3], row.phase_ns[4],
+                           row.bytes_per_hook);
+                }
+            }
+        }
+    }
+    if (json) out.end();
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * live_patch_stress: 在多个线程持续调用目标函数的同时安装、切换和移除 Hook
+ *
+ * 用法: live_patch_stress [--json] [--quick] [--threads N] [--ms duration] [--live-far-install]
+ *
+ * 目标函数为运行时生成的 "x + 5", 近跳转和远跳转各 A64_STRESS_TARGETS 个; 替换函数通过
+ * 跳板调用原函数并加 1000, 因此调用者看到的结果只能是 x + 5 或 x + 1005, 其他值都计为错误结果。
+ *
+ * 阶段:
+ *   baseline: 只有调用者在运行
+ *   patching: 控制线程安装近跳转 Hook, 然后随机启用/停用所有 Hook, 最后全部移除
+ * 报告两个阶段的吞吐量、吞吐量下降比例和调用延迟分布(每 64 次调用采样一次)。
+ * 发生 SIGSEGV/SIGILL/SIGBUS 时立即输出并以退出码 3 结束。
+ *
+ * 远跳转的安装先把第一个字改为跳到跳板, 写好后续的字后再改为 LDR, 只有恰好停在入口
+ * 前几条指令中间的线程不受保护。默认在调用者启动前安装并停用, 运行中只做切换;
+ * --live-far-install 让它们也在 patching 阶段安装, 用于验证这一安装顺序。
+ */
+#include "../And64InlineHook.hpp"
+#include "bench_util.hpp"
+
+#include <pthread.h>
+#include <signal.h>
+
+typedef int (*int_fn)(int);
+
+#define A64_STRESS_TARGETS 4
+#define LATENCY_BUCKETS    40
+#define SAMPLE_MASK        63u
+#define TRAMPOLINE_BYTES   256u
+
+template <int N> struct stress_replace
+{
+    static int_fn orig;
+    static int call(int x)
+    {
+        return orig(x) + 1000;
+    }
+};
+template <int N> int_fn stress_replace<N>::orig;
+
+static void *const replaces[2 * A64_STRESS_TARGETS] = {
+    reinterpret_cast<void *>(stress_replace<0>::call), reinterpret_cast<void *>(stress_replace<1>::call),
+    reinterpret_cast<void *>(stress_replace<2>::call), reinterpret_cast<void *>(stress_replace<3>::call),
+    reinterpret_cast<void *>(stress_replace<4>::call), reinterpret_cast<void *>(stress_replace<5>::call),
+    reinterpret_cast<void *>(stress_replace<6>::call), reinterpret_cast<void *>(stress_replace<7>::call),
+};
+static int_fn *const origs[2 * A64_STRESS_TARGETS] = {
+    &stress_replace<0>::orig, &stress_replace<1>::orig, &stress_replace<2>::orig, &stress_replace<3>::orig,
+    &stress_replace<4>::orig, &stress_replace<5>::orig, &stress_replace<6>::orig, &stress_replace<7>::orig,
+};
+
+enum { PHASE_BASELINE, PHASE_PATCHING, PHASE_STOP };
+
+/*
+ * caller_stats: 每个调用线程每个阶段的统计, 只由所属线程写入
+ */
+struct caller_stats
+{
+    uint64_t calls[2];
+    uint64_t wrong[2];
+    uint64_t hist[2][LATENCY_BUCKETS];  // 第 i 个桶: 耗时在 [2^i, 2^(i+1)) 个计数周期
+    uint64_t max_ticks[2];
+};
+
+static int_fn          targets[2 * A64_STRESS_TARGETS];
+static uint32_t       *far_trampolines[2 * A64_STRESS_TARGETS];
+static volatile int    phase = PHASE_BASELINE;
+static volatile int    started;
+
+static void *caller_main(void *arg)
+{
+    caller_stats *cs = static_cast<caller_stats *>(arg);
+    __sync_fetch_and_add(&started, 1);
+
+    uint32_t n = 0u;
+    for (;;) {
+        const int p = __atomic_load_n(&phase, __ATOMIC_RELAXED);
+        if (p == PHASE_STOP) break;
+
+        int_fn volatile fn = targets[n % (2 * A64_STRESS_TARGETS)];
+        const int x = static_cast<int>(n & 0xffffu);
+        int r;
+        if ((n & SAMPLE_MASK) == 0u) {
+            const uint64_t t0 = bench_ticks();
+            r = fn(x);
+            const uint64_t ticks = bench_ticks() - t0;
+            const uint32_t b = ticks != 0u ? 63u - static_cast<uint32_t>(__builtin_clzll(ticks)) : 0u;
+            ++cs->hist[p][b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1];
+            if (ticks > cs->max_ticks[p]) cs->max_ticks[p] = ticks;
+        } else {
+            r = fn(x);
+        }
+        if (r != x + 5 && r != x + 1005) ++cs->wrong[p];
+        ++cs->calls[p];
+        ++n;
+    }
+    return NULL;
+}
+
+static void on_fault(int sig)
+{
+    static const char msg[] = "live_patch_stress: fatal signal while patching\n";
+    (void)write(STDERR_FILENO, msg, sizeof(msg) - 1u);
+    (void)sig;
+    _exit(3);
+}
+
+static void sleep_ms(const long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0) {}
+}
+
+/*
+ * install: 近跳转目标使用内置跳板池; 远跳转目标的跳板放在目标旁边(A64HookFunctionV),
+ * 这样停用时入口可以改为 B 跳板。原函数指针必须在改写入口之前设置好。
+ */
+static int install(const int i)
+{
+    void *symbol = reinterpret_cast<void *>(targets[i]);
+    if (far_trampolines[i] != NULL) {
+        *origs[i] = reinterpret_cast<int_fn>(far_trampolines[i]);
+        if (A64HookFunctionV(symbol, replaces[i], far_trampolines[i], TRAMPOLINE_BYTES) == NULL) return -1;
+    } else {
+        A64HookFunction(symbol, replaces[i], reinterpret_cast<void **>(origs[i]));
+        if (*origs[i] == NULL) return -1;
+    }
+    return A64HookFind(symbol);
+}
+
+/*
+ * percentile_ns: 由合并后的直方图估算百分位(取桶的上界)
+ */
+static double percentile_ns(const uint64_t *hist, const double q)
+{
+    uint64_t total = 0u;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) total += hist[i];
+    if (total == 0u) return 0.0;
+    uint64_t acc = 0u;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        acc += hist[i];
+        if (static_cast<double>(acc) >= q * static_cast<double>(total)) {
+            return bench_ticks_to_ns(static_cast<double>(2ull << i));
+        }
+    }
+    return bench_ticks_to_ns(static_cast<double>(2ull << (LATENCY_BUCKETS - 1)));
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false, live_far = false;
+    int  threads = 4;
+    long ms      = 1000;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            ms = 50;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) {
+            ms = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--live-far-install") == 0) {
+            live_far = true;
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--quick] [--threads N] [--ms duration] [--live-far-install]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 1 || threads > 256 || ms < 1) return 2;
+
+    signal(SIGSEGV, on_fault);
+    signal(SIGILL, on_fault);
+    signal(SIGBUS, on_fault);
+
+    bench_code near_code(reinterpret_cast<void *>(stress_replace<0>::call), 4096, false);
+    bench_code far_code(reinterpret_cast<void *>(stress_replace<0>::call), 8192, true);
+    for (int i = 0; i < 2 * A64_STRESS_TARGETS; ++i) {
+        bench_code &code = i < A64_STRESS_TARGETS ? near_code : far_code;
+        targets[i] = reinterpret_cast<int_fn>(code.align(32));
+        for (int k = 0; k < 5; ++k) code.emit(BENCH_ADD_W0_1);
+        code.emit(BENCH_RET);
+    }
+    for (int i = A64_STRESS_TARGETS; i < 2 * A64_STRESS_TARGETS; ++i) {
+        far_trampolines[i] = far_code.base + (4096u + (i - A64_STRESS_TARGETS) * TRAMPOLINE_BYTES) / sizeof(uint32_t);
+    }
+    near_code.flush();
+    far_code.flush();
+
+    int ids[2 * A64_STRESS_TARGETS];
+    for (int i = A64_STRESS_TARGETS; !live_far && i < 2 * A64_STRESS_TARGETS; ++i) {
+        if ((ids[i] = install(i)) < 0 || A64HookSetEnabled(ids[i], 0) != 0) {
+            fprintf(stderr, "failed to prepare far hook %d\n", i);
+            return 1;
+        }
+    }
+
+    caller_stats *stats = static_cast<caller_stats *>(calloc(static_cast<size_t>(threads), sizeof(caller_stats)));
+    pthread_t    *tids  = static_cast<pthread_t *>(calloc(static_cast<size_t>(threads), sizeof(pthread_t)));
+    for (int t = 0; t < threads; ++t) pthread_create(&tids[t], NULL, caller_main, &stats[t]);
+    while (__atomic_load_n(&started, __ATOMIC_ACQUIRE) < threads) sched_yield();
+
+    sleep_ms(ms);
+    __atomic_store_n(&phase, PHASE_PATCHING, __ATOMIC_RELEASE);
+    const uint64_t p0 = bench_ticks();
+
+    // 安装
+    uint64_t toggles = 0u, toggle_failures = 0u;
+    for (int i = 0; i < (live_far ? 2 : 1) * A64_STRESS_TARGETS; ++i) {
+        if ((ids[i] = install(i)) < 0) {
+            fprintf(stderr, "failed to install hook %d\n", i);
+            return 1;
+        }
+    }
+
+    // 随机切换
+    uint32_t rnd = 0x9e3779b9u;
+    const uint64_t toggle_end = bench_ticks() + static_cast<uint64_t>(static_cast<double>(ms) * 1e-3 * static_cast<double>(bench_freq()));
+    while (bench_ticks() < toggle_end) {
+        rnd ^= rnd << 13; rnd ^= rnd >> 17; rnd ^= rnd << 5;
+        if (A64HookSetEnabled(ids[rnd % (2 * A64_STRESS_TARGETS)], static_cast<int>((rnd >> 8) & 1u)) == 0) ++toggles;
+        else ++toggle_failures;
+    }
+
+    // 移除
+    for (int i = 0; i < 2 * A64_STRESS_TARGETS; ++i) {
+        if (A64UnhookFunction(ids[i]) != 0) ++toggle_failures;
+    }
+    sleep_ms(ms / 10 + 1);  // 让调用者在移除之后继续运行一段时间
+
+    __atomic_store_n(&phase, PHASE_STOP, __ATOMIC_RELEASE);
+    const uint64_t p1 = bench_ticks();
+    for (int t = 0; t < threads; ++t) pthread_join(tids[t], NULL);
+
+    // 合并统计
+    caller_stats sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int t = 0; t < threads; ++t) {
+        for (int p = 0; p < 2; ++p) {
+            sum.calls[p] += stats[t].calls[p];
+            sum.wrong[p] += stats[t].wrong[p];
+            if (stats[t].max_ticks[p] > sum.max_ticks[p]) sum.max_ticks[p] = stats[t].max_ticks[p];
+            for (int b = 0; b < LATENCY_BUCKETS; ++b) sum.hist[p][b] += stats[t].hist[p][b];
+        }
+    }
+    const double base_rate  = static_cast<double>(sum.calls[0]) / (static_cast<double>(ms) * 1e-3);
+    const double patch_secs = bench_ticks_to_ns(static_cast<double>(p1 - p0)) * 1e-9;
+    const double patch_rate = static_cast<double>(sum.calls[1]) / patch_secs;
+    const double dip        = base_rate > 0.0 ? (1.0 - patch_rate / base_rate) * 100.0 : 0.0;
+
+    static const char *const names[2] = { "baseline", "patching" };
+    if (json) {
+        printf("{\"benchmark\":\"live_patch_stress\",\"threads\":%d,\"targets\":%d,\"live_far_install\":%s,"
+               "\"toggles\":%llu,\"toggle_failures\":%llu,\"toggles_per_sec\":%.0f,\"throughput_dip_pct\":%.2f,"
+               "\"wrong_results\":%llu,\"crashes\":0,\"phases\":{",
+               threads, 2 * A64_STRESS_TARGETS, live_far ? "true" : "false", static_cast<unsigned long long>(toggles),
+               static_cast<unsigned long long>(toggle_failures), static_cast<double>(toggles) / patch_secs, dip,
+               static_cast<unsigned long long>(sum.wrong[0] + sum.wrong[1]));
+        for (int p = 0; p < 2; ++p) {
+            printf("%s\"%s\":{\"calls_per_sec\":%.0f,\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f}",
+                   p == 0 ? "" : ",", names[p], p == 0 ? base_rate : patch_rate, percentile_ns(sum.hist[p], 0.5),
+                   percentile_ns(sum.hist[p], 0.99), percentile_ns(sum.hist[p], 0.999),
+                   bench_ticks_to_ns(static_cast<double>(sum.max_ticks[p])));
+        }
+        printf("}}\n");
+    } else {
+        printf("threads %d, targets %d, toggles %llu (%llu failed), throughput dip %.2f%%, wrong results %llu\n",
+               threads, 2 * A64_STRESS_TARGETS, static_cast<unsigned long long>(toggles),
+               static_cast<unsigned long long>(toggle_failures), dip,
+               static_cast<unsigned long long>(sum.wrong[0] + sum.wrong[1]));
+        printf("%-9s %14s %10s %10s %10s %12s\n", "phase", "calls/s", "p50_ns", "p99_ns", "p999_ns", "max_ns");
+        for (int p = 0; p < 2; ++p) {
+            printf("%-9s %14.0f %10.0f %10.0f %10.0f %12.0f\n", names[p], p == 0 ? base_rate : patch_rate,
+                   percentile_ns(sum.hist[p], 0.5), percentile_ns(sum.hist[p], 0.99), percentile_ns(sum.hist[p], 0.999),
+                   bench_ticks_to_ns(static_cast<double>(sum.max_ticks[p])));
+        }
+    }
+    return sum.wrong[0] + sum.wrong[1] != 0u || toggle_failures != 0u ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * memory_footprint: 每个 Hook 的内存开销
+ *
+ * 用法: memory_footprint [--json] [--quick] [--hooks N] [--stride bytes]
+ *
+ * 把合成的函数写入临时文件, 以 MAP_PRIVATE 只读可执行方式映射, 模拟共享库的 .text 段。
+ * 分别用 A64HookFunction(带跳板)和 A64ProbeFunction 安装 N 个 Hook 并各调用一次,
+ * 比较前后的 /proc/self/smaps_rollup, 被改写的代码映射中变为私有脏页的数量,
+ * 以及 A64GetMemoryStats 报告的池使用情况。
+ *
+ * 跳板池和探针描述表各只有 A64_MAX_BACKUPS 个槽位, 为了两种模式使用相同的 N, N 不超过其一半。
+ * 探针的数据块和跳板分配在共享桩代码区域中, 计入 arena_used。
+ */
+#include "../And64InlineHook.hpp"
+#include "bench_util.hpp"
+
+#include <fcntl.h>
+
+typedef int (*int_fn)(int);
+
+static int replace_fn(int x)
+{
+    return x;
+}
+
+/*
+ * mem_snapshot: 一次采样
+ */
+struct mem_snapshot
+{
+    uint64_t rss;            // smaps_rollup Rss(字节)
+    uint64_t private_dirty;  // smaps_rollup Private_Dirty
+    uint64_t text_dirty;     // 合成模块映射的 Private_Dirty
+    A64MemoryStats  lib;
+    A64InstallStats install;
+};
+
+static uint64_t parse_kb(const char *line, const char *key)
+{
+    const size_t n = strlen(key);
+    if (strncmp(line, key, n) != 0) return UINT64_MAX;
+    return strtoull(line + n, NULL, 10) * 1024u;
+}
+
+static void read_rollup(mem_snapshot &s)
+{
+    char  line[256];
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp == NULL) {
+        s.rss = bench_rss_bytes();  // 旧内核没有 smaps_rollup
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        uint64_t v;
+        if ((v = parse_kb(line, "Rss:")) != UINT64_MAX) s.rss = v;
+        if ((v = parse_kb(line, "Private_Dirty:")) != UINT64_MAX) s.private_dirty = v;
+    }
+    fclose(fp);
+}
+
+/*
+ * read_mapping_dirty: 从 /proc/self/smaps 中读取包含 addr 的映射的 Private_Dirty
+ */
+static uint64_t read_mapping_dirty(const void *addr)
+{
+    char  line[512];
+    bool  inside = false;
+    uint64_t dirty = 0u;
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL) return 0u;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long long lo, hi;
+        const size_t h = strspn(line, "0123456789abcdef");  // 映射的首行以 "start-end " 开头, 字段行以大写字母开头
+        if (h > 0u && line[h] == '-' && sscanf(line, "%llx-%llx ", &lo, &hi) == 2) {
+            inside = reinterpret_cast<uintptr_t>(addr) >= lo && reinterpret_cast<uintptr_t>(addr) < hi;
+            continue;
+        }
+        uint64_t v;
+        if (inside && (v = parse_kb(line, "Private_Dirty:")) != UINT64_MAX) dirty += v;
+    }
+    fclose(fp);
+    return dirty;
+}
+
+static void snapshot(const void *module, mem_snapshot &s)
+{
+    memset(&s, 0, sizeof(s));
+    read_rollup(s);
+    s.text_dirty = read_mapping_dirty(module);
+    A64GetMemoryStats(&s.lib);
+    A64GetInstallStats(&s.install);
+}
+
+/*
+ * map_module: 生成 n 个间隔 stride 字节的 "x + 5" 函数, 写入临时文件后只读映射
+ */
+static uint8_t *map_module(const size_t n, const size_t stride, size_t &size)
+{
+    size = (n * stride + 4095u) & ~static_cast<size_t>(4095u);
+
+    char path[] = "/tmp/a64_memory_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) return NULL;
+    unlink(path);
+
+    uint32_t *code = static_cast<uint32_t *>(calloc(1, size));
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t *fn = code + i * stride / sizeof(uint32_t);
+        for (int k = 0; k < 5; ++k) fn[k] = BENCH_ADD_W0_1;
+        fn[5] = BENCH_RET;
+    }
+    const bool written = write(fd, code, size) == static_cast<ssize_t>(size);
+    free(code);
+
+    const uintptr_t hint = (reinterpret_cast<uintptr_t>(replace_fn) + (1u << 24)) & ~static_cast<uintptr_t>(4095u);
+    void *p = written ? mmap(reinterpret_cast<void *>(hint), size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    __builtin___clear_cache(static_cast<char *>(p), static_cast<char *>(p) + size);
+    return static_cast<uint8_t *>(p);
+}
+
+struct footprint
+{
+    const char  *mode;
+    size_t       hooks;
+    mem_snapshot before, after;
+    size_t       text_pages;  // 被改写的代码页数
+};
+
+static bool run(const bool probe, const size_t n, const size_t stride, footprint &f)
+{
+    size_t size;
+    uint8_t *module = map_module(n, stride, size);
+    if (module == NULL) {
+        perror("map_module");
+        return false;
+    }
+
+    f.mode       = probe ? "probe" : "hook";
+    f.hooks      = n;
+    f.text_pages = ((n - 1u) * stride) / 4096u + 1u;
+    snapshot(module, f.before);
+
+    for (size_t i = 0; i < n; ++i) {
+        void *symbol = module + i * stride;
+        void *orig   = NULL;
+        if (probe) {
+            if (A64ProbeFunction(symbol, NULL, 0u, &orig) < 0) return false;
+        } else {
+            A64HookFunction(symbol, reinterpret_cast<void *>(replace_fn), &orig);
+            if (orig == NULL) return false;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        int_fn fn = reinterpret_cast<int_fn>(module + i * stride);
+        const int expected = probe ? 5 : 0;
+        if (fn(0) != expected) {
+            fprintf(stderr, "%s %zu returned a wrong value\n", f.mode, i);
+            return false;
+        }
+    }
+
+    snapshot(module, f.after);
+    return true;  // 模块保持映射, 已安装的 Hook 仍然指向它
+}
+
+static double delta(const uint64_t a, const uint64_t b)
+{
+    return static_cast<double>(b) - static_cast<double>(a);
+}
+
+int main(int argc, char *argv[])
+{
+    bool   json   = false;
+    size_t hooks  = A64_MAX_BACKUPS / 2;
+    size_t stride = 256u;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            hooks = 16u;
+        } else if (strcmp(argv[i], "--hooks") == 0 && i + 1 < argc) {
+            hooks = static_cast<size_t>(atol(argv[++i]));
+        } else if (strcmp(argv[i], "--stride") == 0 && i + 1 < argc) {
+            stride = static_cast<size_t>(atol(argv[++i]));
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--quick] [--hooks N] [--stride bytes]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (hooks == 0u || hooks > A64_MAX_BACKUPS / 2 || stride < 32u || stride % 8u != 0u) {
+        fprintf(stderr, "hooks must be 1..%d and stride a multiple of 8 >= 32\n", A64_MAX_BACKUPS / 2);
+        return 2;
+    }
+
+    footprint runs[2];
+    for (int m = 0; m < 2; ++m) {
+        if (!run(m != 0, hooks, stride, runs[m])) return 1;
+    }
+
+    bench_json out(stdout);
+    if (json) out.begin("memory_footprint");
+    else printf("%-6s %6s %12s %14s %12s %12s %14s %14s %12s\n", "mode", "hooks", "rss/hook", "priv_dirty/hook",
+                "text_dirty", "text_pages", "tramp_used", "tramp_emitted", "meta/hook");
+
+    for (int m = 0; m < 2; ++m) {
+        const footprint &f = runs[m];
+        const A64MemoryStats &a = f.before.lib, &b = f.after.lib;
+        const double n = static_cast<double>(f.hooks);
+        const double rss_per_hook   = delta(f.before.rss, f.after.rss) / n;
+        const double dirty_per_hook = delta(f.before.private_dirty, f.after.private_dirty) / n;
+        const double text_dirty     = delta(f.before.text_dirty, f.after.text_dirty);
+        const double tramp_used     = delta(a.trampoline_used, b.trampoline_used);
+        const double tramp_emitted  = delta(f.before.install.trampoline_bytes, f.after.install.trampoline_bytes);
+        const double meta_per_hook  = (delta(a.registry_used, b.registry_used) + delta(a.stub_used, b.stub_used) +
+                                       delta(a.arena_used, b.arena_used)) / n;
+
+        if (json) {
+            out.next();
+            printf("\"mode\":\"%s\",\"hooks\":%zu,\"stride\":%zu,\"rss_bytes_per_hook\":%.1f,"
+                   "\"private_dirty_bytes_per_hook\":%.1f,\"text_private_dirty_bytes\":%.0f,\"text_pages_patched\":%zu,"
+                   "\"trampoline_committed\":%llu,\"trampoline_used\":%.0f,\"trampoline_emitted\":%.0f,"
+                   "\"stub_committed\":%llu,\"stub_used\":%llu,\"arena_used\":%llu,\"registry_committed\":%llu,\"registry_used\":%llu,"
+                   "\"thread_bytes\":%llu,\"metadata_bytes_per_hook\":%.1f}",
+                   f.mode, f.hooks, stride, rss_per_hook, dirty_per_hook, text_dirty, f.text_pages,
+                   static_cast<unsigned long long>(b.trampoline_committed), tramp_used, tramp_emitted,
+                   static_cast<unsigned long long>(b.stub_committed), static_cast<unsigned long long>(b.stub_used),
+                   static_cast<unsigned long long>(b.arena_used),
+                   static_cast<unsigned long long>(b.registry_committed), static_cast<unsigned long long>(b.registry_used),
+                   static_cast<unsigned long long>(b.thread_bytes), meta_per_hook);
+        } else {
+            printf("%-6s %6zu %12.1f %14.1f %12.0f %12zu %14.0f %14.0f %12.1f\n", f.mode, f.hooks, rss_per_hook,
+                   dirty_per_hook, text_dirty, f.text_pages, tramp_used, tramp_emitted, meta_per_hook);
+        }
+    }
+    if (json) out.end();
+    return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * reloc_throughput: 指令修复(__relocate)吞吐量基准测试, 可以在任意主机上运行
+ *
+ * 用法: reloc_throughput [--json] [--quick] [--corpus file]
+ *
+ * 语料由 tools/a64_extract_prologues 从 ELF 文件中提取(默认 bench/corpus/prologues.txt)。
+ * 每个序言按原始地址的低 4 位对齐放入一块源镜像, 分别以近跳转(1 条指令)和
+ * 远跳转(4 或 5 条指令)的窗口大小修复到暂存缓冲区。暂存缓冲区分两种位置:
+ * 与源镜像相邻(大部分 PC 相对引用可以直接改写偏移), 以及距离约 8GB
+ * (引用都需要扩展为绝对地址序列)。
+ *
+ * 计时部分只调用 __relocate, 不包含缓存刷新和遥测计时(主机上 __read_cntvct 是一次
+ * clock_gettime), 否则它们会掩盖修复本身的开销。
+ *
+ * 报告每秒修复的窗口数和指令数, 以及输出大小的分布。
+ */
+#define  A64_HOST_RELOCATOR
+#define  A64_LOG_SINK 0
+#include "../And64InlineHook.cpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifndef A64_CORPUS_FILE
+# define A64_CORPUS_FILE "bench/corpus/prologues.txt"
+#endif
+
+#define SLOT_BYTES    128u                  // 源镜像中每个序言占用的空间
+#define IMAGE_BYTES   (4u << 20)            // 源镜像大小, 序言放在中间, 字面量引用(+/-1MB)不会越界
+#define SOURCE_OFFSET (3u << 19)            // 序言区域的起始偏移(1.5MB)
+#define MAX_ENTRIES   ((1u << 20) / SLOT_BYTES)
+#define SCRATCH_SLOTS 256u                  // 暂存缓冲区循环使用的槽位数
+#define SCRATCH_BYTES 256u
+
+struct corpus_entry
+{
+    std::string name;
+    uint64_t    vaddr;
+    std::vector<uint32_t> words;
+    uint32_t   *source;  // 在源镜像中的位置
+};
+
+static bool load_corpus(const char *path, std::vector<corpus_entry> &entries)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return false;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        corpus_entry e;
+        char *save = NULL;
+        const char *name  = strtok_r(line, " \t\n", &save);
+        const char *vaddr = strtok_r(NULL, " \t\n", &save);
+        if (name == NULL || vaddr == NULL) continue;
+        e.name  = name;
+        e.vaddr = strtoull(vaddr, NULL, 16);
+        for (const char *w; (w = strtok_r(NULL, " \t\n", &save)) != NULL && e.words.size() < 16u;) {
+            e.words.push_back(static_cast<uint32_t>(strtoul(w, NULL, 16)));
+        }
+        if (!e.words.empty()) entries.push_back(e);
+    }
+    fclose(fp);
+    return true;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) * 1e9 + static_cast<double>(ts.tv_nsec);
+}
+
+/*
+ * relocate_only: 只修复指令, 不刷新缓存也不读取计数器, 与 __fix_instructions 的修复部分相同
+ */
+static inline uintptr_t relocate_only(uint32_t *inp, const int32_t count, uint32_t *outp)
+{
+    context::insns_info dat[A64_MAX_INSTRUCTIONS];
+    context ctx;
+    ctx.dat      = dat;
+    ctx.in_bias  = 0;
+    ctx.out_bias = 0;
+    ctx.src      = NULL;
+    return __relocate(ctx, inp, count, outp, NULL);
+}
+
+/*
+ * window_size: 与 A64HookFunctionV 相同的覆盖指令数
+ */
+static int32_t window_size(const corpus_entry &e, const bool far_patch)
+{
+    int32_t count = far_patch ? ((reinterpret_cast<uintptr_t>(e.source + 2) & 7u) != 0u ? 5 : 4) : 1;
+    return std::min(count, static_cast<int32_t>(e.words.size()));
+}
+
+struct reloc_result
+{
+    const char *scratch;
+    const char *window;
+    double   windows_per_sec;
+    double   insns_per_sec;
+    double   ns_per_window;
+    uint64_t original_bytes;
+    uint64_t trampoline_bytes;
+    std::vector<uint32_t> sizes;  // 每个窗口的输出字节数
+    A64InstallStats st;
+};
+
+static void run(std::vector<corpus_entry> &entries, uint32_t *scratch, const bool far_patch,
+                const double min_ns, reloc_result &r)
+{
+    // 第一遍收集输出大小和指令分类, 不计时
+    memset(&r.st, 0, sizeof(r.st));
+    uint64_t insns = 0u;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const int32_t count = window_size(entries[i], far_patch);
+        uint32_t *out = scratch + (i % SCRATCH_SLOTS) * (SCRATCH_BYTES / sizeof(uint32_t));
+        r.sizes.push_back(static_cast<uint32_t>(__fix_instructions(entries[i].source, count, out, &r.st)));
+        insns += static_cast<uint64_t>(count);
+    }
+    r.original_bytes   = r.st.original_bytes;
+    r.trampoline_bytes = r.st.trampoline_bytes;
+
+    uint64_t passes = 0u;
+    const double t0 = now_ns();
+    double t1;
+    do {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            uint32_t *out = scratch + (i % SCRATCH_SLOTS) * (SCRATCH_BYTES / sizeof(uint32_t));
+            relocate_only(entries[i].source, window_size(entries[i], far_patch), out);
+        }
+        ++passes;
+        t1 = now_ns();
+    } while (t1 - t0 < min_ns);
+
+    const double windows = static_cast<double>(passes) * static_cast<double>(entries.size());
+    r.windows_per_sec = windows * 1e9 / (t1 - t0);
+    r.insns_per_sec   = static_cast<double>(passes) * static_cast<double>(insns) * 1e9 / (t1 - t0);
+    r.ns_per_window   = (t1 - t0) / windows;
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, const double p)
+{
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1u, static_cast<size_t>(p * static_cast<double>(v.size())))];
+}
+
+int main(int argc, char *argv[])
+{
+    bool        json   = false;
+    double      min_ns = 5e8;
+    const char *corpus = A64_CORPUS_FILE;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            min_ns = 2e7;
+        } else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            corpus = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--quick] [--corpus file]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<corpus_entry> entries;
+    if (!load_corpus(corpus, entries) || entries.empty()) {
+        fprintf(stderr, "failed to load corpus %s\n", corpus);
+        return 1;
+    }
+    if (entries.size() > MAX_ENTRIES) {
+        fprintf(stderr, "corpus truncated to %u entries\n", MAX_ENTRIES);
+        entries.resize(MAX_ENTRIES);
+    }
+
+    uint8_t *image = static_cast<uint8_t *>(mmap(NULL, IMAGE_BYTES, PROT_READ | PROT_WRITE,
+                                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    void *far_hint = image + (8ull << 30);
+    uint32_t *far_scratch = static_cast<uint32_t *>(mmap(far_hint, SCRATCH_SLOTS * SCRATCH_BYTES, PROT_READ | PROT_WRITE,
+                                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (image == MAP_FAILED || far_scratch == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    uint32_t *near_scratch = reinterpret_cast<uint32_t *>(image + (1u << 20));
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        uint8_t *slot = image + SOURCE_OFFSET + i * SLOT_BYTES + (entries[i].vaddr & 0xcu);
+        entries[i].source = reinterpret_cast<uint32_t *>(slot);
+        memcpy(slot, entries[i].words.data(), entries[i].words.size() * sizeof(uint32_t));
+    }
+
+    static const char *const kind_names[A64_RELOC_KINDS] = { "branch", "cond", "literal", "pcrel", "copy" };
+    std::vector<reloc_result> results(4);
+    for (int s = 0; s < 2; ++s) {
+        for (int w = 0; w < 2; ++w) {
+            reloc_result &r = results[s * 2 + w];
+            r.scratch = s == 0 ? "near" : "far";
+            r.window  = w == 0 ? "near_patch" : "far_patch";
+            run(entries, s == 0 ? near_scratch : far_scratch, w != 0, min_ns, r);
+        }
+    }
+
+    if (json) {
+        printf("{\"benchmark\":\"reloc_throughput\",\"corpus\":\"%s\",\"entries\":%zu,\"results\":[", corpus, entries.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            const reloc_result &r = results[i];
+            printf("%s\n  {\"scratch\":\"%s\",\"window\":\"%s\",\"windows_per_sec\":%.0f,\"insns_per_sec\":%.0f,"
+                   "\"ns_per_window\":%.2f,\"expansion_ratio\":%.3f,\"output_bytes\":{\"min\":%u,\"p50\":%u,"
+                   "\"p90\":%u,\"p99\":%u,\"max\":%u},\"relocated\":{",
+                   i == 0 ? "" : ",", r.scratch, r.window, r.windows_per_sec, r.insns_per_sec, r.ns_per_window,
+                   static_cast<double>(r.trampoline_bytes) / static_cast<double>(r.original_bytes),
+                   percentile(r.sizes, 0.0), percentile(r.sizes, 0.5), percentile(r.sizes, 0.9),
+                   percentile(r.sizes, 0.99), percentile(r.sizes, 1.0));
+            for (int k = 0; k < A64_RELOC_KINDS; ++k) {
+                printf("%s\"%s\":[%llu,%llu]", k == 0 ? "" : ",", kind_names[k],
+                       static_cast<unsigned long long>(r.st.relocated[k]), static_cast<unsigned long long>(r.st.expanded[k]));
+            }
+            printf("}}");
+        }
+        printf("\n]}\n");
+    } else {
+        printf("corpus: %s (%zu entries)\n", corpus, entries.size());
+        printf("%-8s %-11s %14s %14s %10s %8s %6s %6s %6s %6s\n", "scratch", "window", "windows/s", "insns/s",
+               "ns/window", "expand", "p50", "p90", "p99", "max");
+        for (size_t i = 0; i < results.size(); ++i) {
+            const reloc_result &r = results[i];
+            printf("%-8s %-11s %14.0f %14.0f %10.2f %8.3f %6u %6u %6u %6u\n", r.scratch, r.window, r.windows_per_sec,
+                   r.insns_per_sec, r.ns_per_window,
+                   static_cast<double>(r.trampoline_bytes) / static_cast<double>(r.original_bytes),
+                   percentile(r.sizes, 0.5), percentile(r.sizes, 0.9), percentile(r.sizes, 0.99),
+                   percentile(r.sizes, 1.0));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+# Cross toolchain for aarch64 Linux (glibc or musl), tests run under qemu-aarch64 user mode.
+#
+#   cmake -S . -B build-a64 -DCMAKE_TOOLCHAIN_FILE=cmake/aarch64-linux-gnu.cmake
+#   cmake --build build-a64 && ctest --test-dir build-a64
+#
+# For musl pass -DA64_TRIPLE=aarch64-linux-musl (tests are then linked statically).
+# A64_SYSROOT defaults to /usr/<triple>, which is where Debian/Ubuntu cross packages install.
+
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR aarch64)
+
+set(A64_TRIPLE "aarch64-linux-gnu" CACHE STRING "cross compiler prefix")
+set(A64_SYSROOT "/usr/${A64_TRIPLE}" CACHE PATH "target sysroot used by qemu-aarch64 -L")
+set(A64_QEMU "qemu-aarch64" CACHE STRING "user-mode emulator used to run tests and benchmarks")
+
+set(CMAKE_C_COMPILER "${A64_TRIPLE}-gcc")
+set(CMAKE_CXX_COMPILER "${A64_TRIPLE}-g++")
+
+set(CMAKE_FIND_ROOT_PATH "${A64_SYSROOT}")
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+
+if(A64_TRIPLE MATCHES "musl")
+  set(CMAKE_EXE_LINKER_FLAGS_INIT "-static")
+endif()
+
+set(CMAKE_CROSSCOMPILING_EMULATOR "${A64_QEMU};-L;${A64_SYSROOT}")
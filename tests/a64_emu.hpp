@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * a64_emu: 用于差分验证指令修复结果的 AArch64 微型解释器, 可以在任意主机上运行
+ *
+ * 只实现被覆盖窗口和跳板中会出现的指令子集:
+ *   - 分支: B, BL, B.cond, CBZ/CBNZ, TBZ/TBNZ, BR, BLR, RET
+ *   - 加载: LDR/LDRSW/PRFM (literal), 包括 S/D/Q 浮点寄存器
+ *   - PC 相对地址: ADR, ADRP
+ *   - 整数: ADD/SUB(立即数和移位寄存器, 含 S 变体), MOVN/MOVZ/MOVK, AND/ORR/EOR/ANDS(移位寄存器)
+ *   - NOP 和其他 HINT
+ * 没有存储指令, 内存只读。地址就是主机地址, 只允许读取通过 map() 登记的区域,
+ * 这样指令修复时按主机指针计算的偏移和读取的字面量与解释执行时完全一致。
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * a64_state: 解释器可见的处理器状态
+ *
+ * x[31] 是 SP; 作为 XZR 使用的场合由指令解码决定。
+ */
+struct a64_state
+{
+    uint64_t x[32];
+    uint64_t v[32][2];  // SIMD/FP 寄存器, 低 64 位在 v[i][0]
+    uint64_t pc;
+    uint32_t nzcv;      // bit3..0 = N Z C V
+};
+
+enum a64_emu_result
+{
+    A64_EMU_EXIT,     // PC 离开了执行范围
+    A64_EMU_UNDEF,    // 遇到不支持的指令
+    A64_EMU_FAULT,    // 取指或读取字面量越界
+    A64_EMU_TIMEOUT,  // 超过最大步数(窗口内的循环)
+};
+
+struct a64_emu
+{
+    struct region
+    {
+        uint64_t lo, hi;
+    };
+
+    region   regions[8];
+    int      nregions;
+    uint64_t steps;  // 最近一次 run 执行的指令数
+
+    a64_emu() : nregions(0), steps(0u) {}
+
+    void map(const void *p, const size_t n)
+    {
+        if (nregions < 8) {
+            regions[nregions].lo = reinterpret_cast<uint64_t>(p);
+            regions[nregions].hi = reinterpret_cast<uint64_t>(p) + n;
+            ++nregions;
+        }
+    }
+
+    bool readable(const uint64_t addr, const size_t n) const
+    {
+        for (int i = 0; i < nregions; ++i) {
+            if (addr >= regions[i].lo && addr <= regions[i].hi && n <= regions[i].hi - addr) return true;
+        }
+        return false;
+    }
+
+    /*
+     * run: 从 s.pc 开始执行, 直到 PC 离开 [lo, hi) 或出错
+     */
+    a64_emu_result run(a64_state &s, const uint64_t lo, const uint64_t hi, const uint64_t max_steps)
+    {
+        for (steps = 0u; s.pc >= lo && s.pc < hi; ++steps) {
+            if (steps >= max_steps) return A64_EMU_TIMEOUT;
+            const a64_emu_result r = step(s);
+            if (r != A64_EMU_EXIT) return r;
+        }
+        return A64_EMU_EXIT;
+    }
+
+    static int64_t sext(const uint64_t v, const unsigned bits)
+    {
+        return static_cast<int64_t>(v << (64u - bits)) >> (64u - bits);
+    }
+
+    static uint64_t xreg(const a64_state &s, const uint32_t r)  // r == 31 读作 XZR
+    {
+        return r == 31u ? 0u : s.x[r];
+    }
+
+    static void set_xreg(a64_state &s, const uint32_t r, const uint64_t v, const bool sf)  // r == 31 写入被丢弃
+    {
+        if (r != 31u) s.x[r] = sf ? v : (v & 0xffffffffu);
+    }
+
+    static bool cond_holds(const a64_state &s, const uint32_t cond)
+    {
+        const bool n = (s.nzcv & 8u) != 0u, z = (s.nzcv & 4u) != 0u, c = (s.nzcv & 2u) != 0u, v = (s.nzcv & 1u) != 0u;
+        bool r;
+        switch (cond >> 1) {
+        case 0:  r = z; break;
+        case 1:  r = c; break;
+        case 2:  r = n; break;
+        case 3:  r = v; break;
+        case 4:  r = c && !z; break;
+        case 5:  r = n == v; break;
+        case 6:  r = n == v && !z; break;
+        default: r = true; break;
+        }
+        return (cond & 1u) != 0u && cond != 0xfu ? !r : r;
+    }
+
+    static uint64_t add_with_flags(a64_state &s, const uint64_t a, const uint64_t b, const bool carry_in,
+                                   const bool sf, const bool set_flags)
+    {
+        if (sf) {
+            const uint64_t r = a + b + (carry_in ? 1u : 0u);
+            if (set_flags) {
+                const bool c = r < a || (carry_in && r == a);
+                const bool v = ((~(a ^ b) & (a ^ r)) >> 63) != 0u;
+                s.nzcv = ((r >> 63) << 3) | (r == 0u ? 4u : 0u) | (c ? 2u : 0u) | (v ? 1u : 0u);
+            }
+            return r;
+        }
+        const uint32_t a32 = static_cast<uint32_t>(a), b32 = static_cast<uint32_t>(b);
+        const uint64_t wide = static_cast<uint64_t>(a32) + b32 + (carry_in ? 1u : 0u);
+        const uint32_t r    = static_cast<uint32_t>(wide);
+        if (set_flags) {
+            const bool v = ((~(a32 ^ b32) & (a32 ^ r)) >> 31) != 0u;
+            s.nzcv = ((r >> 31) << 3) | (r == 0u ? 4u : 0u) | ((wide >> 32) != 0u ? 2u : 0u) | (v ? 1u : 0u);
+        }
+        return r;
+    }
+
+    static uint64_t shift_reg(const uint64_t v, const uint32_t type, const uint32_t amount, const bool sf)
+    {
+        const unsigned width = sf ? 64u : 32u;
+        const uint64_t mask  = sf ? ~0ull : 0xffffffffull;
+        const uint64_t x     = v & mask;
+        switch (type) {
+        case 0:  return (x << amount) & mask;
+        case 1:  return x >> amount;
+        case 2:  return static_cast<uint64_t>(sext(x, width) >> amount) & mask;
+        default: return amount == 0u ? x : ((x >> amount) | (x << (width - amount))) & mask;
+        }
+    }
+
+    a64_emu_result step(a64_state &s)
+    {
+        if ((s.pc & 3u) != 0u || !readable(s.pc, 4u)) return A64_EMU_FAULT;
+        uint32_t ins;
+        memcpy(&ins, reinterpret_cast<const void *>(s.pc), sizeof(ins));
+        const uint64_t pc = s.pc;
+        s.pc += 4u;
+
+        const uint32_t rd = ins & 31u, rn = (ins >> 5) & 31u, rm = (ins >> 16) & 31u;
+        const bool     sf = (ins >> 31) != 0u;
+
+        if ((ins & 0x7c000000u) == 0x14000000u) {                        // B / BL
+            if ((ins >> 31) != 0u) s.x[30] = pc + 4u;
+            s.pc = pc + static_cast<uint64_t>(sext(ins & 0x3ffffffu, 26) * 4);
+        } else if ((ins & 0xff000010u) == 0x54000000u) {                 // B.cond
+            if (cond_holds(s, ins & 15u)) s.pc = pc + static_cast<uint64_t>(sext((ins >> 5) & 0x7ffffu, 19) * 4);
+        } else if ((ins & 0x7e000000u) == 0x34000000u) {                 // CBZ / CBNZ
+            const uint64_t v    = sf ? xreg(s, rd) : (xreg(s, rd) & 0xffffffffu);
+            const bool     nz   = ((ins >> 24) & 1u) != 0u;
+            if ((v != 0u) == nz) s.pc = pc + static_cast<uint64_t>(sext((ins >> 5) & 0x7ffffu, 19) * 4);
+        } else if ((ins & 0x7e000000u) == 0x36000000u) {                 // TBZ / TBNZ
+            const uint32_t bit = ((ins >> 31) << 5) | ((ins >> 19) & 31u);
+            const bool     nz  = ((ins >> 24) & 1u) != 0u;
+            if ((((xreg(s, rd) >> bit) & 1u) != 0u) == nz) s.pc = pc + static_cast<uint64_t>(sext((ins >> 5) & 0x3fffu, 14) * 4);
+        } else if ((ins & 0xffdffc1fu) == 0xd61f0000u) {                 // BR / BLR
+            const uint64_t target = xreg(s, rn);
+            if ((ins & 0x00200000u) != 0u) s.x[30] = pc + 4u;
+            s.pc = target;
+        } else if ((ins & 0xfffffc1fu) == 0xd65f0000u) {                 // RET
+            s.pc = xreg(s, rn);
+        } else if ((ins & 0x3b000000u) == 0x18000000u) {                 // LDR (literal)
+            const uint32_t opc  = ins >> 30;
+            const bool     simd = ((ins >> 26) & 1u) != 0u;
+            const uint64_t addr = pc + static_cast<uint64_t>(sext((ins >> 5) & 0x7ffffu, 19) * 4);
+            if (!simd && opc == 3u) return A64_EMU_EXIT;                 // PRFM: 不访问内存
+            if (simd && opc == 3u) return A64_EMU_UNDEF;
+            const size_t size = simd ? (4u << opc) : (opc == 1u ? 8u : 4u);
+            if (!readable(addr, size)) return A64_EMU_FAULT;
+            uint64_t lo = 0u, hi = 0u;
+            memcpy(&lo, reinterpret_cast<const void *>(addr), size < 8u ? size : 8u);
+            if (size == 16u) memcpy(&hi, reinterpret_cast<const void *>(addr + 8u), 8u);
+            if (simd) {
+                s.v[rd][0] = lo;
+                s.v[rd][1] = hi;
+            } else if (opc == 2u) {
+                set_xreg(s, rd, static_cast<uint64_t>(sext(lo, 32)), true);
+            } else {
+                set_xreg(s, rd, lo, opc == 1u);
+            }
+        } else if ((ins & 0x1f000000u) == 0x10000000u) {                 // ADR / ADRP
+            const int64_t imm = sext((((ins >> 5) & 0x7ffffu) << 2) | ((ins >> 29) & 3u), 21);
+            if ((ins >> 31) != 0u) {
+                set_xreg(s, rd, (pc & ~static_cast<uint64_t>(0xfff)) + static_cast<uint64_t>(imm * 4096), true);
+            } else {
+                set_xreg(s, rd, pc + static_cast<uint64_t>(imm), true);
+            }
+        } else if ((ins & 0x1f800000u) == 0x11000000u) {                 // ADD/SUB (immediate)
+            const bool     sub   = ((ins >> 30) & 1u) != 0u;
+            const bool     flags = ((ins >> 29) & 1u) != 0u;
+            uint64_t       imm   = (ins >> 10) & 0xfffu;
+            if (((ins >> 22) & 1u) != 0u) imm <<= 12;
+            const uint64_t a = s.x[rn];                                  // Rn == 31 是 SP
+            const uint64_t r = add_with_flags(s, a, sub ? ~imm : imm, sub, sf, flags);
+            if (flags) set_xreg(s, rd, r, sf);                           // Rd == 31 是 XZR
+            else s.x[rd] = sf ? r : (r & 0xffffffffu);                   // Rd == 31 是 SP
+        } else if ((ins & 0x1f800000u) == 0x12800000u) {                 // MOVN/MOVZ/MOVK
+            const uint32_t opc   = (ins >> 29) & 3u;
+            const uint32_t shift = ((ins >> 21) & 3u) * 16u;
+            const uint64_t imm   = static_cast<uint64_t>((ins >> 5) & 0xffffu) << shift;
+            if (opc == 1u || (!sf && shift >= 32u)) return A64_EMU_UNDEF;
+            if (opc == 0u) set_xreg(s, rd, ~imm, sf);
+            else if (opc == 2u) set_xreg(s, rd, imm, sf);
+            else set_xreg(s, rd, (xreg(s, rd) & ~(0xffffull << shift)) | imm, sf);
+        } else if ((ins & 0x1f000000u) == 0x0a000000u) {                 // AND/ORR/EOR/ANDS (shifted register)
+            const uint32_t amount = (ins >> 10) & 63u;
+            if (!sf && amount >= 32u) return A64_EMU_UNDEF;
+            uint64_t b = shift_reg(xreg(s, rm), (ins >> 22) & 3u, amount, sf);
+            if (((ins >> 21) & 1u) != 0u) b = ~b;
+            const uint64_t a = xreg(s, rn);
+            uint64_t r;
+            switch ((ins >> 29) & 3u) {
+            case 0:  r = a & b; break;
+            case 1:  r = a | b; break;
+            case 2:  r = a ^ b; break;
+            default:
+                r = a & b;
+                r = sf ? r : (r & 0xffffffffu);
+                s.nzcv = (((r >> (sf ? 63 : 31)) & 1u) << 3) | (r == 0u ? 4u : 0u);
+                break;
+            }
+            set_xreg(s, rd, r, sf);
+        } else if ((ins & 0x1f200000u) == 0x0b000000u) {                 // ADD/SUB (shifted register)
+            const uint32_t amount = (ins >> 10) & 63u;
+            const uint32_t type   = (ins >> 22) & 3u;
+            if (type == 3u || (!sf && amount >= 32u)) return A64_EMU_UNDEF;
+            const bool     sub   = ((ins >> 30) & 1u) != 0u;
+            const bool     flags = ((ins >> 29) & 1u) != 0u;
+            const uint64_t b     = shift_reg(xreg(s, rm), type, amount, sf);
+            set_xreg(s, rd, add_with_flags(s, xreg(s, rn), sub ? ~b : b, sub, sf, flags), sf);
+        } else if ((ins & 0xfffff01fu) == 0xd503201fu) {                 // NOP / HINT
+        } else {
+            return A64_EMU_UNDEF;
+        }
+        return A64_EMU_EXIT;
+    }
+};
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * fuzz_relocate: __fix_instructions 和入口补丁形状选择的覆盖率引导模糊测试目标
+ *
+ * 用 -DA64_FUZZ=ON(clang)构建时链接 libFuzzer; 否则自带一个驱动:
+ *   fuzz_relocate <file>...          逐个重放输入文件(AFL: afl-fuzz ... -- fuzz_relocate @@)
+ *   fuzz_relocate --runs n [--seed s] 生成 n 个随机输入
+ *
+ * 输入格式: 第 1 个字节选择模式和位置, 其余字节逐个驱动 tests/reloc_check.hpp 中的生成决策。
+ *   bit0:   0 = 生成窗口(数据指令不读取 X16/X30, 检查差分等价)
+ *           1 = 原始窗口(指令字直接取自输入, 只检查边界和执行终止)
+ *   bit1-2: 跳板位置 near/mid/far
+ *   bit3:   替换函数在 +/-128MB 内(近跳转补丁)或任意 64 位地址(远跳转补丁)
+ *
+ * 窗口大小由 __patch_words 按替换函数地址决定, 与 __hook_function 一致。每个输入检查:
+ *   - 补丁形状: 近跳转 1 条, 远跳转 4 条或 original+2 不对齐时 5 条
+ *   - 跳板大小不超过 __fix_bound, 不写出界
+ *   - 生成窗口的原始执行和跳板执行等价(见 reloc_check.hpp)
+ *   - 写入补丁后从入口执行, 在补丁范围内到达替换函数, 除 X17 外寄存器和 NZCV 不变
+ * 任何一项失败都会 abort(), 以便模糊测试引擎保存输入。
+ */
+#define  A64_HOST_RELOCATOR
+#define  A64_LOG_SINK 0
+#include "../And64InlineHook.cpp"
+#include "reloc_check.hpp"
+
+#include <vector>
+
+static reloc_env *__env;
+
+static void fuzz_fail(const reloc_case &c)
+{
+    dump_failure(0u, c);
+    abort();
+}
+
+/*
+ * check_patch: 写入入口补丁并执行, 检查补丁把控制流交给替换函数且只改写 X17
+ */
+static void check_patch(reloc_case &c, const void *replace)
+{
+    __emit_patch(c.win, replace, c.count);
+
+    a64_state s, before;
+    random_state(s);
+    before = s;
+    s.pc   = reinterpret_cast<uint64_t>(c.win);
+    const uint64_t hi = s.pc + static_cast<uint64_t>(c.count) * 4u;
+    const a64_emu_result r = __env->emu.run(s, s.pc, hi, static_cast<uint64_t>(c.count));
+    c.ro = r;
+    c.o  = s;
+    c.reg = -1;
+    if (r != A64_EMU_EXIT || s.pc != reinterpret_cast<uint64_t>(replace)) {
+        c.what = "entry patch target";
+        fuzz_fail(c);
+    }
+    for (int i = 0; i < 32; ++i) {
+        if (i != 17 && s.x[i] != before.x[i]) {
+            c.what = "x (entry patch)";
+            c.reg  = i;
+            fuzz_fail(c);
+        }
+    }
+    if (s.nzcv != before.nzcv || memcmp(s.v, before.v, sizeof(s.v)) != 0) {
+        c.what = "entry patch state";
+        fuzz_fail(c);
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (__env == NULL) {
+        static reloc_env env;
+        rng_seed(0x5eedu);  // 源镜像内容与输入无关, 保证可以重放
+        if (!reloc_env_init(env)) abort();
+        __env = &env;
+    }
+    if (size == 0u) return 0;
+
+    const uint8_t   mode = data[0];
+    const bool      raw  = (mode & 1u) != 0u;
+    const placement p    = static_cast<placement>(((mode >> 1) & 3u) % PLACEMENTS);
+    rng_input(data + 1, size - 1u);
+
+    reloc_case c;
+    place_window(*__env, c, p, 1);
+
+    // 替换函数地址: 近跳转时避开窗口本身, 保证补丁执行后 PC 离开窗口
+    uintptr_t replace;
+    if ((mode & 8u) == 0u) {
+        const int64_t delta = (static_cast<int64_t>(rnd(1u << 25)) - (1 << 24) + 8) * 4;
+        replace = reinterpret_cast<uintptr_t>(c.win) + static_cast<uintptr_t>(delta);
+    } else {
+        replace = static_cast<uintptr_t>(rnd()) & ~static_cast<uintptr_t>(3u);
+    }
+    c.count = __patch_words(c.win, reinterpret_cast<void *>(replace));
+
+    const int64_t distance = static_cast<int64_t>(replace - reinterpret_cast<uintptr_t>(c.win)) >> 2;
+    const bool    near     = llabs(distance) < static_cast<int64_t>(0x03ffffffu >> 1);
+    const int32_t expect   = near ? 1 : ((reinterpret_cast<uintptr_t>(c.win + 2) & 7u) != 0u ? 5 : 4);
+    if (c.count != expect) {
+        c.what = "patch shape";
+        c.bytes = 0u;
+        fuzz_fail(c);
+    }
+    if (replace >= reinterpret_cast<uintptr_t>(c.win) && replace < reinterpret_cast<uintptr_t>(c.win + c.count)) {
+        return 0;
+    }
+
+    if (raw) {
+        for (int32_t i = 0; i < c.count; ++i) c.win[i] = static_cast<uint32_t>(rng_bytes(4u));
+    } else {
+        gen_window(c, NULL);
+    }
+    if (check_case(*__env, c, !raw) == CHECK_FAIL) fuzz_fail(c);
+
+    check_patch(c, reinterpret_cast<void *>(replace));
+    return 0;
+}
+
+#if !defined(A64_LIBFUZZER)
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    uint8_t buf[4096];
+    size_t  n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    const bool ok = ferror(fp) == 0;
+    fclose(fp);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t runs = 0u, seed = 1u;
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [--runs n] [--seed s] [file...]\n", argv[0]);
+            return 2;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::vector<uint8_t> data;
+        if (!read_file(files[i], data)) {
+            fprintf(stderr, "failed to read %s\n", files[i]);
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+
+    // 随机输入: 输入的生成和 LLVMFuzzerTestOneInput 内部都使用 reloc_check 的随机数来源,
+    // 这里用独立的 splitmix64 状态生成字节
+    uint64_t state = seed;
+    std::vector<uint8_t> input;
+    for (uint64_t n = 0; n < runs; ++n) {
+        input.resize(1u + static_cast<size_t>(n % 96u));
+        for (size_t i = 0; i < input.size(); ++i) {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            input[i] = static_cast<uint8_t>(z ^ (z >> 31));
+        }
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    printf("fuzz_relocate: %zu files, %" PRIu64 " random inputs, no failures\n", files.size(), runs);
+    return 0;
+}
+#endif // !A64_LIBFUZZER
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * hook_test: 基本功能测试, 可以在真机上运行, 也可以在 x86-64 主机上通过 qemu-aarch64 运行
+ *
+ * 环境变量 A64_CPU_FEATURES=<mask> 把使用的 CPU 特性限制为 mask(见 A64SetCpuFeatures), 0 走全部 ARMv8.0 回退路径。
+ *
+ * 覆盖近跳转(B)和远跳转(LDR/BR)两种入口改写方式、通过跳板调用原函数、
+ * 自定义跳板缓冲区(A64HookFunctionV/VX)、启用/停用/移除、注册表内容、A64HookDescribe、探针的调用计数、
+ * BRK 陷阱 Hook、一次性覆盖率探针、内联代码片段、闭包 Hook、通用处理函数、系统调用位置拦截以及基本块计数。
+ */
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../And64InlineHook.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond) do {                                                  \
+    if (!(cond)) {                                                        \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        ++failures;                                                       \
+    }                                                                     \
+} while (0)
+
+typedef int (*int_fn)(int);
+
+// 通过 volatile 函数指针调用, 防止编译器内联或常量折叠
+static int call(int_fn volatile fn, int x)
+{
+    return fn(x);
+}
+
+extern "C" __attribute__((noinline)) int near_target(int x)
+{
+    __asm__ __volatile__("");
+    return x + 1;
+}
+
+static int_fn near_orig;
+static int near_replace(int x)
+{
+    return near_orig(x) * 10;
+}
+
+extern "C" __attribute__((noinline)) int v_target(int x)
+{
+    __asm__ __volatile__("");
+    return x * 3;
+}
+
+static int_fn v_orig;
+static int v_replace(int x)
+{
+    return v_orig(x) + 7;
+}
+
+extern "C" __attribute__((noinline)) int vx_target(int x)
+{
+    __asm__ __volatile__("");
+    return x * 5;
+}
+
+static int_fn vx_orig;
+static int vx_replace(int x)
+{
+    return vx_orig(x) + 9;
+}
+
+extern "C" __attribute__((noinline)) int probe_target(int x)
+{
+    __asm__ __volatile__("");
+    return x ^ 0x55;
+}
+
+extern "C" __attribute__((noinline)) int cover_hit(int x)
+{
+    __asm__ __volatile__("");
+    return x - 2;
+}
+
+extern "C" __attribute__((noinline)) int cover_miss(int x)
+{
+    __asm__ __volatile__("");
+    return x + 2;
+}
+
+// 只有两条指令(add + ret), 放不下远跳转补丁
+extern "C" __attribute__((noinline)) int trap_target(int x)
+{
+    return x + 9;
+}
+
+static int_fn trap_orig;
+static int trap_replace(int x)
+{
+    return trap_orig(x) * 2;
+}
+
+extern "C" __attribute__((noinline)) int snippet_target(int x)
+{
+    __asm__ __volatile__("");
+    return x * 3;
+}
+
+// cbz w0, end; add w0, w0, #100; mov x19, #7; end:
+static const uint32_t snippet_code[3] = { 0x34000060u, 0x11019000u, 0xd28000f3u };
+
+extern "C" __attribute__((noinline)) int closure_a(int x)
+{
+    __asm__ __volatile__("");
+    return x + 1;
+}
+
+extern "C" __attribute__((noinline)) int closure_b(int x)
+{
+    __asm__ __volatile__("");
+    return x + 2;
+}
+
+extern "C" __attribute__((noinline)) int lambda_target(int x)
+{
+    __asm__ __volatile__("");
+    return x * 5;
+}
+
+struct closure_state
+{
+    int_fn orig;
+    int    bias;
+};
+
+// closure_a 和 closure_b 共用的处理函数, 以第一个参数 data 区分
+static int closure_handler(void *data, int x)
+{
+    const closure_state *s = static_cast<const closure_state *>(data);
+    return s->orig(x) + s->bias;
+}
+
+extern "C" __attribute__((noinline)) int universal_a(int x)
+{
+    __asm__ __volatile__("");
+    return x + 1;
+}
+
+extern "C" __attribute__((noinline)) int universal_b(int x)
+{
+    __asm__ __volatile__("");
+    return x + 2;
+}
+
+static uint32_t universal_last = 0u;
+static void universal_handler(uint32_t id, A64UniversalRegs *regs)
+{
+    universal_last = id;
+    regs->x[0] *= 10u;
+}
+
+static int syscall_getpid_calls = 0;
+static int syscall_pre(uint64_t, A64SyscallRegs *regs)
+{
+    if (regs->x[8] == 172u) ++syscall_getpid_calls;  // getpid
+    if (regs->x[8] != 173u) return 0;                // getppid
+    regs->x[0] = 12345u;
+    return 1;
+}
+
+// 模块路径中包含 "libc.so" 时返回 1, 停止 dl_iterate_phdr
+static int has_libc(struct dl_phdr_info *info, size_t, void *)
+{
+    return info->dlpi_name != NULL && strstr(info->dlpi_name, "libc.so") != NULL ? 1 : 0;
+}
+
+/*
+ * blocks_target: 求 n + (n - 1) + ... + 1, 用汇编写出以确定大小和基本块:
+ * 入口 [0, 8), 循环体 [8, 20), 出口 [20, 28)
+ */
+__asm__(".text\n"
+        ".balign 4\n"
+        ".global blocks_target\n"
+        "blocks_target:\n"
+        "    mov  w1, #0\n"
+        "    cbz  w0, 2f\n"
+        "1:  add  w1, w1, w0\n"
+        "    subs w0, w0, #1\n"
+        "    b.ne 1b\n"
+        "2:  mov  w0, w1\n"
+        "    ret\n");
+extern "C" int blocks_target(int n);
+
+static int_fn far_orig;
+static int far_replace(int x)
+{
+    return far_orig(x) + 1000;
+}
+
+/*
+ * make_far_function: 在距离本模块 4GB 左右的位置生成 "x + 4" 函数, 以触发远跳转改写
+ */
+static int_fn make_far_function()
+{
+    const uintptr_t hint = (reinterpret_cast<uintptr_t>(&near_target) + (1ull << 32)) & ~static_cast<uintptr_t>(0xfff);
+    void *page = mmap(reinterpret_cast<void *>(hint), 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) return NULL;
+
+    static const uint32_t code[] = {
+        0x11000400u, // add w0, w0, #1
+        0x11000400u, // add w0, w0, #1
+        0x11000400u, // add w0, w0, #1
+        0x11000400u, // add w0, w0, #1
+        0xd65f03c0u, // ret
+        0xd503201fu, // nop
+    };
+    memcpy(page, code, sizeof(code));
+    __builtin___clear_cache(static_cast<char *>(page), static_cast<char *>(page) + sizeof(code));
+    return reinterpret_cast<int_fn>(page);
+}
+
+/*
+ * find_entry: 在注册表中查找 symbol 对应的条目
+ */
+static bool find_entry(const void *symbol, A64HookStatsEntry *out)
+{
+    const A64HookStats *stats = A64StatsGet();
+    if (stats == NULL) return false;
+    for (uint32_t i = 0; i < stats->count; ++i) {
+        if (A64StatsReadEntry(stats, i, out) && out->symbol == reinterpret_cast<uintptr_t>(symbol)) return true;
+    }
+    return false;
+}
+
+int main()
+{
+    A64HookStatsEntry e;
+
+    const char *features = getenv("A64_CPU_FEATURES");
+    if (features != NULL) {
+        const uint32_t mask = static_cast<uint32_t>(strtoul(features, NULL, 0));
+        CHECK((A64SetCpuFeatures(mask) & ~mask) == 0u);
+    }
+
+    // 近跳转: 目标与替换函数在同一模块内
+    CHECK(call(near_target, 4) == 5);
+    A64HookFunction(reinterpret_cast<void *>(near_target), reinterpret_cast<void *>(near_replace),
+                    reinterpret_cast<void **>(&near_orig));
+    CHECK(near_orig != NULL);
+    CHECK(call(near_target, 4) == 50);
+    CHECK(call(near_orig, 4) == 5);
+    CHECK(find_entry(reinterpret_cast<void *>(near_target), &e) && e.patch_shape == A64_PATCH_NEAR);
+
+    // 启用/停用/移除
+    const int near_id = A64HookFind(reinterpret_cast<void *>(near_target));
+    CHECK(near_id >= 0);
+    CHECK(A64HookSetEnabled(near_id, 0) == 0 && call(near_target, 4) == 5);
+    CHECK(A64HookSetEnabled(near_id, 1) == 0 && call(near_target, 4) == 50);
+    CHECK(A64UnhookFunction(near_id) == 0 && call(near_target, 4) == 5);
+    CHECK(A64HookSetEnabled(near_id, 1) == -1 && call(near_target, 4) == 5);
+
+    // 自定义跳板缓冲区
+    static uint32_t rwx[64] __attribute__((aligned(16)));
+    mprotect(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(rwx) & ~static_cast<uintptr_t>(0xfff)),
+             8192, PROT_READ | PROT_WRITE | PROT_EXEC);
+    v_orig = reinterpret_cast<int_fn>(A64HookFunctionV(reinterpret_cast<void *>(v_target),
+                                                       reinterpret_cast<void *>(v_replace), rwx, sizeof(rwx)));
+    CHECK(v_orig == reinterpret_cast<int_fn>(rwx));
+    CHECK(call(v_target, 5) == 22);
+
+    // 写入/执行地址分离的跳板: 同一个 memfd 分别映射为 RW 和 RX
+    const int memfd = static_cast<int>(syscall(__NR_memfd_create, "a64_vx", 0));
+    CHECK(memfd >= 0 && ftruncate(memfd, 4096) == 0);
+    void *const vx_rw = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    void *const vx_rx = mmap(NULL, 4096, PROT_READ | PROT_EXEC, MAP_SHARED, memfd, 0);
+    CHECK(vx_rw != MAP_FAILED && vx_rx != MAP_FAILED);
+    vx_orig = reinterpret_cast<int_fn>(A64HookFunctionVX(reinterpret_cast<void *>(vx_target),
+                                                         reinterpret_cast<void *>(vx_replace), vx_rw, vx_rx, 4096));
+    CHECK(vx_orig == reinterpret_cast<int_fn>(vx_rx));
+    CHECK(call(vx_target, 5) == 34);
+
+    // 远跳转: 目标距离替换函数超过 128MB
+    int_fn far_target = make_far_function();
+    CHECK(far_target != NULL);
+    if (far_target != NULL) {
+        CHECK(call(far_target, 1) == 5);
+        A64HookFunction(reinterpret_cast<void *>(far_target), reinterpret_cast<void *>(far_replace),
+                        reinterpret_cast<void **>(&far_orig));
+        CHECK(call(far_target, 1) == 1005);
+        CHECK(call(far_orig, 1) == 5);
+        const intptr_t distance = reinterpret_cast<intptr_t>(far_target) - reinterpret_cast<intptr_t>(far_replace);
+        if (distance > 0x7ffffff || distance < -0x8000000) {
+            CHECK(find_entry(reinterpret_cast<void *>(far_target), &e) && e.patch_shape == A64_PATCH_FAR);
+
+            // 描述: 远跳转补丁反汇编为 LDR X17 + BR X17, 截断时仍返回完整长度
+            char desc[4096];
+            const int far_id = A64HookFind(reinterpret_cast<void *>(far_target));
+            const int n = A64HookDescribe(far_id, desc, sizeof(desc));
+            CHECK(n > 0 && n < static_cast<int>(sizeof(desc)) && strstr(desc, "br x17") != NULL && strstr(desc, "map: [0]+0x") != NULL);
+            CHECK(A64HookDescribe(far_id, desc, 8u) == n && strlen(desc) == 7u);
+        }
+        CHECK(A64HookDescribe(-1, NULL, 0u) == -1);
+    }
+
+    // 探针: 调用计数写入注册表
+    int_fn probe_orig = NULL;
+    const int id = A64ProbeFunction(reinterpret_cast<void *>(probe_target), "probe_target", 0u,
+                                    reinterpret_cast<void **>(&probe_orig));
+    CHECK(id >= 0);
+    for (int i = 0; i < 100; ++i) CHECK(call(probe_target, i) == (i ^ 0x55));
+    CHECK(call(probe_orig, 1) == (1 ^ 0x55));
+    if (id >= 0) {
+        const A64HookStats *stats = A64StatsGet();
+        CHECK(A64StatsEntryAt(stats, static_cast<uint32_t>(id))->calls == 100u);
+    }
+
+    // BRK 陷阱 Hook: 经 SIGTRAP 转到替换函数, 停用后恢复原始入口
+    const int trap_id = A64TrapHookFunction(reinterpret_cast<void *>(trap_target), reinterpret_cast<void *>(trap_replace),
+                                            reinterpret_cast<void **>(&trap_orig));
+    CHECK(trap_id >= 0 && trap_orig != NULL);
+    CHECK(call(trap_target, 1) == 20 && call(trap_orig, 1) == 10);
+    CHECK(A64HookSetEnabled(trap_id, 0) == 0 && call(trap_target, 1) == 10);
+    CHECK(A64HookSetEnabled(trap_id, 1) == 0 && call(trap_target, 2) == 22);
+
+    // 一次性覆盖率探针: 第一次调用置位并恢复原始入口
+    uint64_t covered[1] = { 0u };
+    void *const cover[2] = { reinterpret_cast<void *>(cover_hit), reinterpret_cast<void *>(cover_miss) };
+    const uint32_t cover_entry = *reinterpret_cast<const uint32_t *>(cover_hit);
+    CHECK(A64CoverageInstall(cover, 2, covered) == 2);
+    CHECK(*reinterpret_cast<const uint32_t *>(cover_hit) != cover_entry && covered[0] == 0u);
+    CHECK(call(cover_hit, 5) == 3 && covered[0] == 1u);
+    CHECK(*reinterpret_cast<const uint32_t *>(cover_hit) == cover_entry);
+    CHECK(call(cover_hit, 6) == 4 && covered[0] == 1u);
+
+    // 内联代码片段: 修改参数后继续执行原函数, 跳到片段末尾的分支落在恢复寄存器之前
+    const int snippet_id = A64HookInjectSnippet(reinterpret_cast<void *>(snippet_target), snippet_code,
+                                                sizeof(snippet_code), 1u << 19);
+    CHECK(snippet_id >= 0);
+    CHECK(call(snippet_target, 1) == 303 && call(snippet_target, 0) == 0);
+    CHECK(A64HookSetEnabled(snippet_id, 0) == 0 && call(snippet_target, 1) == 3);
+    CHECK(A64HookSetEnabled(snippet_id, 1) == 0 && call(snippet_target, 2) == 306);
+
+    // 闭包: 两个 Hook 共用一个处理函数, lambda 的捕获作为私有数据
+    static closure_state state_a = { NULL, 100 }, state_b = { NULL, 200 };
+    CHECK(A64HookClosure(reinterpret_cast<void *>(closure_a), reinterpret_cast<void *>(closure_handler), &state_a,
+                         reinterpret_cast<void **>(&state_a.orig)) >= 0);
+    CHECK(A64HookClosure(reinterpret_cast<void *>(closure_b), reinterpret_cast<void *>(closure_handler), &state_b,
+                         reinterpret_cast<void **>(&state_b.orig)) >= 0);
+    CHECK(call(closure_a, 1) == 102 && call(closure_b, 1) == 203);
+
+    static int_fn lambda_orig;
+    int lambda_calls = 0;
+    CHECK(A64HookLambda(lambda_target, [&lambda_calls](int x) { ++lambda_calls; return lambda_orig(x) + 7; },
+                        &lambda_orig) >= 0);
+    CHECK(call(lambda_target, 2) == 17 && call(lambda_target, 3) == 22 && lambda_calls == 2);
+
+    // 通用处理函数: 按 id 区分函数, 修改参数后继续执行原函数
+    A64MemoryStats mem0, mem1;
+    A64GetMemoryStats(&mem0);
+    void *const universal[2] = { reinterpret_cast<void *>(universal_a), reinterpret_cast<void *>(universal_b) };
+    CHECK(A64UniversalHook(universal, 2, universal_handler, 40u) == 2);
+    CHECK(call(universal_a, 1) == 11 && universal_last == 40u);
+    CHECK(call(universal_b, 1) == 12 && universal_last == 41u);
+
+    // 探针和通用处理函数共用桩代码区域, 每个 Hook 只增加数据块和跳板
+    A64GetMemoryStats(&mem1);
+    CHECK(mem1.arena_sites == mem0.arena_sites + 2u && mem1.arena_used - mem0.arena_used <= 2u * 96u);
+
+    // 系统调用位置拦截: pre 计数 getpid, 并跳过 getppid 直接给出结果
+    // 静态链接时没有 libc.so 模块, 明确跳过; 动态链接的 libc(glibc 的 libc.so.6 也匹配)中一定有 SVC
+    if (dl_iterate_phdr(has_libc, NULL) != 0) {
+        const int syscall_sites = A64SyscallHook("libc.so", syscall_pre, NULL);
+        CHECK(syscall_sites > 0);
+        const pid_t pid = getpid();
+        CHECK(pid > 0 && syscall_getpid_calls >= 1 && getppid() == 12345);
+    } else {
+        printf("skipped: no libc.so module loaded, A64SyscallHook not tested\n");
+    }
+
+    // 基本块计数: 重写整个函数, 每个块的执行次数
+    A64BlockProfile prof;
+    CHECK(A64HookBlocks(reinterpret_cast<void *>(blocks_target), 7u * sizeof(uint32_t), &prof) >= 0);
+    CHECK(prof.blocks == 3u && prof.offsets[0] == 0u && prof.offsets[1] == 8u && prof.offsets[2] == 20u);
+    CHECK(call(blocks_target, 4) == 10 && call(blocks_target, 0) == 0);
+    CHECK(prof.counters[0] == 2u && prof.counters[1] == 4u && prof.counters[2] == 2u);
+
+    A64InstallStats total;
+    A64GetInstallStats(&total);
+    CHECK(total.hooks >= 10u && total.failures == 0u);
+
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
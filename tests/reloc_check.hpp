@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * reloc_check: reloc_verify 和 fuzz_relocate 共用的用例生成与差分检查
+ *
+ * 使用前必须先定义 A64_HOST_RELOCATOR 并以源码方式包含 And64InlineHook.cpp。
+ *
+ * 随机窗口由整数运算、各类分支、字面量加载、ADR/ADRP 组成, 放入一块填充随机数据的源镜像,
+ * 再修复到三种位置的暂存缓冲区:
+ *   near: 与窗口相距不到 1MB, 所有 PC 相对引用都可以直接改写偏移
+ *   mid:  相距约 64MB, 只有 B/BL 还能直接改写, 其余都要扩展
+ *   far:  相距约 8GB, 所有引用都要扩展为绝对地址序列
+ * 然后用 a64_emu 从同一个随机寄存器状态分别执行原始窗口(直到 PC 离开窗口)
+ * 和跳板(直到 PC 离开跳板), 比较离开时的 PC、通用寄存器、SIMD 寄存器和 NZCV。
+ *
+ * 允许的差异:
+ *   X17(IP1): 跳板用于远跳转的临时寄存器
+ *   X30(LR):  BL 写入的返回地址, 原始执行中指向窗口内, 跳板执行中指向跳板内
+ *   X16(IP0): 目标在窗口内的 ADR 固定写入 X16, 修复后同样指向跳板内的对应指令
+ * 数据指令不读取 X16/X30, 它们只用于 BR/BLR/RET, 以验证跳回窗口内的地址映射。
+ * 原始窗口中的循环在 64 步后视为超时, 此时只要求跳板执行不出现未定义指令或越界访问。
+ */
+#pragma once
+
+#include "a64_emu.hpp"
+
+#define IMAGE_BYTES    (4u << 20)    // 源镜像, 窗口在中间, 字面量引用(+/-1MB)不会越界
+#define WINDOW_OFFSET  (2u << 20)    // 窗口区域 [2MB, 2.5MB)
+#define WINDOW_SPAN    (1u << 19)
+#define NEAR_OFFSET    0x1f0000u     // near 暂存区在镜像内, 紧挨窗口区域
+#define SCRATCH_BYTES  4096u
+#define ORIGINAL_STEPS 64u
+
+enum placement { NEAR, MID, FAR, PLACEMENTS };
+static const char *const placement_names[PLACEMENTS] = { "near", "mid", "far" };
+
+enum insn_kind { K_ALU_IMM, K_MOVE_WIDE, K_LOGICAL, K_ALU_REG, K_BRANCH, K_COND, K_COMPARE, K_TEST,
+                 K_LITERAL, K_ADR, K_NOP, K_REG_BRANCH, KINDS };
+static const char *const kind_names[KINDS] = { "alu_imm", "move_wide", "logical", "alu_reg", "branch", "cond",
+                                               "compare", "test", "literal", "adr", "nop", "reg_branch" };
+
+/*
+ * 随机数来源: 种子驱动的 splitmix64, 或者逐字节消耗的输入数据
+ *
+ * 输入数据用完后固定返回 0, 保证同一份输入总是生成同一个用例。
+ */
+struct rng_source
+{
+    uint64_t       state;
+    const uint8_t *data;
+    size_t         left;
+};
+
+static rng_source __rng;
+
+static void rng_seed(const uint64_t seed)
+{
+    __rng.state = seed;
+    __rng.data  = NULL;
+    __rng.left  = 0u;
+}
+
+static inline void rng_input(const uint8_t *data, const size_t size)
+{
+    __rng.data = data;
+    __rng.left = size;
+}
+
+static uint64_t rng_bytes(const unsigned n)
+{
+    if (__rng.data != NULL) {
+        uint64_t v = 0u;
+        for (unsigned i = 0; i < n && __rng.left != 0u; ++i, --__rng.left) {
+            v |= static_cast<uint64_t>(*__rng.data++) << (i * 8u);
+        }
+        return v;
+    }
+    uint64_t z = (__rng.state += 0x9e3779b97f4a7c15ull);  // splitmix64
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rnd()
+{
+    return rng_bytes(8u);
+}
+
+static uint32_t rnd(const uint32_t n)
+{
+    // 输入数据只消耗表示 [0, n) 所需的字节数
+    const unsigned bytes = n <= 0x100u ? 1u : n <= 0x10000u ? 2u : n <= 0x1000000u ? 3u : 4u;
+    return static_cast<uint32_t>(rng_bytes(bytes) % n);
+}
+
+/*
+ * branch_delta: 分支偏移(以指令为单位), 偏向窗口内部和窗口边缘, 也覆盖整个立即数范围
+ */
+static int64_t branch_delta(const int32_t idx, const int32_t count, const unsigned bits)
+{
+    const int64_t limit = (1ll << (bits - 1)) - 1;
+    switch (rnd(4u)) {
+    case 0:
+    case 1:  return static_cast<int64_t>(rnd(static_cast<uint32_t>(count + 1))) - idx;  // 窗口内, 包括窗口末尾
+    case 2:  return static_cast<int64_t>(rnd(static_cast<uint32_t>(count + 16))) - idx - 8;
+    default: return static_cast<int64_t>(rnd() % static_cast<uint64_t>(2 * limit + 1)) - limit;
+    }
+}
+
+#define CODE_REG 16u  // 目标在窗口内的 ADR 写入的寄存器
+
+/*
+ * data_reg: 数据指令的寄存器操作数, 不使用 X16/X30
+ *
+ * 这两个寄存器中的代码地址在原始执行和跳板执行中不同(见文件头), 如果再作为数据参与运算,
+ * 差异会传播到其他寄存器。
+ */
+static uint32_t data_reg()
+{
+    const uint32_t r = rnd(30u);
+    return r == CODE_REG ? 31u : r;
+}
+
+static bool is_code_reg(const int r)
+{
+    return r == static_cast<int>(CODE_REG) || r == 30;
+}
+
+static uint32_t gen_insn(const insn_kind k, const int32_t idx, const int32_t count)
+{
+    const uint32_t sf = rnd(2u), rd = data_reg(), rn = data_reg(), rm = data_reg();
+    switch (k) {
+    case K_ALU_IMM:
+        return (sf << 31) | (rnd(4u) << 29) | 0x11000000u | (rnd(2u) << 22) | (rnd(4096u) << 10) | (rn << 5) | rd;
+    case K_MOVE_WIDE: {
+        static const uint32_t opcs[3] = { 0u, 2u, 3u };
+        return (sf << 31) | (opcs[rnd(3u)] << 29) | 0x12800000u | (rnd(sf ? 4u : 2u) << 21)
+             | (static_cast<uint32_t>(rnd() & 0xffffu) << 5) | rd;
+    }
+    case K_LOGICAL:
+        return (sf << 31) | (rnd(4u) << 29) | 0x0a000000u | (rnd(4u) << 22) | (rnd(2u) << 21) | (rm << 16)
+             | (rnd(sf ? 64u : 32u) << 10) | (rn << 5) | rd;
+    case K_ALU_REG:
+        return (sf << 31) | (rnd(4u) << 29) | 0x0b000000u | (rnd(3u) << 22) | (rm << 16)
+             | (rnd(sf ? 64u : 32u) << 10) | (rn << 5) | rd;
+    case K_BRANCH:
+        return (rnd(2u) << 31) | 0x14000000u | (static_cast<uint32_t>(branch_delta(idx, count, 26)) & 0x3ffffffu);
+    case K_COND:
+        return 0x54000000u | ((static_cast<uint32_t>(branch_delta(idx, count, 19)) & 0x7ffffu) << 5) | rnd(16u);
+    case K_COMPARE:
+        return (sf << 31) | 0x34000000u | (rnd(2u) << 24) | ((static_cast<uint32_t>(branch_delta(idx, count, 19)) & 0x7ffffu) << 5) | rd;
+    case K_TEST: {
+        const uint32_t bit = rnd(64u);
+        return ((bit >> 5) << 31) | 0x36000000u | (rnd(2u) << 24) | ((bit & 31u) << 19)
+             | ((static_cast<uint32_t>(branch_delta(idx, count, 14)) & 0x3fffu) << 5) | rd;
+    }
+    case K_LITERAL: {
+        // W, X, SW, PRFM, S, D, Q; 字面量可以在窗口内(读取指令本身)或 +/-1MB 内的任意位置
+        static const uint32_t forms[7] = { 0x18000000u, 0x58000000u, 0x98000000u, 0xd8000000u,
+                                           0x1c000000u, 0x5c000000u, 0x9c000000u };
+        const int64_t delta = rnd(2u) != 0u ? static_cast<int64_t>(rnd(static_cast<uint32_t>(count + 2))) - idx
+                                            : static_cast<int64_t>(rnd(1u << 19)) - (1 << 18);
+        return forms[rnd(7u)] | ((static_cast<uint32_t>(delta) & 0x7ffffu) << 5) | rd;
+    }
+    case K_ADR: {
+        const uint32_t op  = rnd(2u);
+        const uint32_t imm = op == 0u && rnd(4u) == 0u ? static_cast<uint32_t>((rnd(static_cast<uint32_t>(count)) - idx) * 4)
+                                                       : static_cast<uint32_t>(rnd());
+        const int64_t  off = a64_emu::sext(imm & 0x1fffffu, 21);
+        const bool     in_window = op == 0u && off >= -idx * 4 && off < (count - idx) * 4;
+        return (op << 31) | ((imm & 3u) << 29) | 0x10000000u | (((imm >> 2) & 0x7ffffu) << 5) | (in_window ? CODE_REG : rd);
+    }
+    case K_NOP:
+        return A64_NOP;
+    default: {
+        static const uint32_t forms[3] = { 0xd61f0000u, 0xd63f0000u, 0xd65f0000u };  // BR, BLR, RET
+        static const uint32_t regs[3] = { CODE_REG, 30u, 0u };
+        const uint32_t r = rnd(3u);
+        return forms[rnd(3u)] | ((r < 2u ? regs[r] : rnd(32u)) << 5);
+    }
+    }
+}
+
+static insn_kind pick_kind()
+{
+    // 分支和字面量加载是修复的重点, 权重更高; 寄存器跳转几乎总是离开窗口, 权重最低
+    static const uint8_t weights[KINDS] = { 8, 6, 6, 6, 10, 10, 8, 8, 12, 8, 3, 1 };
+    uint32_t r = rnd(86u);
+    for (int k = 0; k < KINDS; ++k) {
+        if (r < weights[k]) return static_cast<insn_kind>(k);
+        r -= weights[k];
+    }
+    return K_NOP;
+}
+
+static void random_state(a64_state &s)
+{
+    for (int i = 0; i < 32; ++i) {
+        switch (rnd(8u)) {
+        case 0:  s.x[i] = 0u; break;                            // 覆盖 CBZ/TBZ 的两个方向
+        case 1:  s.x[i] = rnd(16u); break;
+        case 2:  s.x[i] = ~static_cast<uint64_t>(rnd(16u)); break;
+        default: s.x[i] = rnd(); break;
+        }
+        s.v[i][0] = rnd();
+        s.v[i][1] = rnd();
+    }
+    s.nzcv = rnd(16u);
+}
+
+struct reloc_env
+{
+    uint8_t  *image;
+    uint32_t *scratch[PLACEMENTS];
+    a64_emu   emu;
+};
+
+/*
+ * reloc_env_init: 分配源镜像和暂存缓冲区, 镜像用当前随机数来源填充
+ */
+static bool reloc_env_init(reloc_env &env)
+{
+    env.image = static_cast<uint8_t *>(mmap(NULL, IMAGE_BYTES, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (env.image == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    env.scratch[NEAR] = reinterpret_cast<uint32_t *>(env.image + NEAR_OFFSET);
+    for (int p = MID; p < PLACEMENTS; ++p) {
+        void *hint = env.image + (p == MID ? (64ull << 20) : (8ull << 30));
+        void *m    = mmap(hint, SCRATCH_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+        if (m != hint) fprintf(stderr, "warning: %s scratch placed at %p instead of %p\n", placement_names[p], m, hint);
+        env.scratch[p] = static_cast<uint32_t *>(m);
+    }
+    for (size_t i = 0; i < IMAGE_BYTES / sizeof(uint64_t); ++i) {
+        reinterpret_cast<uint64_t *>(env.image)[i] = rnd();
+    }
+    env.emu.map(env.image, IMAGE_BYTES);
+    env.emu.map(env.scratch[MID], SCRATCH_BYTES);
+    env.emu.map(env.scratch[FAR], SCRATCH_BYTES);
+    return true;
+}
+
+struct reloc_case
+{
+    placement      p;
+    int32_t        count;
+    uint32_t      *win;
+    uint32_t      *tr;
+    uintptr_t      bytes;
+    a64_state      o, t;
+    a64_emu_result ro, rt;
+    const char    *what;  // 失败原因
+    int            reg;   // 不一致的寄存器, -1 表示无
+};
+
+enum check_result { CHECK_PASS, CHECK_LOOP, CHECK_SKIP, CHECK_FAIL };
+
+/*
+ * place_window: 在窗口区域中选择窗口位置和跳板位置(跳板起点覆盖 16 种 8/16 字节对齐情况)
+ */
+static void place_window(reloc_env &env, reloc_case &c, const placement p, const int32_t count)
+{
+    c.p     = p;
+    c.count = count;
+    c.win   = reinterpret_cast<uint32_t *>(env.image + WINDOW_OFFSET + rnd(WINDOW_SPAN / 4u) * 4u);
+    c.tr    = env.scratch[p] + rnd(16u);
+}
+
+static void gen_window(reloc_case &c, uint64_t *kinds)
+{
+    for (int32_t i = 0; i < c.count; ++i) {
+        const insn_kind k = pick_kind();
+        if (kinds != NULL) ++kinds[k];
+        c.win[i] = gen_insn(k, i, c.count);
+    }
+}
+
+static bool compare(reloc_case &c)
+{
+    const a64_state &o = c.o, &t = c.t;
+    const uint64_t win_lo = reinterpret_cast<uint64_t>(c.win), win_hi = win_lo + static_cast<uint64_t>(c.count) * 4u;
+    const uint64_t tr_lo  = reinterpret_cast<uint64_t>(c.tr), tr_hi = tr_lo + c.bytes;
+    if (o.pc != t.pc) {
+        c.what = "exit pc";
+        return false;
+    }
+    for (int i = 0; i < 32; ++i) {
+        if (i == 17 || o.x[i] == t.x[i]) continue;
+        if (is_code_reg(i) && o.x[i] >= win_lo && o.x[i] <= win_hi && t.x[i] >= tr_lo && t.x[i] <= tr_hi) continue;
+        c.what = "x";
+        c.reg  = i;
+        return false;
+    }
+    for (int i = 0; i < 32; ++i) {
+        if (o.v[i][0] != t.v[i][0] || o.v[i][1] != t.v[i][1]) {
+            c.what = "v";
+            c.reg  = i;
+            return false;
+        }
+    }
+    if (o.nzcv != t.nzcv) {
+        c.what = "nzcv";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * check_case: 修复窗口并执行检查
+ *
+ * 总是检查跳板大小不超过 __fix_bound 且没有写出界; equivalence 为 false 时
+ * (任意输入的窗口, 数据指令可能读取 X16/X30)只执行两边而不比较结果。
+ */
+static check_result check_case(reloc_env &env, reloc_case &c, const bool equivalence)
+{
+    static const uint32_t canary = 0xa5a5a5a5u;
+    const uintptr_t bound = __fix_bound(c.count);
+    for (uintptr_t i = 0; i < 8u; ++i) c.tr[bound / sizeof(uint32_t) + i] = canary;
+
+    c.what  = "result";
+    c.reg   = -1;
+    c.bytes = __fix_instructions(c.win, c.count, c.tr);
+    if (c.bytes > bound || (c.bytes & 3u) != 0u) {
+        c.what = "trampoline size";
+        return CHECK_FAIL;
+    }
+    for (uintptr_t i = 0; i < 8u; ++i) {
+        if (c.tr[bound / sizeof(uint32_t) + i] != canary) {
+            c.what = "write past trampoline bound";
+            return CHECK_FAIL;
+        }
+    }
+
+    // A64Relocate 在局部缓冲区中按指定的虚拟地址修复, 结果必须与原位修复逐字节相同;
+    // map 单调不减(PRFM 不产生任何指令)
+    A64RelocRequest req;
+    req.src      = env.image;
+    req.src_size = IMAGE_BYTES;
+    req.src_va   = reinterpret_cast<uint64_t>(env.image);
+    req.pc       = reinterpret_cast<uint64_t>(c.win);
+    req.dst_va   = reinterpret_cast<uint64_t>(c.tr);
+    req.count    = c.count;
+    uint8_t  out[A64_RELOC_MAX_BYTES];
+    uint32_t map[A64_MAX_INSTRUCTIONS + 1];
+    if (A64Relocate(&req, out, sizeof(out), map) != static_cast<intptr_t>(c.bytes) || memcmp(out, c.tr, c.bytes) != 0) {
+        c.what = "A64Relocate output";
+        return CHECK_FAIL;
+    }
+    for (int32_t i = 0; i <= c.count; ++i) {
+        if (map[i] >= c.bytes || (map[i] & 3u) != 0u || (i > 0 && map[i] < map[i - 1])) {
+            c.what = "A64Relocate map";
+            return CHECK_FAIL;
+        }
+    }
+
+    const uint64_t win_lo = reinterpret_cast<uint64_t>(c.win), win_hi = win_lo + static_cast<uint64_t>(c.count) * 4u;
+    const uint64_t tr_lo  = reinterpret_cast<uint64_t>(c.tr), tr_hi = tr_lo + c.bytes;
+    random_state(c.o);
+    c.t    = c.o;
+    c.o.pc = win_lo;
+    c.t.pc = tr_lo;
+    c.ro   = env.emu.run(c.o, win_lo, win_hi, ORIGINAL_STEPS);
+    if (c.ro == A64_EMU_EXIT && c.o.pc >= tr_lo && c.o.pc < tr_hi) {
+        return CHECK_SKIP;  // 原始窗口恰好跳进了跳板所在的地址范围, 无法区分
+    }
+    // 每条原始指令最多展开为 9 条, 循环的每一轮在跳板中最多多执行这么多步
+    c.rt = env.emu.run(c.t, tr_lo, tr_hi, ORIGINAL_STEPS * 16u);
+    if (!equivalence) return CHECK_PASS;
+
+    if (c.ro == A64_EMU_TIMEOUT) {
+        return c.rt == A64_EMU_TIMEOUT || c.rt == A64_EMU_EXIT ? CHECK_LOOP : CHECK_FAIL;
+    }
+    return c.ro == c.rt && (c.ro != A64_EMU_EXIT || compare(c)) ? CHECK_PASS : CHECK_FAIL;
+}
+
+static void dump_failure(const uint64_t index, const reloc_case &c)
+{
+    fprintf(stderr, "case %" PRIu64 " (%s): mismatch in %s", index, placement_names[c.p], c.what);
+    if (c.reg >= 0) fprintf(stderr, "%d", c.reg);
+    fprintf(stderr, "\n  window     @%p:", static_cast<const void *>(c.win));
+    for (int32_t i = 0; i < c.count; ++i) fprintf(stderr, " %08x", c.win[i]);
+    fprintf(stderr, "\n  trampoline @%p:", static_cast<const void *>(c.tr));
+    for (uintptr_t i = 0; i < c.bytes / sizeof(uint32_t); ++i) fprintf(stderr, " %08x", c.tr[i]);
+    fprintf(stderr, "\n  original:   result %d, pc 0x%" PRIx64 ", nzcv %x", c.ro, c.o.pc, c.o.nzcv);
+    fprintf(stderr, "\n  relocated:  result %d, pc 0x%" PRIx64 ", nzcv %x", c.rt, c.t.pc, c.t.nzcv);
+    if (c.reg >= 0 && c.what[0] == 'x') {
+        fprintf(stderr, "\n  x%d: 0x%" PRIx64 " vs 0x%" PRIx64, c.reg, c.o.x[c.reg], c.t.x[c.reg]);
+    }
+    fprintf(stderr, "\n");
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * reloc_verify: 指令修复(__fix_instructions)的差分验证, 可以在任意主机上运行
+ *
+ * 用法: reloc_verify [--cases n] [--seed s] [--verbose]
+ *
+ * 每个用例随机生成一个 1~5 条指令的窗口, 依次修复到 near/mid/far 三种位置的跳板,
+ * 用 tests/a64_emu.hpp 分别执行原始窗口和跳板并比较结果, 见 tests/reloc_check.hpp。
+ */
+#define  A64_HOST_RELOCATOR
+#define  A64_LOG_SINK 0
+#include "../And64InlineHook.cpp"
+#include "reloc_check.hpp"
+
+#define MAX_FAILURES 10
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) * 1e9 + static_cast<double>(ts.tv_nsec);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t cases   = 1000000u;
+    uint64_t seed    = static_cast<uint64_t>(time(NULL));
+    bool     verbose = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--cases") == 0 && i + 1 < argc) {
+            cases = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [--cases n] [--seed s] [--verbose]\n", argv[0]);
+            return 2;
+        }
+    }
+    rng_seed(seed);
+
+    reloc_env env;
+    if (!reloc_env_init(env)) return 1;
+
+    uint64_t kinds[KINDS] = { 0u }, results[CHECK_FAIL + 1] = { 0u }, expanded[PLACEMENTS] = { 0u };
+    uint64_t max_bytes = 0u;
+    int      failures  = 0;
+    const double t0 = now_ns();
+    for (uint64_t n = 0; n < cases && failures < MAX_FAILURES; ++n) {
+        // 窗口大小覆盖近跳转(1 条)和远跳转(4 或 5 条)
+        reloc_case c;
+        place_window(env, c, static_cast<placement>(n % PLACEMENTS), static_cast<int32_t>(1u + rnd(A64_MAX_INSTRUCTIONS)));
+        gen_window(c, kinds);
+
+        const check_result r = check_case(env, c, true);
+        ++results[r];
+        if (c.bytes > max_bytes) max_bytes = c.bytes;
+        if (c.bytes > static_cast<uintptr_t>(c.count + 1) * sizeof(uint32_t)) ++expanded[c.p];
+        if (r == CHECK_FAIL) {
+            dump_failure(n, c);
+            ++failures;
+        }
+    }
+    const double elapsed = now_ns() - t0;
+
+    printf("reloc_verify: seed 0x%" PRIx64 ", %" PRIu64 " cases in %.2fs (%.0f cases/s), %d failures\n",
+           seed, cases, elapsed / 1e9, static_cast<double>(cases) * 1e9 / elapsed, failures);
+    if (verbose) {
+        printf("  looping %" PRIu64 ", skipped %" PRIu64 ", max trampoline %" PRIu64 " bytes\n",
+               results[CHECK_LOOP], results[CHECK_SKIP], max_bytes);
+        for (int p = 0; p < PLACEMENTS; ++p) {
+            printf("  %-4s expanded %" PRIu64 "\n", placement_names[p], expanded[p]);
+        }
+        for (int k = 0; k < KINDS; ++k) {
+            printf("  %-10s %" PRIu64 "\n", kind_names[k], kinds[k]);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ * a64_extract_prologues: 从 AArch64 ELF 文件中提取函数序言, 生成重定位基准测试的语料
+ *
+ * 在任意主机上运行, 支持链接后的可执行文件和共享库。优先使用 .symtab,
+ * 没有时使用 .dynsym; 只提取 STT_FUNC 类型、位于 SHT_PROGBITS 节中的符号。
+ * 不处理重定位, 因此拒绝目标文件(.o): 其中 BL/B/ADRP 等的立即数都还是 0。
+ *
+ * 用法: a64_extract_prologues [-n words] [-u] <elf file>...
+ *   -n: 每个函数最多提取的指令数(默认 8, 最大 16)
+ *   -u: 去掉指令序列完全相同的条目
+ *
+ * 输出格式(每行一个函数, # 开头为注释):
+ *   <name> <vaddr> <w0> <w1> ...
+ * vaddr 是函数的虚拟地址, 指令字均为 8 位十六进制数。
+ */
+#define  __STDC_FORMAT_MACROS
+#include <elf.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    uint8_t buf[65536];
+    size_t  n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    const bool ok = ferror(fp) == 0;
+    fclose(fp);
+    return ok;
+}
+
+/*
+ * in_bounds: 判断 [off, off + size) 是否完全位于文件内
+ */
+static bool in_bounds(const std::vector<uint8_t> &data, const uint64_t off, const uint64_t size)
+{
+    return off <= data.size() && size <= data.size() - off;
+}
+
+static int extract(const char *path, const unsigned max_words, std::set<std::vector<uint32_t> > *seen)
+{
+    std::vector<uint8_t> data;
+    if (!read_file(path, data)) {
+        fprintf(stderr, "failed to read %s\n", path);
+        return 1;
+    }
+
+    Elf64_Ehdr eh;
+    if (data.size() < sizeof(eh) || memcmp(data.data(), ELFMAG, SELFMAG) != 0) {
+        fprintf(stderr, "%s: not an ELF file\n", path);
+        return 1;
+    }
+    memcpy(&eh, data.data(), sizeof(eh));
+    if (eh.e_ident[EI_CLASS] != ELFCLASS64 || eh.e_ident[EI_DATA] != ELFDATA2LSB || eh.e_machine != EM_AARCH64) {
+        fprintf(stderr, "%s: not a little-endian AArch64 ELF file\n", path);
+        return 1;
+    }
+    if (eh.e_type != ET_EXEC && eh.e_type != ET_DYN) {
+        fprintf(stderr, "%s: relocatable object, link it first (immediates are not relocated)\n", path);
+        return 1;
+    }
+    if (eh.e_shentsize != sizeof(Elf64_Shdr) || !in_bounds(data, eh.e_shoff, static_cast<uint64_t>(eh.e_shnum) * sizeof(Elf64_Shdr))) {
+        fprintf(stderr, "%s: bad section header table\n", path);
+        return 1;
+    }
+
+    std::vector<Elf64_Shdr> sh(eh.e_shnum);
+    memcpy(sh.data(), data.data() + eh.e_shoff, sh.size() * sizeof(Elf64_Shdr));
+
+    // 优先 .symtab, 没有时使用 .dynsym
+    int symtab = -1;
+    for (size_t i = 0; i < sh.size(); ++i) {
+        if (sh[i].sh_type == SHT_SYMTAB) symtab = static_cast<int>(i);
+        if (sh[i].sh_type == SHT_DYNSYM && symtab < 0) symtab = static_cast<int>(i);
+    }
+    if (symtab < 0 || sh[symtab].sh_link >= sh.size()) {
+        fprintf(stderr, "%s: no symbol table\n", path);
+        return 1;
+    }
+    const Elf64_Shdr &st = sh[symtab];
+    const Elf64_Shdr &strtab = sh[st.sh_link];
+    if (!in_bounds(data, st.sh_offset, st.sh_size) || !in_bounds(data, strtab.sh_offset, strtab.sh_size)) {
+        fprintf(stderr, "%s: bad symbol table\n", path);
+        return 1;
+    }
+
+    printf("# %s\n", path);
+    const size_t nsyms = st.sh_size / sizeof(Elf64_Sym);
+    for (size_t i = 0; i < nsyms; ++i) {
+        Elf64_Sym sym;
+        memcpy(&sym, data.data() + st.sh_offset + i * sizeof(Elf64_Sym), sizeof(sym));
+        if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_shndx == SHN_UNDEF || sym.st_shndx >= sh.size()) continue;
+
+        const Elf64_Shdr &sec = sh[sym.st_shndx];
+        if (sec.sh_type != SHT_PROGBITS || sym.st_value < sec.sh_addr) continue;
+        const uint64_t off = sec.sh_offset + (sym.st_value - sec.sh_addr);
+
+        // 函数大小未知时按最大指令数提取, 但不越过所在节的末尾
+        uint64_t bytes = sym.st_size != 0u ? sym.st_size : max_words * 4u;
+        if (bytes > max_words * 4u) bytes = max_words * 4u;
+        if (sym.st_value - sec.sh_addr + bytes > sec.sh_size) bytes = sec.sh_size - (sym.st_value - sec.sh_addr);
+        bytes &= ~static_cast<uint64_t>(3u);
+        if (bytes == 0u || !in_bounds(data, off, bytes)) continue;
+
+        std::vector<uint32_t> words(bytes / 4u);
+        memcpy(words.data(), data.data() + off, bytes);
+        if (seen != NULL && !seen->insert(words).second) continue;
+
+        const char *name = sym.st_name < strtab.sh_size ? reinterpret_cast<const char *>(data.data() + strtab.sh_offset + sym.st_name) : "";
+        printf("%s 0x%" PRIx64, name[0] != '\0' ? name : "?", static_cast<uint64_t>(sym.st_value));
+        for (size_t k = 0; k < words.size(); ++k) printf(" %08x", words[k]);
+        printf("\n");
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned max_words = 8u;
+    bool     unique    = false;
+    int      first     = 1;
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        if (strcmp(argv[first], "-n") == 0 && first + 1 < argc) {
+            max_words = static_cast<unsigned>(atoi(argv[++first]));
+        } else if (strcmp(argv[first], "-u") == 0) {
+            unique = true;
+        } else {
+            break;
+        }
+    }
+    if (first >= argc || max_words == 0u || max_words > 16u) {
+        fprintf(stderr, "usage: %s [-n words] [-u] <elf file>...\n", argv[0]);
+        return 2;
+    }
+
+    printf("# a64 prologue corpus: <name> <vaddr> <words>...\n");
+    std::set<std::vector<uint32_t> > seen;
+    int rc = 0;
+    for (int i = first; i < argc; ++i) {
+        rc |= extract(argv[i], max_words, unique ? &seen : NULL);
+    }
+    return rc;
+}
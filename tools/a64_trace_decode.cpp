@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2025-2026 fei_cong(https://github.com/feicong/feicong-course)
+ *
+ *  https://github.com/Rprop/And64InlineHook
+ */
+/*
+ MIT License
+
+ Copyright (c) 2018 Rprop (r_prop@outlook.com)
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+/*
+ * a64_trace_decode: 调用追踪文件解码工具
+ *
+ * 在任意主机(不要求 AArch64)上解析 A64TraceStart 生成的追踪文件。
+ *
+ * 用法: a64_trace_decode [-c] [-s] <trace file>
+ *   默认: 按文件顺序逐条输出记录
+ *   -c:   以 CSV 格式输出记录
+ *   -s:   只输出每个 hook 的调用次数和耗时统计
+ */
+#define  __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../And64InlineHook.hpp"
+
+/*
+ * hook_summary: 单个 hook 的汇总统计(-s)
+ */
+struct hook_summary
+{
+    uint64_t calls;
+    uint64_t total_ticks;
+    uint64_t max_ticks;
+};
+
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    uint8_t buf[65536];
+    size_t  n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    const bool ok = ferror(fp) == 0;
+    fclose(fp);
+    return ok;
+}
+
+/*
+ * parse_names: 解析名称表, 每行 "<id>\t<symbol>\t<name>\n"
+ */
+static void parse_names(const char *p, const char *end, std::map<uint32_t, std::string> &names)
+{
+    while (p < end) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        if (eol == NULL) eol = end;
+
+        std::string line(p, eol);
+        const size_t t1 = line.find('\t');
+        const size_t t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+        if (t2 != std::string::npos) {
+            const uint32_t id = static_cast<uint32_t>(strtoul(line.c_str(), NULL, 10));
+            std::string name  = line.substr(t2 + 1);
+            names[id] = name.empty() ? line.substr(t1 + 1, t2 - t1 - 1) : name;
+        }
+        p = eol + 1;
+    }
+}
+
+static double ticks_to_ns(const uint64_t ticks, const uint64_t freq)
+{
+    return freq != 0u ? static_cast<double>(ticks) * 1e9 / static_cast<double>(freq) : static_cast<double>(ticks);
+}
+
+int main(int argc, char *argv[])
+{
+    bool csv = false, summary = false;
+    const char *path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            summary = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [-c] [-s] <trace file>\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> data;
+    if (!read_file(path, data)) {
+        fprintf(stderr, "failed to read %s\n", path);
+        return 1;
+    }
+
+    A64TraceFileHeader hdr;
+    if (data.size() < sizeof(hdr)) {
+        fprintf(stderr, "%s: file too small\n", path);
+        return 1;
+    }
+    memcpy(&hdr, data.data(), sizeof(hdr));
+    if (memcmp(hdr.magic, A64_TRACE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != A64_TRACE_VERSION) {
+        fprintf(stderr, "%s: not an A64 trace file (or unsupported version)\n", path);
+        return 1;
+    }
+    if (hdr.record_size < sizeof(A64TraceRecord) || hdr.header_size < sizeof(hdr)) {
+        fprintf(stderr, "%s: unexpected record size %u\n", path, hdr.record_size);
+        return 1;
+    }
+    if (hdr.header_size > data.size()) {
+        fprintf(stderr, "%s: truncated header (%u of %zu bytes)\n", path, hdr.header_size, data.size());
+        return 1;
+    }
+
+    std::map<uint32_t, std::string> names;
+    if (hdr.names_offset != 0u && hdr.names_offset <= data.size() && hdr.names_size <= data.size() - hdr.names_offset) {
+        const char *p = reinterpret_cast<const char *>(data.data() + hdr.names_offset);
+        parse_names(p, p + hdr.names_size, names);
+    }
+
+    uint64_t count = hdr.record_count;
+    const uint64_t avail = (data.size() - hdr.header_size) / hdr.record_size;
+    if (count > avail) {
+        fprintf(stderr, "%s: truncated, %" PRIu64 " of %" PRIu64 " records present\n", path, avail, count);
+        count = avail;
+    }
+
+    std::map<uint32_t, hook_summary> sums;
+    if (csv && !summary) {
+        printf("tid,hook_id,name,enter_ns,duration_ns,x0,x1,x2,x3,retval\n");
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        A64TraceRecord r;
+        memcpy(&r, data.data() + hdr.header_size + i * hdr.record_size, sizeof(r));
+
+        const uint64_t ticks = r.leave_ts - r.enter_ts;
+        if (summary) {
+            hook_summary &s = sums[r.hook_id];
+            ++s.calls;
+            s.total_ticks += ticks;
+            if (ticks > s.max_ticks) s.max_ticks = ticks;
+            continue;
+        }
+
+        const std::string &name = names[r.hook_id];
+        printf(csv ? "%u,%u,%s,%.0f,%.0f,0x%" PRIx64 ",0x%" PRIx64 ",0x%" PRIx64 ",0x%" PRIx64 ",0x%" PRIx64 "\n"
+                   : "[%u] %u %s @%.0fns +%.0fns (0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64 ") = 0x%" PRIx64 "\n",
+               r.tid, r.hook_id, name.c_str(),
+               ticks_to_ns(r.enter_ts, hdr.counter_freq), ticks_to_ns(ticks, hdr.counter_freq),
+               r.args[0], r.args[1], r.args[2], r.args[3], r.retval);
+    }
+
+    if (summary) {
+        printf("%-8s %-32s %12s %14s %14s\n", "hook_id", "name", "calls", "avg_ns", "max_ns");
+        for (std::map<uint32_t, hook_summary>::const_iterator it = sums.begin(); it != sums.end(); ++it) {
+            const hook_summary &s = it->second;
+            printf("%-8u %-32s %12" PRIu64 " %14.1f %14.1f\n", it->first, names[it->first].c_str(), s.calls,
+                   ticks_to_ns(s.total_ticks, hdr.counter_freq) / static_cast<double>(s.calls),
+                   ticks_to_ns(s.max_ticks, hdr.counter_freq));
+        }
+    }
+
+    if (hdr.lost_count != 0u) {
+        fprintf(stderr, "%" PRIu64 " records were lost\n", hdr.lost_count);
+    }
+    return 0;
+}